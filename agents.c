@@ -0,0 +1,459 @@
+/*  Headless multi-agent simulation, for load tests.
+ *
+ *  Many agents walk the same maze at once, each from cell center to cell
+ *  center, choosing where to go next with a policy:  following the wall
+ *  on their right, or walking down the distance field to the end cell.
+ *  Agents that reach the end start again from a random cell.  Nothing is
+ *  drawn; the program reports how many agent-steps per second it ran.
+ *
+ *  Usage:  agents WIDTH HEIGHT [options]
+ *      --agents N: simulate N agents (default 10000).
+ *      --steps N: run N steps of STEP_SECS seconds (default 1000).
+ *      --threads N: use N threads (default one per processor).
+ *      --policy wall|field: the policy (default wall).  Following the
+ *          wall only finds the end of a perfect maze, so in a braided maze
+ *          the field policy is used instead.
+ *      --braid F: braid the fraction F of the maze's dead ends (default
+ *          0); see maze_opts_t.
+ *      --seed N: seed the maze and agents with N instead of the time.
+ *      --mazed PATH: fetch the maze from the maze daemon listening on
+ *          PATH (see mazed.h), making it here if the daemon cannot.
+ *
+ *  The agents are kept as a structure of arrays, and the agents are split
+ *  into ranges, one per thread.  Agents do not interact, so each thread
+ *  runs every step of its own range without waiting for the others.
+ *  Each step is a loop over the range with no branches that moves every
+ *  agent and keeps it out of the walls of its cell, which the compiler
+ *  can vectorize, followed by a pass that gives the agents that have
+ *  reached their target cell a new one.
+ */
+
+#include <math.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "maze.h"
+#include "mazed.h"
+
+#define DEFAULT_AGENTS 10000
+#define DEFAULT_STEPS 1000
+
+// Agents move like the player in hw4:  at AGENT_SPEED units per second,
+// keeping AGENT_RADIUS from the middle of the walls.  Each step turns an
+// agent's heading STEER of the way toward its target, so agents cut
+// corners and are stopped by walls, and an agent within ARRIVE_DIST of
+// its target has reached it.
+#define STEP_SECS 0.01f
+#define AGENT_SPEED 2.0f
+#define AGENT_RADIUS 0.275f
+#define STEER 0.2f
+#define ARRIVE_DIST 0.25f
+
+// Agent ranges start on multiples of RANGE_ALIGN agents, so that threads
+// do not share cache lines of the arrays.
+#define RANGE_ALIGN 16
+
+/*  The policies.
+ */
+typedef enum _policy_t {
+    PolicyWall,
+    PolicyField
+} policy_t ;
+
+/*  The agents.  Agent i is at (r[i], c[i]) in the frame in which cell
+ *  (r, c) is the unit square [r, r+1) x [c, c+1), heading in the
+ *  direction of the unit vector (hr[i], hc[i]) toward the center
+ *  (tr[i], tc[i]) of the cell it is walking to.  dir[i] is the direction
+ *  it last chose, as an index into dir_bits, and arrived[i] is set by
+ *  each step if it has reached its target.  walls[i] holds the passages of
+ *  the cell it is in during a step.
+ */
+typedef struct _agents_t {
+    int n ;
+    float *r, *c ;
+    float *hr, *hc ;
+    float *tr, *tc ;
+    unsigned char* dir ;
+    unsigned char* arrived ;
+    unsigned char* walls ;
+} agents_t ;
+
+/*  A thread's range of agents and what it counted.
+ */
+typedef struct _worker_t {
+    int first, last ;
+    uint64_t rng ;
+    long reached ;
+    long contacts ;
+    pthread_t thread ;
+} worker_t ;
+
+/*  The maze, its passages as one bitmask per cell (row by row), and for
+ *  the field policy the number of steps from each cell to the
+ *  end.
+ */
+maze_t* maze ;
+int nrows, ncols ;
+size_t end_cell ;
+const unsigned char* passages ;
+int* field ;
+
+// Directions in clockwise order, and the row and column steps of each.
+unsigned char dir_bits[] = {NORTH, EAST, SOUTH, WEST} ;
+int dir_dr[] = {1, 0, -1, 0} ;
+int dir_dc[] = {0, 1, 0, -1} ;
+
+agents_t agents ;
+policy_t policy = PolicyWall ;
+int nsteps = DEFAULT_STEPS ;
+
+void make_field() ;
+void make_agents(int, uint64_t*) ;
+void *run_worker(void*) ;
+void step_agents(int, int, long*) ;
+void choose_targets(worker_t*) ;
+int choose_dir(size_t, int) ;
+size_t random_cell(uint64_t*) ;
+
+int main(int argc, char **argv) {
+    if (argc < 3) {
+        fprintf(stderr, "Usage: %s WIDTH HEIGHT [options]\n", argv[0]) ;
+        return EXIT_FAILURE ;
+    }
+    ncols = atoi(argv[1]) ;
+    nrows = atoi(argv[2]) ;
+
+    int nagents = DEFAULT_AGENTS ;
+    int nthreads = sysconf(_SC_NPROCESSORS_ONLN) ;
+    long seed = time(NULL) ;
+    maze_opts_t opts = {MAZE_ROW_MAJOR, 0} ;
+    char* mazed_path = NULL ;
+    for (int i=3; i<argc; ++i) {
+        if (strcmp(argv[i], "--agents") == 0 && i+1 < argc) {
+            nagents = atoi(argv[++i]) ;
+        } else if (strcmp(argv[i], "--steps") == 0 && i+1 < argc) {
+            nsteps = atoi(argv[++i]) ;
+        } else if (strcmp(argv[i], "--threads") == 0 && i+1 < argc) {
+            nthreads = atoi(argv[++i]) ;
+        } else if (strcmp(argv[i], "--seed") == 0 && i+1 < argc) {
+            seed = atol(argv[++i]) ;
+        } else if (strcmp(argv[i], "--braid") == 0 && i+1 < argc) {
+            opts.braid = atof(argv[++i]) ;
+        } else if (strcmp(argv[i], "--mazed") == 0 && i+1 < argc) {
+            mazed_path = argv[++i] ;
+        } else if (strcmp(argv[i], "--policy") == 0 && i+1 < argc) {
+            ++i ;
+            if (strcmp(argv[i], "wall") == 0) policy = PolicyWall ;
+            else if (strcmp(argv[i], "field") == 0) policy = PolicyField ;
+            else {
+                fprintf(stderr, "Unknown policy %s\n", argv[i]) ;
+                return EXIT_FAILURE ;
+            }
+        } else {
+            fprintf(stderr, "Unknown option %s\n", argv[i]) ;
+            return EXIT_FAILURE ;
+        }
+    }
+    if (nthreads < 1) nthreads = 1 ;
+
+    if (mazed_path != NULL) {
+        maze = fetch_maze(mazed_path, nrows, ncols, seed, &opts) ;
+        if (maze == NULL) {
+            fprintf(stderr, "Could not fetch the maze from %s; making it\n",
+                    mazed_path) ;
+        }
+    }
+    if (maze == NULL) maze = make_maze_opts(nrows, ncols, seed, &opts) ;
+    if (maze == NULL) {
+        fprintf(stderr, "Not enough memory for a %dx%d maze\n", nrows, ncols) ;
+        return EXIT_FAILURE ;
+    }
+    if (policy == PolicyWall && !is_perfect(maze)) {
+        fprintf(stderr, "The maze is braided; using the field policy\n") ;
+        policy = PolicyField ;
+    }
+    cell_t* end = get_end(maze) ;
+    end_cell = (size_t)end->r*ncols + end->c ;
+    passages = get_row_span(maze, 0, nrows) ;
+    if (policy == PolicyField) make_field() ;
+
+    uint64_t rng = (uint64_t)seed*0x9e3779b97f4a7c15ULL | 1 ;
+    make_agents(nagents, &rng) ;
+
+    // Split the agents into aligned ranges, one per thread.
+    worker_t* workers = calloc(nthreads, sizeof(worker_t)) ;
+    int per = (nagents/nthreads + RANGE_ALIGN-1)/RANGE_ALIGN*RANGE_ALIGN ;
+    for (int t=0; t<nthreads; ++t) {
+        workers[t].first = t*per < nagents ? t*per : nagents ;
+        workers[t].last = (t+1)*per < nagents && t < nthreads-1 ?
+            (t+1)*per : nagents ;
+        workers[t].rng = rng ^ ((uint64_t)(t+1)*0xbf58476d1ce4e5b9ULL) ;
+    }
+
+    struct timespec start, finish ;
+    clock_gettime(CLOCK_MONOTONIC, &start) ;
+    for (int t=0; t<nthreads; ++t) {
+        pthread_create(&workers[t].thread, NULL, run_worker, &workers[t]) ;
+    }
+    long reached = 0, contacts = 0 ;
+    for (int t=0; t<nthreads; ++t) {
+        pthread_join(workers[t].thread, NULL) ;
+        reached += workers[t].reached ;
+        contacts += workers[t].contacts ;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &finish) ;
+
+    double secs = (finish.tv_sec-start.tv_sec) +
+        (finish.tv_nsec-start.tv_nsec)/1.0e9 ;
+    double agent_steps = (double)nagents*nsteps ;
+    printf("maze: %dx%d  agents: %d  steps: %d  threads: %d  policy: %s\n",
+            ncols, nrows, nagents, nsteps, nthreads,
+            policy == PolicyWall ? "wall" : "field") ;
+    printf("agent-steps: %.0f in %.3f s  (%.0f agent-steps/s)\n",
+            agent_steps, secs, agent_steps/secs) ;
+    printf("reached end: %ld  wall contacts: %ld\n", reached, contacts) ;
+
+    free(workers) ;
+    free(agents.r) ;
+    free(agents.c) ;
+    free(agents.hr) ;
+    free(agents.hc) ;
+    free(agents.tr) ;
+    free(agents.tc) ;
+    free(agents.dir) ;
+    free(agents.arrived) ;
+    free(agents.walls) ;
+    free(field) ;
+    free_maze(maze) ;
+    return EXIT_SUCCESS ;
+}
+
+/*  Compute the distance field:  the number of steps from each cell to the
+ *  end cell, by a breadth-first search out from the end.
+ */
+void make_field() {
+    size_t ncells = (size_t)nrows*ncols ;
+    field = malloc(ncells*sizeof(int)) ;
+    size_t* queue = malloc(ncells*sizeof(size_t)) ;
+    for (size_t k=0; k<ncells; ++k) field[k] = -1 ;
+
+    size_t head = 0, tail = 0 ;
+    field[end_cell] = 0 ;
+    queue[tail++] = end_cell ;
+    while (head < tail) {
+        size_t k = queue[head++] ;
+        int r = k/ncols, c = k%ncols ;
+        for (int d=0; d<4; ++d) {
+            if ((passages[k] & dir_bits[d]) == 0) continue ;
+            size_t n = (size_t)(r+dir_dr[d])*ncols + c+dir_dc[d] ;
+            if (field[n] >= 0) continue ;
+            field[n] = field[k]+1 ;
+            queue[tail++] = n ;
+        }
+    }
+    free(queue) ;
+}
+
+/*  Get a random number (xorshift64*).
+ */
+static uint64_t next_random(uint64_t* rng) {
+    *rng ^= *rng >> 12 ;
+    *rng ^= *rng << 25 ;
+    *rng ^= *rng >> 27 ;
+    return *rng*0x2545f4914f6cdd1dULL ;
+}
+
+/*  Choose a cell at random.  Mazes of more cells than 32 bits can count
+ *  draw from all 64 bits of the random number.
+ *
+ *  @param rng the random number generator.
+ *  @return the index of the cell.
+ */
+size_t random_cell(uint64_t* rng) {
+    uint64_t ncells = (uint64_t)nrows*ncols ;
+    uint64_t x = next_random(rng) ;
+    return (ncells >> 32 == 0 ? x >> 32 : x) % ncells ;
+}
+
+/*  Make the agents, each at the center of a random cell with its own
+ *  cell as its target, so that each chooses where to go on the first step.
+ *
+ *  @param n the number of agents.
+ *  @param rng the random number generator.
+ */
+void make_agents(int n, uint64_t* rng) {
+    agents.n = n ;
+    agents.r = malloc(n*sizeof(float)) ;
+    agents.c = malloc(n*sizeof(float)) ;
+    agents.hr = malloc(n*sizeof(float)) ;
+    agents.hc = malloc(n*sizeof(float)) ;
+    agents.tr = malloc(n*sizeof(float)) ;
+    agents.tc = malloc(n*sizeof(float)) ;
+    agents.dir = malloc(n) ;
+    agents.arrived = malloc(n) ;
+    agents.walls = malloc(n) ;
+    for (int i=0; i<n; ++i) {
+        size_t k = random_cell(rng) ;
+        agents.r[i] = agents.tr[i] = k/ncols + 0.5f ;
+        agents.c[i] = agents.tc[i] = k%ncols + 0.5f ;
+        agents.dir[i] = next_random(rng) >> 62 ;
+        agents.hr[i] = dir_dr[agents.dir[i]] ;
+        agents.hc[i] = dir_dc[agents.dir[i]] ;
+    }
+}
+
+/*  A worker thread:  run every step for the worker's range of agents.
+ *
+ *  @param arg the worker_t.
+ *  @return NULL.
+ */
+void *run_worker(void *arg) {
+    worker_t* w = arg ;
+    for (int s=0; s<nsteps; ++s) {
+        step_agents(w->first, w->last, &w->contacts) ;
+        choose_targets(w) ;
+    }
+    return NULL ;
+}
+
+/*  Move agents one step.  Each agent turns toward its target and moves
+ *  toward it, then is pushed back out of any wall of the cell it started
+ *  the step in, by clamping each coordinate against the walls of that one
+ *  cell with selects instead of branches.  Unlike move_circles in the maze
+ *  library this misses the corners of neighboring cells, but agents walk
+ *  between cell centers and only ever graze them.  The
+ *  arrays are passed as restrict parameters so that the compiler knows
+ *  they do not overlap and can vectorize the loop.
+ *
+ *  @param n the number of agents.
+ *  @param r, c, hr, hc, tr, tc, arrived the agents' arrays.
+ *  @param walls the passages of the cell each agent is in.
+ *  @return the number of agents stopped by a wall.
+ */
+static int move_agents(int n, float *restrict r, float *restrict c,
+        float *restrict hr, float *restrict hc, const float *restrict tr,
+        const float *restrict tc, unsigned char *restrict arrived,
+        const unsigned char *restrict walls) {
+    const float step = AGENT_SPEED*STEP_SECS ;
+    int contacts = 0 ;
+
+    for (int i=0; i<n; ++i) {
+        // Turn toward the target.
+        float dr = tr[i]-r[i], dc = tc[i]-c[i] ;
+        float dist = sqrtf(dr*dr + dc*dc) ;
+        float inv = 1.0f/(dist + 1e-6f) ;
+        float nhr = hr[i] + STEER*(dr*inv - hr[i]) ;
+        float nhc = hc[i] + STEER*(dc*inv - hc[i]) ;
+        float hinv = 1.0f/(sqrtf(nhr*nhr + nhc*nhc) + 1e-6f) ;
+        nhr *= hinv ;
+        nhc *= hinv ;
+
+        // Move, but not past the target.
+        float s = dist < step ? dist : step ;
+        float nr = r[i] + nhr*s ;
+        float nc = c[i] + nhc*s ;
+
+        // Keep out of the walls of the cell.  Agents are always inside
+        // the maze, so truncating finds the cell.
+        float fr = (int)r[i], fc = (int)c[i] ;
+        unsigned char p = walls[i] ;
+        float lo_r = (p & SOUTH) ? -INFINITY : fr + AGENT_RADIUS ;
+        float hi_r = (p & NORTH) ? INFINITY : fr + 1 - AGENT_RADIUS ;
+        float lo_c = (p & WEST) ? -INFINITY : fc + AGENT_RADIUS ;
+        float hi_c = (p & EAST) ? INFINITY : fc + 1 - AGENT_RADIUS ;
+        float kr = nr < lo_r ? lo_r : nr > hi_r ? hi_r : nr ;
+        float kc = nc < lo_c ? lo_c : nc > hi_c ? hi_c : nc ;
+        contacts += (kr != nr) | (kc != nc) ;
+
+        r[i] = kr ;
+        c[i] = kc ;
+        hr[i] = nhr ;
+        hc[i] = nhc ;
+        arrived[i] = dist - s < ARRIVE_DIST ;
+    }
+
+    return contacts ;
+}
+
+/*  Move a range of agents one step.  The passages of each agent's cell
+ *  are gathered first, since vector units cannot gather single bytes,
+ *  and then all the agents are moved at once.
+ *
+ *  @param first the first agent.
+ *  @param last one past the last agent.
+ *  @param contacts incremented by the number of agents stopped by a wall.
+ */
+void step_agents(int first, int last, long *contacts) {
+    for (int i=first; i<last; ++i) {
+        agents.walls[i] =
+            passages[(size_t)agents.r[i]*ncols + (size_t)agents.c[i]] ;
+    }
+    *contacts += move_agents(last-first, agents.r+first, agents.c+first,
+            agents.hr+first, agents.hc+first, agents.tr+first,
+            agents.tc+first, agents.arrived+first, agents.walls+first) ;
+}
+
+/*  Give each agent of a worker's range that has reached its target a new
+ *  one, and start agents that have reached the end again from a random
+ *  cell.
+ *
+ *  @param w the worker.
+ */
+void choose_targets(worker_t *w) {
+    for (int i=w->first; i<w->last; ++i) {
+        if (!agents.arrived[i]) continue ;
+        int r = (int)agents.tr[i], c = (int)agents.tc[i] ;
+        size_t k = (size_t)r*ncols + c ;
+        if (k == end_cell) {
+            w->reached++ ;
+            k = random_cell(&w->rng) ;
+            r = k/ncols ;
+            c = k%ncols ;
+            agents.r[i] = r + 0.5f ;
+            agents.c[i] = c + 0.5f ;
+        }
+        int d = choose_dir(k, agents.dir[i]) ;
+        agents.dir[i] = d ;
+        agents.tr[i] = r + dir_dr[d] + 0.5f ;
+        agents.tc[i] = c + dir_dc[d] + 0.5f ;
+    }
+}
+
+/*  Choose the direction to leave a cell in.  With the wall policy, an
+ *  agent turns right if it can, else goes straight, else turns left, else
+ *  goes back.  With the field policy it goes to the neighbor nearest the
+ *  end.
+ *
+ *  @param k the index of the cell.
+ *  @param last the index of the direction the agent came in.
+ *  @return the index of the direction to leave in.
+ */
+int choose_dir(size_t k, int last) {
+    unsigned char p = passages[k] ;
+    if (policy == PolicyWall) {
+        static const int turns[] = {1, 0, 3, 2} ;
+        for (int t=0; t<4; ++t) {
+            int d = (last+turns[t]) & 3 ;
+            if (p & dir_bits[d]) return d ;
+        }
+    } else {
+        int r = k/ncols, c = k%ncols ;
+        int best = last, best_dist = -1 ;
+        for (int d=0; d<4; ++d) {
+            if ((p & dir_bits[d]) == 0) continue ;
+            size_t n = (size_t)(r+dir_dr[d])*ncols + c+dir_dc[d] ;
+            if (best_dist < 0 || field[n] < best_dist) {
+                best = d ;
+                best_dist = field[n] ;
+            }
+        }
+        return best ;
+    }
+    return last ;
+}
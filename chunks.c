@@ -0,0 +1,639 @@
+/** chunks.c:  streaming wall meshes for large mazes.
+ *
+ *  Each chunk is in one of four states.  The GL thread moves absent
+ *  chunks to queued by putting them on the work queue; a builder thread
+ *  takes a queued chunk, builds its mesh and puts it on the built list;
+ *  and the GL thread uploads built chunks into vertex buffers, making them
+ *  resident, and evicts resident chunks back to absent.
+ */
+
+#include <math.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __MACOSX__
+#include <OpenGL/gl.h>
+#elif defined __LINUX__ || defined __CYGWIN__
+#define GL_GLEXT_PROTOTYPES
+#include <GL/gl.h>
+#endif
+
+#include "chunks.h"
+#include "maze.h"
+
+#define D2R(x) ((x)*M_PI/180.0)     // Convert degrees to radians.
+
+// Chunks are CHUNK_CELLS cells on a side.  Vertex positions are in
+// 1/MESH_SCALE units relative to the chunk's corner, which keeps them
+// small enough for shorts.
+#define CHUNK_CELLS 32
+#define CHUNK_RADIUS (CHUNK_CELLS*0.75f)
+#define MESH_SCALE 8
+#define VERTS_PER_WALL 20
+
+// The most chunks queued or being built at once.  Chunks are queued
+// nearest first, so keeping the queue short lets the order follow the
+// camera.
+#define MAX_OUTSTANDING 16
+
+/** A vertex of a wall mesh.
+ */
+typedef struct _mesh_vertex_t {
+    GLshort position[3] ;
+    GLbyte normal[3] ;
+    GLbyte pad ;
+} mesh_vertex_t ;
+
+/** The state of a chunk.  A dropped chunk was built but could not be
+ *  uploaded; it is only built again once there is room for it.
+ */
+typedef enum _chunk_state_t {
+    ChunkAbsent,
+    ChunkQueued,
+    ChunkBuilt,
+    ChunkResident,
+    ChunkDropped
+} chunk_state_t ;
+
+/** A chunk mesh that has been built but not uploaded.
+ */
+typedef struct _built_chunk_t {
+    int chunk ;
+    mesh_vertex_t* vertices ;
+    int nverts ;
+    struct _built_chunk_t* next ;
+} built_chunk_t ;
+
+/** A resident chunk.
+ */
+typedef struct _slot_t {
+    int chunk ;
+    GLuint vbo ;
+    int nverts ;
+    unsigned long last_wanted ;
+} slot_t ;
+
+/** A wanted chunk and how far it is from the point ahead of the camera.
+ */
+typedef struct _want_t {
+    int chunk ;
+    float dist ;
+} want_t ;
+
+/** Type of a chunk cache.
+ */
+struct _chunk_cache_t {
+    /** The maze, its size in chunks on each level, and its number of
+     *  levels.  Chunks are numbered level by level, row by row.
+     */
+    maze_t* maze ;
+    int chunk_rows, chunk_cols ;
+    int nlevels ;
+
+    /** The state of each chunk, the slot of each resident chunk, and
+     *  the number of vertices of each dropped chunk.
+     */
+    unsigned char* state ;
+    int* slot_of ;
+
+    /** The resident chunks.
+     */
+    slot_t* slots ;
+    int nslots, max_slots ;
+    size_t resident_bytes ;
+
+    /** Budgets, and the update count used to find the least recently
+     *  wanted chunk.
+     */
+    size_t resident_budget ;
+    size_t upload_budget ;
+    unsigned long update ;
+
+    /** Statistics for the last update.
+     */
+    int uploaded, evicted ;
+
+    /** The wanted chunks of the last update, nearest first.
+     */
+    want_t* wanted ;
+    int nwanted, max_wanted ;
+
+    /** The builder threads.  The work queue, the number of chunks being
+     *  built, and the built list are guarded by lock.
+     */
+    int nthreads ;
+    pthread_t* threads ;
+    pthread_mutex_t lock ;
+    pthread_cond_t work_ready ;
+    pthread_cond_t idle ;
+    int* queue ;
+    int queue_head, queue_len ;
+    int building ;
+    built_chunk_t* built ;
+    bool quit ;
+} ;
+
+static void* run_builder(void* arg) ;
+
+/** Make a chunk cache; see chunks.h.
+ */
+chunk_cache_t* make_chunk_cache(size_t resident_budget, size_t upload_budget,
+        int nthreads) {
+    chunk_cache_t* cc = calloc(1, sizeof(chunk_cache_t)) ;
+    cc->resident_budget = resident_budget ;
+    cc->upload_budget = upload_budget ;
+    cc->queue = malloc(MAX_OUTSTANDING*sizeof(int)) ;
+    cc->nthreads = nthreads < 1 ? 1 : nthreads ;
+    cc->threads = malloc(cc->nthreads*sizeof(pthread_t)) ;
+
+    pthread_mutex_init(&cc->lock, NULL) ;
+    pthread_cond_init(&cc->work_ready, NULL) ;
+    pthread_cond_init(&cc->idle, NULL) ;
+    for (int i=0; i<cc->nthreads; ++i) {
+        pthread_create(&cc->threads[i], NULL, run_builder, cc) ;
+    }
+
+    return cc ;
+}
+
+/** Free a chunk cache; see chunks.h.
+ */
+void free_chunk_cache(chunk_cache_t* cc) {
+    set_chunk_maze(cc, NULL) ;
+
+    pthread_mutex_lock(&cc->lock) ;
+    cc->quit = true ;
+    pthread_cond_broadcast(&cc->work_ready) ;
+    pthread_mutex_unlock(&cc->lock) ;
+    for (int i=0; i<cc->nthreads; ++i) pthread_join(cc->threads[i], NULL) ;
+
+    pthread_mutex_destroy(&cc->lock) ;
+    pthread_cond_destroy(&cc->work_ready) ;
+    pthread_cond_destroy(&cc->idle) ;
+    free(cc->threads) ;
+    free(cc->queue) ;
+    free(cc->wanted) ;
+    free(cc) ;
+}
+
+/** Switch to a new maze; see chunks.h.
+ */
+void set_chunk_maze(chunk_cache_t* cc, maze_t* m) {
+    // Empty the queue, wait for the builders, and drop what they built.
+    pthread_mutex_lock(&cc->lock) ;
+    cc->queue_len = 0 ;
+    while (cc->building > 0) pthread_cond_wait(&cc->idle, &cc->lock) ;
+    built_chunk_t* built = cc->built ;
+    cc->built = NULL ;
+    cc->maze = m ;
+    pthread_mutex_unlock(&cc->lock) ;
+
+    while (built != NULL) {
+        built_chunk_t* next = built->next ;
+        free(built->vertices) ;
+        free(built) ;
+        built = next ;
+    }
+
+    for (int i=0; i<cc->nslots; ++i) {
+        if (cc->slots[i].vbo != 0) glDeleteBuffers(1, &cc->slots[i].vbo) ;
+    }
+    free(cc->slots) ;
+    free(cc->state) ;
+    free(cc->slot_of) ;
+    cc->slots = NULL ;
+    cc->state = NULL ;
+    cc->slot_of = NULL ;
+    cc->nslots = cc->max_slots = 0 ;
+    cc->resident_bytes = 0 ;
+    cc->nwanted = 0 ;
+    if (m == NULL) return ;
+
+    cc->chunk_rows = (get_nrows(m)+CHUNK_CELLS-1)/CHUNK_CELLS ;
+    cc->chunk_cols = (get_ncols(m)+CHUNK_CELLS-1)/CHUNK_CELLS ;
+    cc->nlevels = get_nlevels(m) ;
+    int nchunks = cc->nlevels*cc->chunk_rows*cc->chunk_cols ;
+    cc->state = calloc(nchunks, sizeof(unsigned char)) ;
+    cc->slot_of = malloc(nchunks*sizeof(int)) ;
+}
+
+/** Add the faces of a wall box to a mesh.  The faces are wound the same
+ *  way as in hw4's <code>draw_wall</code>; the bottom face is never seen,
+ *  so is left out.
+ *
+ *  @param v where to put the <code>VERTS_PER_WALL</code> vertices.
+ *  @param x0 the low x-coordinate of the box, in mesh units.
+ *  @param x1 the high x-coordinate of the box.
+ *  @param z0 the low z-coordinate of the box.
+ *  @param z1 the high z-coordinate of the box.
+ */
+static void add_wall_box(mesh_vertex_t* v, int x0, int x1, int z0, int z1) {
+    int y0 = 0, y1 = MESH_SCALE ;
+    GLshort faces[VERTS_PER_WALL][3] = {
+        // x=x1 plane
+        {x1, y0, z1}, {x1, y1, z1}, {x1, y1, z0}, {x1, y0, z0},
+        // x=x0 plane
+        {x0, y0, z0}, {x0, y1, z0}, {x0, y1, z1}, {x0, y0, z1},
+        // y=y1 plane
+        {x1, y1, z1}, {x0, y1, z1}, {x0, y1, z0}, {x1, y1, z0},
+        // z=z1 plane
+        {x0, y0, z1}, {x0, y1, z1}, {x1, y1, z1}, {x1, y0, z1},
+        // z=z0 plane
+        {x1, y0, z0}, {x1, y1, z0}, {x0, y1, z0}, {x0, y0, z0}
+    } ;
+    GLbyte normals[VERTS_PER_WALL/4][3] = {
+        {127, 0, 0}, {-127, 0, 0}, {0, 127, 0}, {0, 0, 127}, {0, 0, -127}
+    } ;
+    for (int i=0; i<VERTS_PER_WALL; ++i) {
+        memcpy(v[i].position, faces[i], sizeof(faces[i])) ;
+        memcpy(v[i].normal, normals[i/4], sizeof(normals[i/4])) ;
+        v[i].pad = 0 ;
+    }
+}
+
+/** Build the mesh of the north and east walls of the cells of a chunk.
+ *
+ *  @param m the maze.
+ *  @param level the level of the chunk.
+ *  @param cr the chunk row.
+ *  @param ccol the chunk column.
+ *  @param nverts set to the number of vertices.
+ *
+ *  @return the vertices, or <code>NULL</code> if there are none.
+ */
+static mesh_vertex_t* build_chunk(maze_t* m, int level, int cr, int ccol,
+        int* nverts) {
+    int r0 = cr*CHUNK_CELLS, c0 = ccol*CHUNK_CELLS ;
+    int r1 = r0+CHUNK_CELLS, c1 = c0+CHUNK_CELLS ;
+    if (r1 > get_nrows(m)) r1 = get_nrows(m) ;
+    if (c1 > get_ncols(m)) c1 = get_ncols(m) ;
+
+    int ncols = get_ncols(m) ;
+    const unsigned char* cells =
+        get_row_span(m, level*get_nrows(m) + r0, r1-r0) ;
+
+    int nwalls = 0 ;
+    for (int r=r0; r<r1; ++r) {
+        const unsigned char* row = cells + (r-r0)*ncols ;
+        for (int c=c0; c<c1; ++c) {
+            nwalls += !(row[c] & NORTH) + !(row[c] & EAST) ;
+        }
+    }
+    *nverts = nwalls*VERTS_PER_WALL ;
+    if (nwalls == 0) return NULL ;
+
+    mesh_vertex_t* v = malloc(*nverts*sizeof(mesh_vertex_t)) ;
+    mesh_vertex_t* next = v ;
+    for (int r=r0; r<r1; ++r) {
+        const unsigned char* row = cells + (r-r0)*ncols ;
+        for (int c=c0; c<c1; ++c) {
+            int x = (r-r0)*MESH_SCALE, z = (c-c0)*MESH_SCALE ;
+            if (!(row[c] & NORTH)) {
+                add_wall_box(next, x+7, x+9, z-1, z+9) ;
+                next += VERTS_PER_WALL ;
+            }
+            if (!(row[c] & EAST)) {
+                add_wall_box(next, x-1, x+9, z+7, z+9) ;
+                next += VERTS_PER_WALL ;
+            }
+        }
+    }
+    return v ;
+}
+
+/** Builder thread:  build queued chunks until told to quit.
+ *
+ *  @param arg the chunk cache.
+ */
+static void* run_builder(void* arg) {
+    chunk_cache_t* cc = arg ;
+
+    pthread_mutex_lock(&cc->lock) ;
+    while (true) {
+        while (!cc->quit && cc->queue_len == 0) {
+            pthread_cond_wait(&cc->work_ready, &cc->lock) ;
+        }
+        if (cc->quit) break ;
+        int chunk = cc->queue[cc->queue_head] ;
+        cc->queue_head = (cc->queue_head+1)%MAX_OUTSTANDING ;
+        cc->queue_len-- ;
+        cc->building++ ;
+        maze_t* m = cc->maze ;
+        int chunk_rows = cc->chunk_rows, chunk_cols = cc->chunk_cols ;
+        pthread_mutex_unlock(&cc->lock) ;
+
+        built_chunk_t* b = malloc(sizeof(built_chunk_t)) ;
+        b->chunk = chunk ;
+        int level_chunk = chunk%(chunk_rows*chunk_cols) ;
+        b->vertices = build_chunk(m, chunk/(chunk_rows*chunk_cols),
+                level_chunk/chunk_cols, level_chunk%chunk_cols, &b->nverts) ;
+
+        pthread_mutex_lock(&cc->lock) ;
+        b->next = cc->built ;
+        cc->built = b ;
+        if (--cc->building == 0) pthread_cond_broadcast(&cc->idle) ;
+    }
+    pthread_mutex_unlock(&cc->lock) ;
+
+    return NULL ;
+}
+
+/** Compare wanted chunks by distance for qsort.
+ */
+static int want_cmp(const void* a, const void* b) {
+    float x = ((const want_t*)a)->dist ;
+    float y = ((const want_t*)b)->dist ;
+    return (x > y) - (x < y) ;
+}
+
+/** Find the chunks within a radius of the camera or of the point ahead
+ *  of it on the camera's level and those next to it, nearest the point
+ *  ahead first.  Chunks on other levels count as a level's height
+ *  farther away than they are.
+ */
+static void find_wanted(chunk_cache_t* cc, int level, float x, float z,
+        float theta, float radius) {
+    float ax = x + 0.5f*radius*cos(D2R(theta)) ;
+    float az = z - 0.5f*radius*sin(D2R(theta)) ;
+    float reach = radius+CHUNK_RADIUS ;
+
+    // Chunk rows and columns of the box around both circles.
+    float lo_x = fminf(x, ax)-reach, hi_x = fmaxf(x, ax)+reach ;
+    float lo_z = fminf(z, az)-reach, hi_z = fmaxf(z, az)+reach ;
+    int cr0 = (int)floorf(lo_x/CHUNK_CELLS), cr1 = (int)floorf(hi_x/CHUNK_CELLS) ;
+    int cc0 = (int)floorf(lo_z/CHUNK_CELLS), cc1 = (int)floorf(hi_z/CHUNK_CELLS) ;
+    if (cr0 < 0) cr0 = 0 ;
+    if (cc0 < 0) cc0 = 0 ;
+    if (cr1 >= cc->chunk_rows) cr1 = cc->chunk_rows-1 ;
+    if (cc1 >= cc->chunk_cols) cc1 = cc->chunk_cols-1 ;
+
+    int l0 = level > 0 ? level-1 : 0 ;
+    int l1 = level < cc->nlevels-1 ? level+1 : cc->nlevels-1 ;
+    int most = (l1-l0+1)*(cr1-cr0+1)*(cc1-cc0+1) ;
+    if (most > cc->max_wanted) {
+        cc->max_wanted = most ;
+        cc->wanted = realloc(cc->wanted, most*sizeof(want_t)) ;
+    }
+
+    cc->nwanted = 0 ;
+    for (int l=l0; l<=l1; ++l) {
+        int first = l*cc->chunk_rows*cc->chunk_cols ;
+        float dl = l == level ? 0.0f : LEVEL_HEIGHT ;
+        for (int cr=cr0; cr<=cr1; ++cr) {
+            for (int ccol=cc0; ccol<=cc1; ++ccol) {
+                float mx = (cr+0.5f)*CHUNK_CELLS ;
+                float mz = (ccol+0.5f)*CHUNK_CELLS ;
+                float d0 = hypotf(mx-x, mz-z) ;
+                float d1 = hypotf(mx-ax, mz-az) ;
+                if (d0 > reach && d1 > reach) continue ;
+                cc->wanted[cc->nwanted++] =
+                    (want_t){first + cr*cc->chunk_cols + ccol, d1+dl} ;
+            }
+        }
+    }
+    qsort(cc->wanted, cc->nwanted, sizeof(want_t), want_cmp) ;
+}
+
+/** Evict the least recently wanted resident chunk that was not wanted by
+ *  this update.
+ *
+ *  @return true if a chunk was evicted, false if every resident chunk is
+ *      wanted.
+ */
+static bool evict_one(chunk_cache_t* cc) {
+    int victim = -1 ;
+    for (int i=0; i<cc->nslots; ++i) {
+        if (cc->slots[i].last_wanted == cc->update) continue ;
+        if (victim < 0 ||
+                cc->slots[i].last_wanted < cc->slots[victim].last_wanted) {
+            victim = i ;
+        }
+    }
+    if (victim < 0) return false ;
+
+    slot_t* s = &cc->slots[victim] ;
+    if (s->vbo != 0) glDeleteBuffers(1, &s->vbo) ;
+    cc->resident_bytes -= s->nverts*sizeof(mesh_vertex_t) ;
+    cc->state[s->chunk] = ChunkAbsent ;
+
+    // Move the last slot into the hole.
+    *s = cc->slots[--cc->nslots] ;
+    if (victim < cc->nslots) cc->slot_of[s->chunk] = victim ;
+    cc->evicted++ ;
+    return true ;
+}
+
+/** Drop a built chunk that could not be uploaded, remembering its size
+ *  so that it is not built again until there is room for it.
+ */
+static void drop_chunk(chunk_cache_t* cc, built_chunk_t* b) {
+    cc->state[b->chunk] = ChunkDropped ;
+    cc->slot_of[b->chunk] = b->nverts ;
+}
+
+/** Upload a built chunk into a new slot, evicting chunks to make room.
+ *  If there is no room, the chunk is dropped.
+ */
+static void upload_chunk(chunk_cache_t* cc, built_chunk_t* b) {
+    size_t bytes = b->nverts*sizeof(mesh_vertex_t) ;
+    while (cc->resident_bytes+bytes > cc->resident_budget && evict_one(cc)) ;
+    if (cc->resident_bytes+bytes > cc->resident_budget) {
+        drop_chunk(cc, b) ;
+        return ;
+    }
+
+    if (cc->nslots == cc->max_slots) {
+        int max_slots = cc->max_slots == 0 ? 64 : 2*cc->max_slots ;
+        slot_t* slots = realloc(cc->slots, max_slots*sizeof(slot_t)) ;
+        if (slots == NULL) {
+            drop_chunk(cc, b) ;
+            return ;
+        }
+        cc->slots = slots ;
+        cc->max_slots = max_slots ;
+    }
+    slot_t* s = &cc->slots[cc->nslots] ;
+    s->chunk = b->chunk ;
+    s->nverts = b->nverts ;
+    s->last_wanted = cc->update ;
+    s->vbo = 0 ;
+    if (b->nverts > 0) {
+        glGenBuffers(1, &s->vbo) ;
+        glBindBuffer(GL_ARRAY_BUFFER, s->vbo) ;
+        glBufferData(GL_ARRAY_BUFFER, bytes, b->vertices, GL_STATIC_DRAW) ;
+        glBindBuffer(GL_ARRAY_BUFFER, 0) ;
+    }
+    cc->slot_of[b->chunk] = cc->nslots++ ;
+    cc->resident_bytes += bytes ;
+    cc->state[b->chunk] = ChunkResident ;
+    cc->uploaded++ ;
+}
+
+/** Request, upload and evict chunks; see chunks.h.
+ */
+void update_chunks(chunk_cache_t* cc, int level, float x, float z,
+        float theta, float radius) {
+    cc->uploaded = cc->evicted = 0 ;
+    if (cc->maze == NULL) return ;
+    cc->update++ ;
+
+    // Only want as many chunks, nearest first, as are likely to fit in
+    // the resident budget; otherwise the farthest would be built, dropped
+    // for lack of room and built again forever.  Chunks that have never
+    // been built are guessed to be the size of the average resident one.
+    find_wanted(cc, level, x, z, theta, radius) ;
+    size_t guess = cc->nslots > 0 ? cc->resident_bytes/cc->nslots
+        : CHUNK_CELLS*CHUNK_CELLS*VERTS_PER_WALL*sizeof(mesh_vertex_t) ;
+    size_t wanted_bytes = 0 ;
+    for (int i=0; i<cc->nwanted; ++i) {
+        int chunk = cc->wanted[i].chunk ;
+        if (cc->state[chunk] == ChunkResident) {
+            wanted_bytes +=
+                cc->slots[cc->slot_of[chunk]].nverts*sizeof(mesh_vertex_t) ;
+        }
+        else if (cc->state[chunk] == ChunkDropped) {
+            wanted_bytes += cc->slot_of[chunk]*sizeof(mesh_vertex_t) ;
+        }
+        else wanted_bytes += guess ;
+        if (wanted_bytes > cc->resident_budget) {
+            cc->nwanted = i ;
+            break ;
+        }
+    }
+
+    // Mark the wanted resident chunks so they are not evicted.
+    for (int i=0; i<cc->nwanted; ++i) {
+        int chunk = cc->wanted[i].chunk ;
+        if (cc->state[chunk] == ChunkResident) {
+            cc->slots[cc->slot_of[chunk]].last_wanted = cc->update ;
+        }
+    }
+
+    // Upload built chunks within the budget; put the rest back.  This is
+    // done before queuing so that chunks dropped now can be queued again
+    // below if there is room for them after all.
+    pthread_mutex_lock(&cc->lock) ;
+    built_chunk_t* built = cc->built ;
+    cc->built = NULL ;
+    pthread_mutex_unlock(&cc->lock) ;
+    for (built_chunk_t* b=built; b != NULL; b=b->next) {
+        cc->state[b->chunk] = ChunkBuilt ;
+    }
+    size_t uploaded_bytes = 0 ;
+    while (built != NULL &&
+            (uploaded_bytes == 0 || uploaded_bytes < cc->upload_budget)) {
+        built_chunk_t* next = built->next ;
+        upload_chunk(cc, built) ;
+        uploaded_bytes += built->nverts*sizeof(mesh_vertex_t) ;
+        free(built->vertices) ;
+        free(built) ;
+        built = next ;
+    }
+
+    // The room for dropped chunks is what is left of the budget once the
+    // unwanted resident chunks are evicted.
+    size_t room = cc->resident_budget-cc->resident_bytes ;
+    for (int i=0; i<cc->nslots; ++i) {
+        if (cc->slots[i].last_wanted != cc->update) {
+            room += cc->slots[i].nverts*sizeof(mesh_vertex_t) ;
+        }
+    }
+
+    // Queue the nearest absent chunks, and the dropped ones that now fit.
+    pthread_mutex_lock(&cc->lock) ;
+    if (built != NULL) {
+        built_chunk_t* last = built ;
+        while (last->next != NULL) last = last->next ;
+        last->next = cc->built ;
+        cc->built = built ;
+    }
+    for (int i=0; i<cc->nwanted
+            && cc->queue_len+cc->building < MAX_OUTSTANDING; ++i) {
+        int chunk = cc->wanted[i].chunk ;
+        if (cc->state[chunk] == ChunkDropped) {
+            size_t bytes = cc->slot_of[chunk]*sizeof(mesh_vertex_t) ;
+            if (bytes > room) continue ;
+            room -= bytes ;
+        }
+        else if (cc->state[chunk] != ChunkAbsent) continue ;
+        int tail = (cc->queue_head+cc->queue_len)%MAX_OUTSTANDING ;
+        cc->queue[tail] = chunk ;
+        cc->queue_len++ ;
+        cc->state[chunk] = ChunkQueued ;
+        pthread_cond_signal(&cc->work_ready) ;
+    }
+    pthread_mutex_unlock(&cc->lock) ;
+}
+
+/** Draw the resident chunks; see chunks.h.
+ */
+void draw_chunks(chunk_cache_t* cc, int level,
+        bool (*is_culled)(float, float, float), int* draw_calls,
+        int* vertices, int* walls_culled) {
+    glEnableClientState(GL_VERTEX_ARRAY) ;
+    glEnableClientState(GL_NORMAL_ARRAY) ;
+    glMatrixMode(GL_MODELVIEW) ;
+
+    int level_chunks = cc->chunk_rows*cc->chunk_cols ;
+    for (int i=0; i<cc->nslots; ++i) {
+        slot_t* s = &cc->slots[i] ;
+        if (s->nverts == 0 || s->chunk/level_chunks != level) continue ;
+        int chunk = s->chunk%level_chunks ;
+        int cr = chunk/cc->chunk_cols, ccol = chunk%cc->chunk_cols ;
+        if (is_culled((cr+0.5f)*CHUNK_CELLS, (ccol+0.5f)*CHUNK_CELLS,
+                    CHUNK_RADIUS)) {
+            *walls_culled += s->nverts/VERTS_PER_WALL ;
+            continue ;
+        }
+
+        glBindBuffer(GL_ARRAY_BUFFER, s->vbo) ;
+        glVertexPointer(3, GL_SHORT, sizeof(mesh_vertex_t),
+                (void*)offsetof(mesh_vertex_t, position)) ;
+        glNormalPointer(GL_BYTE, sizeof(mesh_vertex_t),
+                (void*)offsetof(mesh_vertex_t, normal)) ;
+        glPushMatrix() ;
+        glTranslatef(cr*CHUNK_CELLS, level*LEVEL_HEIGHT, ccol*CHUNK_CELLS) ;
+        glScalef(1.0/MESH_SCALE, 1.0/MESH_SCALE, 1.0/MESH_SCALE) ;
+        glDrawArrays(GL_QUADS, 0, s->nverts) ;
+        glPopMatrix() ;
+        (*draw_calls)++ ;
+        *vertices += s->nverts ;
+    }
+
+    glBindBuffer(GL_ARRAY_BUFFER, 0) ;
+    glDisableClientState(GL_NORMAL_ARRAY) ;
+    glDisableClientState(GL_VERTEX_ARRAY) ;
+}
+
+/** Check for outstanding work; see chunks.h.
+ */
+bool chunks_busy(chunk_cache_t* cc) {
+    pthread_mutex_lock(&cc->lock) ;
+    bool busy = cc->queue_len > 0 || cc->building > 0 || cc->built != NULL ;
+    pthread_mutex_unlock(&cc->lock) ;
+    if (busy || cc->maze == NULL) return busy ;
+
+    // Wanted chunks that could not be queued yet.  Dropped chunks wait
+    // for room, which more updates alone will not make.
+    for (int i=0; i<cc->nwanted; ++i) {
+        if (cc->state[cc->wanted[i].chunk] == ChunkAbsent) return true ;
+    }
+    return false ;
+}
+
+/** Get statistics; see chunks.h.
+ */
+void get_chunk_stats(chunk_cache_t* cc, chunk_stats_t* stats) {
+    pthread_mutex_lock(&cc->lock) ;
+    int pending = cc->queue_len + cc->building ;
+    for (built_chunk_t* b=cc->built; b != NULL; b=b->next) pending++ ;
+    pthread_mutex_unlock(&cc->lock) ;
+
+    stats->resident = cc->nslots ;
+    stats->resident_bytes = cc->resident_bytes ;
+    stats->pending = pending ;
+    stats->uploaded = cc->uploaded ;
+    stats->evicted = cc->evicted ;
+}
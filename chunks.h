@@ -0,0 +1,135 @@
+/** @file chunks.h streaming wall meshes for large mazes.
+ *
+ *  A chunk cache splits a maze into square chunks of cells and keeps wall
+ *  meshes in vertex buffer objects only for the chunks near the camera.
+ *  Chunk meshes are built from the maze on background threads; on the GL
+ *  thread, <code>update_chunks</code> requests the chunks around the camera
+ *  (and ahead of it), uploads finished meshes within a per-frame byte
+ *  budget, and evicts the least recently wanted chunks to stay within a
+ *  budget of resident bytes.  So memory use and the work done per frame
+ *  do not depend on the size of the maze.
+ *
+ *  Positions use the frame of the 3D maze view:  x runs along rows and z
+ *  along columns, and a heading of theta degrees looks in direction
+ *  (cos theta, -sin theta) in (x, z).  Walls are drawn as in
+ *  <code>draw_wall</code>:  boxes a quarter unit thick, 1.25 units long
+ *  and 1 unit high, centered on the north and east edges of each cell.
+ *  The levels of a layered maze are stacked <code>LEVEL_HEIGHT</code>
+ *  apart in y, and only the chunks of the camera's level and the levels
+ *  next to it are wanted.
+ *
+ *  All functions except <code>make_chunk_cache</code>'s threads must be
+ *  called on the GL thread with a current context.
+ */
+
+#ifndef CHUNKS_H
+#define CHUNKS_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "maze.h"
+
+/** The height in y of a level of a layered maze.
+ */
+#define LEVEL_HEIGHT 3.0f
+
+/** The type of a chunk cache.
+ */
+typedef struct _chunk_cache_t chunk_cache_t ;
+
+/** Statistics about a chunk cache.
+ */
+typedef struct _chunk_stats_t {
+    /** Chunks with a vertex buffer, and the bytes in those buffers.
+     */
+    int resident ;
+    size_t resident_bytes ;
+
+    /** Chunks queued, being built, or built and waiting for upload.
+     */
+    int pending ;
+
+    /** Chunks uploaded and evicted by the last update.
+     */
+    int uploaded ;
+    int evicted ;
+} chunk_stats_t ;
+
+/** Make a chunk cache with no maze.
+ *
+ *  @param resident_budget the most bytes of vertex buffers to keep.
+ *  @param upload_budget the most bytes to upload per update (at least
+ *      one chunk is always uploaded if one is ready).
+ *  @param nthreads the number of threads to build chunks with.
+ *
+ *  @return the chunk cache.
+ */
+chunk_cache_t* make_chunk_cache(size_t resident_budget, size_t upload_budget,
+        int nthreads) ;
+
+/** Stop a chunk cache's threads and free it and its vertex buffers.
+ *
+ *  @param cc a chunk cache.
+ */
+void free_chunk_cache(chunk_cache_t* cc) ;
+
+/** Switch a chunk cache to a new maze, dropping every chunk of the old
+ *  one.  Waits for chunks being built from the old maze, so the old maze
+ *  may be freed once this returns.
+ *
+ *  @param cc a chunk cache.
+ *  @param m the new maze, or <code>NULL</code>.
+ */
+void set_chunk_maze(chunk_cache_t* cc, maze_t* m) ;
+
+/** Request, upload and evict chunks for a camera position.  The chunks
+ *  wanted are those within <code>radius</code> of the camera or of a point
+ *  half that far ahead of it, on the camera's level and the levels above
+ *  and below it, nearest the point ahead first and the camera's level
+ *  before the others.
+ *
+ *  @param cc a chunk cache.
+ *  @param level the level of the camera.
+ *  @param x the x-coordinate of the camera.
+ *  @param z the z-coordinate of the camera.
+ *  @param theta the heading of the camera in degrees.
+ *  @param radius how far from the camera walls are wanted.
+ */
+void update_chunks(chunk_cache_t* cc, int level, float x, float z,
+        float theta, float radius) ;
+
+/** Draw the resident chunks of a level with the current material, raised
+ *  to the height of the level.
+ *
+ *  @param cc a chunk cache.
+ *  @param level the level to draw.
+ *  @param is_culled a function that is given the center and radius of a
+ *      chunk in (x, z) and returns true if it is out of view.
+ *  @param draw_calls incremented for each chunk drawn.
+ *  @param vertices incremented by the number of vertices drawn.
+ *  @param walls_culled incremented by the number of walls in chunks that
+ *      were out of view.
+ */
+void draw_chunks(chunk_cache_t* cc, int level,
+        bool (*is_culled)(float, float, float), int* draw_calls,
+        int* vertices, int* walls_culled) ;
+
+/** Check whether a chunk cache has chunks queued, being built, or
+ *  waiting for upload.  Chunks dropped for lack of room do not count.
+ *
+ *  @param cc a chunk cache.
+ *
+ *  @return true if more updates are needed to finish loading the chunks
+ *      last wanted, false otherwise.
+ */
+bool chunks_busy(chunk_cache_t* cc) ;
+
+/** Get statistics about a chunk cache.
+ *
+ *  @param cc a chunk cache.
+ *  @param stats filled in with the statistics.
+ */
+void get_chunk_stats(chunk_cache_t* cc, chunk_stats_t* stats) ;
+
+#endif
@@ -1,41 +1,23 @@
 #ifndef DEBUG_H
 #define DEBUG_H
 
-// A marginally-clever debugging function that expends to a no-op
-// when NDEBUG is defined and otherwise prints its string formatting
-// arguments to stderr.
+// A marginally-clever debugging function that expands to a no-op
+// when NDEBUG is defined and otherwise records an instant event in the
+// trace (see trace.h) when TRACE_DEBUG is in the trace mask.  Nothing is
+// formatted:  the event is named by the format string, which must be a
+// literal, and carries the first argument after it, if any, which must
+// be an integer.
 #ifdef NDEBUG
-#define debug(fmt, ...) 
-#define debug_c(expr, fmt, ...)
+#define debug(...)
+#define debug_c(expr, ...)
 #else
 
-#include <stdarg.h>
-#include <stdbool.h>
-#include <stdio.h>
-#include <stdlib.h>
+#include "trace.h"
 
-static void debug(const char* fmt, ...) {
-    va_list argptr ;
-    va_start(argptr, fmt) ;
-
-    char* fmt_newline ;
-    asprintf(&fmt_newline, "%s\n", fmt) ;
-    vfprintf(stderr, fmt_newline, argptr) ;
-    free(fmt_newline) ;
-    fflush(stderr) ;
-}
-static void debug_c(bool expr, const char* fmt, ...) {
-    if (expr) {
-        va_list argptr ;
-        va_start(argptr, fmt) ;
-
-        char* fmt_newline ;
-        asprintf(&fmt_newline, "%s\n", fmt) ;
-        vfprintf(stderr, fmt_newline, argptr) ;
-        free(fmt_newline) ;
-        fflush(stderr) ;
-    }
-}
+#define debug(...) debug_event(__VA_ARGS__, 0, 0)
+#define debug_event(fmt, arg, ...) \
+    trace_instant(TRACE_DEBUG, fmt, (long long)(arg))
+#define debug_c(expr, ...) do { if (expr) debug(__VA_ARGS__) ; } while (0)
 #endif
 
 #endif
@@ -9,11 +9,13 @@
 #include <assert.h>
 #include <float.h>
 #include <math.h>
+#include <pthread.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
+#include <unistd.h>
 
 #ifdef __MACOSX__
 #include <OpenGL/gl.h>
@@ -26,8 +28,16 @@
 #include <GL/glut.h>
 #endif
 
+#ifdef HAVE_OSMESA
+#include <GL/osmesa.h>
+#endif
+
 #include "geom356.h"
+#include "chunks.h"
+#include "impostor.h"
 #include "maze.h"
+#include "raycast.h"
+#include "trace.h"
 #include "debug.h"
 
 // Window data.
@@ -38,35 +48,215 @@ int win_width;
 int win_height;
 
 // Viewing data.
-int theta;			// The angle the look direction makes with the x-axis.    
+float theta;		// The angle the look direction makes with the x-axis.    
 point3_t camera_position;
 point3_t jump_look_at;	  // To be set at the beginning of every jump
 						  // and used as the look-at point throughout the
 						  // animation.
+bool jump_view = false;	  // Whether the camera is looking at jump_look_at.
 vector3_t up_dir = {0.0, 1.0, 0.0};
-#define EYE_THETA_INCR 5
-#define CAMERA_POSN_INCR 0.1
-#define JUMP_INCR 0.1
+#define TURN_SPEED 120.0f		// Degrees per second.
+#define MOVE_SPEED 2.0f			// Units per second.
+#define JUMP_SPEED 15.0f		// Units per second.
+#define END_SPIN_SPEED 90.0f	// Degrees per second.
+#define END_RISE_SPEED 1.0f		// Units per second.
+#define CLIMB_SPEED 2.0f		// Units per second.
 #define NORM_HEIGHT 0.75
 #define JUMP_HEIGHT 19.5
+#define END_HEIGHT 50.0
 #define COLLISION_THRESHOLD 0.15f
 
+// Simulation timing.  The simulation advances in fixed steps of TICK_MS
+// milliseconds, and a frame is drawn every FRAME_MS milliseconds by
+// interpolating between the last two simulation states.  The timer only
+// runs while something is moving, so an idle player costs no CPU.
+#define TICK_MS 10
+#define FRAME_MS 16
+#define MAX_CATCHUP_MS 250
+#define TICK_SECS (TICK_MS/1000.0f)
+bool timer_running = false;
+int last_tick_time;
+int tick_accumulator;
+float render_alpha;		  // Fraction of a tick elapsed since the last step.
+float prev_theta;
+point3_t prev_camera_position;
+point3_t eye_position;	  // The interpolated camera state last drawn.
+float eye_theta;
+
+// The current animation, if any; called once per simulation step with
+// the step length in seconds.  While an animation is running, the player
+// cannot move.
+void (*animation)(float) = NULL;
+
+// Arrow keys currently held down.
+typedef enum _held_key_t {
+	KeyLeft,
+	KeyRight,
+	KeyUp,
+	KeyDown,
+	NUM_HELD_KEYS
+} held_key_t;
+bool keys_down[NUM_HELD_KEYS];
+
 #define D2R(x) ((x)*M_PI/180.0)		//Convert degrees to radians.
 
-// The maze and associated data.
-maze_t *maze;
+// The maze and associated data.  maze is NULL until the first maze has
+// been generated.
+long maze_seed;
+maze_t *maze = NULL;
 int maze_width;
 int maze_height;
 cell_t *start;
 cell_t *end;
-bool *visited;
-unsigned char wall_dirs[] = {NORTH, SOUTH, EAST, WEST};
-#define NUM_WALL_DIRS 4
+unsigned long *visited;	  // Bitset of visited cells, row by row, counting
+						  // the rows of all levels.
+
+// Levels.  A layered maze has maze_levels levels, LEVEL_HEIGHT apart; the
+// player walks on one at a time and climbs between them through shafts.
+// Only the player's level and the levels next to it are drawn, so the
+// frame costs the same however many levels there are.  Camera x and z
+// are within the player's level; the rows the library sees are offset by
+// the rows of the levels below (see player_row).
+int maze_levels = 1;
+int player_level;
+int climb_level;		  // The level being climbed to.
+#define SHAFT_VIEW 16	  // Shafts are marked within this many cells.
+#define WORD_BITS (8*sizeof(unsigned long))
 #define WALL_THICKNESS .25
+// The player is a circle that keeps COLLISION_THRESHOLD from the faces of
+// the walls.
+#define COLLISION_RADIUS (COLLISION_THRESHOLD+WALL_THICKNESS/2)
+
+// The wall meshes, streamed in chunks around the camera.  Only chunks
+// within CHUNK_RADIUS of the camera are kept, and at most
+// CHUNK_BUDGET_MB megabytes of them.
+#define CHUNK_RADIUS view_plane_far
+#define CHUNK_BUDGET_MB 256
+#define CHUNK_UPLOAD_MB 2
+chunk_cache_t *chunks;
+
+// The overhead view's level of detail.  Beyond IMPOSTOR_NEAR from the eye
+// a flat impostor baked from the maze image fades in over the walls, and
+// beyond IMPOSTOR_FAR it replaces them, so only the walls within
+// IMPOSTOR_FAR are drawn as geometry.  The in-maze view always draws the
+// walls, since the impostor only looks right from above.
+#define IMPOSTOR_NEAR 24.0f
+#define IMPOSTOR_FAR 32.0f
+impostor_t *impostor;
+
+// Route hints.  When shown, the route from the player's cell to the end is
+// drawn as a line just above the floor.  Each world comes with a table of
+// the next hop from every cell toward the end, so the route is rebuilt
+// only when the player changes cells, in time proportional to its length.
+#define HINT_HEIGHT 0.05f
+bool show_hints = false;
+unsigned char *next_hops;	  // See make_next_hops.
+GLfloat *hint_route = NULL;	  // The route's vertices, 3 floats each.
+int hint_route_len = 0;
+int hint_route_cap = 0;
+long hint_cell = -1;		  // The cell the route was built from.
+
+// A maze and everything built from it.  Worlds are built on a background
+// thread while the current one stays playable, then swapped in as a whole
+// on the GLUT thread.
+typedef struct _world_t {
+	long seed;
+	maze_t *maze;
+	unsigned long *visited;
+	unsigned char *next_hops;
+} world_t;
+pthread_t generator;
+bool generating = false;
+long generator_seed;
+int generator_percent = 0;	  // Of the maze being generated; written by the
+							  // generator thread.
+#define GENERATOR_STEP_US 10000
+pthread_mutex_t world_lock = PTHREAD_MUTEX_INITIALIZER;
+world_t *next_world = NULL;	  // Built but not yet swapped in; guarded by
+							  // world_lock.
+bool world_done = false;	  // Whether the generator thread has finished,
+							  // leaving next_world NULL if it failed;
+							  // guarded by world_lock.
 
 // View-volume specification in camera frame basis.
 float view_plane_near = 0.1f;
 float view_plane_far = 100.0f;
+#define FOV_Y 60.0
+
+// Frame profiling.  The CPU time spent drawing each frame is kept for the
+// last FRAME_HISTORY frames, and the scene drawing functions count the
+// draw calls (glBegin/glEnd pairs) and vertices they submit and the walls
+// they skip.  If a CSV file is given on the command line, each frame's
+// numbers are appended to it.
+#define FRAME_HISTORY 256
+double frame_times[FRAME_HISTORY];	  // In milliseconds.
+int frame_count = 0;
+int draw_calls;
+int vertices_submitted;
+int walls_culled;
+FILE *csv_file = NULL;
+
+// Tracing.  If a trace file is given on the command line, every trace
+// category is enabled and the trace is written to the file at exit.
+char *trace_file = NULL;
+
+// Text drawing.  Each ASCII glyph is compiled into a display list once,
+// so a string is drawn with a single glCallLists.
+#define HUD_FONT GLUT_BITMAP_HELVETICA_12
+#define NUM_GLYPHS 128
+#define HUD_LINE_HEIGHT 20
+GLuint glyph_base;
+
+// CPU raycasting backend.  When enabled, the in-maze view is drawn by a
+// multi-threaded raycaster into a framebuffer that is presented as a
+// single screen-sized texture.  The overhead view still uses geometry.
+bool use_raycaster = false;
+raycaster_t *raycaster = NULL;
+GLuint raycast_texture;
+int raycast_width = 0;	  // The size the texture was last allocated at.
+int raycast_height = 0;
+
+// Headless benchmarking.  When running headless there is no window and
+// GLUT is never initialized; instead frames are drawn into an offscreen
+// software (OSMesa) buffer at the default window size while a scripted
+// camera path is replayed through the keyboard callbacks.
+bool headless = false;
+char *ppm_dir = NULL;	  // If set, each headless frame is saved here.
+
+// How long to wait between checks for chunks still being built when
+// running headless.  Each headless frame is drawn with everything it
+// wants loaded, so that its timings and image do not depend on how far
+// the builder threads have got.
+#define LOAD_POLL_US 1000
+// The most checks before a headless frame is drawn anyway.
+#define LOAD_MAX_POLLS 10000
+
+// The current keyboard callbacks.  These are kept here as well as
+// registered with GLUT so that the camera script can call them.
+void (*key_func)(unsigned char, int, int) = NULL;
+void (*special_func)(int, int, int) = NULL;
+
+// A step of the camera script:  press <code>ascii</code> (if not 0),
+// then hold the arrow key <code>special</code> (if not 0) for
+// <code>frames</code> frames.
+typedef struct _script_step_t {
+	unsigned char ascii;
+	int special;
+	int frames;
+} script_step_t;
+
+// Walk, turn, walk, jump, look around from above and fall back.
+script_step_t camera_script[] = {
+	{0, GLUT_KEY_UP, 120},
+	{0, GLUT_KEY_LEFT, 45},
+	{0, GLUT_KEY_UP, 90},
+	{0, GLUT_KEY_RIGHT, 90},
+	{0, GLUT_KEY_DOWN, 30},
+	{' ', 0, 120},
+	{' ', 0, 120},
+	{0, GLUT_KEY_UP, 60}
+};
+#define NUM_SCRIPT_STEPS (sizeof(camera_script)/sizeof(script_step_t))
 
 // Materials and lights.
 typedef struct _material_t {
@@ -128,33 +318,85 @@ material_t bright_red = {
 	0.0f
 };
 
+// Markers for shafts up (cyan) and down (magenta).
+material_t bright_cyan = {
+	{0.0f, 0.0f, 0.0f, 1.0f},
+	{0.0f, 10.0f, 10.0f, 1.0f},
+	{0.0f, 0.0f, 0.0f, 1.0f},
+	0.0f
+};
+
+material_t bright_magenta = {
+	{0.0f, 0.0f, 0.0f, 1.0f},
+	{10.0f, 0.0f, 10.0f, 1.0f},
+	{0.0f, 0.0f, 0.0f, 1.0f},
+	0.0f
+};
+
+// The walls of the levels above and below the player.
+material_t dim_plastic = {
+    {0.0f, 0.0f, 0.3f, 1.0f},
+    {0.0f, 0.0f, 0.3f, 1.0f},
+    {0.0f, 0.0f, 0.0f, 1.0f},
+    0.0f
+};
+
 // Callbacks.
-void animate_jump();
-void animate_fall();
 void handle_display(void);
 void handle_key_norm(unsigned char, int, int);
 void handle_key_jumped(unsigned char, int, int);
 void handle_resize(int, int);
 void handle_special_key(int, int, int);
-void animate_end();
+void handle_special_key_up(int, int, int);
+void handle_timer(int);
+void set_key_funcs(void (*)(unsigned char, int, int), void (*)(int, int, int));
+
+// Animations.
+void animate_climb(float);
+void animate_end(float);
+void animate_fall(float);
+void animate_jump(float);
 
 // Initialization functions.
+void close_csv();
+void close_trace();
+void draw_frame();
 void gl_init();
 void init();
-void initialize_maze();
+void init_glyphs();
+void install_world(world_t*);
+void reset_player();
+void *run_generator(void*);
+void start_generation(long);
+bool update_scenery();
+bool swap_world();
+
+// World functions.  These do not use GL, so can run on any thread.
+world_t *make_world(long);
 
 // Application functions.
 void draw_breadcrumbs();
 void draw_maze();
+void draw_message(char*);
+void draw_raycast();
+void draw_shafts();
 void draw_square(material_t*);
 void draw_start_end();
+void draw_walls(int);
+void draw_hud();
+void draw_hints();
 void draw_string(char*);
 void draw_wall();
-void get_new_posn(movement_dir_t, point3_t*);
-bool is_collision(point3_t*);
+void get_new_posn(movement_dir_t, float, point3_t*);
+bool is_culled(float, float, float);
+bool is_culled_lod(float, float, float);
 bool is_visited(int, int);
-void print_position_heading();
+float level_base(int);
+void move_player(float);
+int player_row();
 void process_cell();
+void release_keys();
+void set_animation(void (*)(float));
 void set_camera();
 void set_jump_look_at();
 void set_lights();
@@ -162,6 +404,13 @@ void set_material(material_t*);
 void set_projection_viewport();
 void set_visited(int, int);
 void reached_end();
+void update_hints(int, int);
+void advance_simulation(int);
+int run_headless();
+bool write_ppm(int);
+void record_frame(double);
+void start_timer();
+void step_simulation(float);
 
 // XXX: SHOULD WE KEEP THIS??? AT THE VERY LEAST WE NEED TO CHANGE THE MATERIAL
 void draw_floor();
@@ -171,6 +420,51 @@ int main(int argc, char **argv) {
 	maze_width = atoi(argv[1]);
 	maze_height = atoi(argv[2]);
 
+	// Parse any options:
+	//	--csv FILE: write per-frame timings to FILE.
+	//	--seed N: seed the maze with N instead of the time.
+	//	--trace FILE: write a Chrome trace of the run to FILE.
+	//	--headless: replay the camera script offscreen and report timings.
+	//	--hints: start with the route to the end shown.
+	//	--levels N: make mazes with N levels.
+	//	--ppm DIR: with --headless, save each frame to DIR as a PPM image.
+	//	--raycast: draw the in-maze view with the CPU raycaster.
+	maze_seed = time(NULL);
+	for (int i=3; i<argc; i++) {
+		if (strcmp(argv[i], "--seed") == 0 && i+1 < argc) {
+			maze_seed = atol(argv[++i]);
+		} else if (strcmp(argv[i], "--raycast") == 0) {
+			use_raycaster = true;
+		} else if (strcmp(argv[i], "--headless") == 0) {
+			headless = true;
+		} else if (strcmp(argv[i], "--hints") == 0) {
+			show_hints = true;
+		} else if (strcmp(argv[i], "--levels") == 0 && i+1 < argc) {
+			maze_levels = atoi(argv[++i]);
+		} else if (strcmp(argv[i], "--ppm") == 0 && i+1 < argc) {
+			ppm_dir = argv[++i];
+		} else if (strcmp(argv[i], "--trace") == 0 && i+1 < argc) {
+			trace_file = argv[++i];
+			trace_mask = TRACE_ALL;
+			atexit(close_trace);
+		} else if (strcmp(argv[i], "--csv") == 0 && i+1 < argc) {
+			csv_file = fopen(argv[++i], "w");
+			if (csv_file == NULL) {
+				perror(argv[i]);
+				return EXIT_FAILURE;
+			}
+			fprintf(csv_file, "frame,cpu_ms,draw_calls,vertices,walls_culled\n");
+			atexit(close_csv);
+		} else {
+			fprintf(stderr, "Unknown option %s\n", argv[i]);
+			return EXIT_FAILURE;
+		}
+	}
+
+	if (maze_levels < 1) maze_levels = 1;
+
+	if (headless) return run_headless();
+
 	// Initialize the drawing window.
 	glutInitWindowSize(DEFAULT_WIN_WIDTH, DEFAULT_WIN_HEIGHT);
 	glutInitWindowPosition(0, 0);
@@ -181,11 +475,12 @@ int main(int argc, char **argv) {
 	// Create the main window.
 	glutCreateWindow(WINDOW_TITLE);
 
-	// Set callbacks.
+	// Set callbacks.  Held arrow keys are tracked with down/up events,
+	// so key repeat is not wanted.
 	glutReshapeFunc(handle_resize);
 	glutDisplayFunc(handle_display);
-	glutKeyboardFunc(handle_key_norm);
-	glutSpecialFunc(handle_special_key);
+	glutSpecialUpFunc(handle_special_key_up);
+	glutIgnoreKeyRepeat(1);
 
 	// GL initialization.
 	gl_init();
@@ -201,67 +496,78 @@ int main(int argc, char **argv) {
 
 // GLUT CALLBACKS.
 
-/** Animate falling back to the normal in-maze view from the overhead view.
+/** Handle a display request by drawing the frame and swapping buffers.
  */
-void animate_fall() {
-	debug("animate_fall()");
-
-	if (camera_position.y > NORM_HEIGHT) {
-		glMatrixMode(GL_MODELVIEW);
-		glLoadIdentity();
-		camera_position.y -= JUMP_INCR;
-		gluLookAt(camera_position.x, camera_position.y, camera_position.z,
-				  jump_look_at.x, jump_look_at.y, jump_look_at.z,
-				  up_dir.x, up_dir.y, up_dir.z);
-		glutPostRedisplay();
-	} else {
-		// Unregister the idle callback and return control to the player.
-		glutKeyboardFunc(handle_key_norm);
-		glutSpecialFunc(handle_special_key);
-		glutIdleFunc(NULL);
-	}
+void handle_display() {
+	draw_frame();
+	glutSwapBuffers();
 }
 
-/** Animate jumping to the overhead view.
+/** Request the chunks and impostor tiles wanted around the camera, and
+ * upload those that are ready.  The impostor's tiles are kept loaded in
+ * either view, so that they are ready when the player jumps; layered
+ * mazes have no impostor.
+ *
+ * @return true if some of them are still loading, false otherwise.
  */
-void animate_jump() {
-	debug("animate_jump()");
-
-	// If the y-coordinate of the camera is less than JUMP_HEIGHT,
-	// increment it by JUMP_INCR and redisplay. Otherwise, we're done animating,
-	// so unregister the idle callback and set the keyboard callback to allow
-	// the player to return to the normal view.
-	if (camera_position.y < JUMP_HEIGHT) {
-		glMatrixMode(GL_MODELVIEW);
-		glLoadIdentity();
-		camera_position.y += JUMP_INCR;
-		gluLookAt(camera_position.x, camera_position.y, camera_position.z,
-				  jump_look_at.x, jump_look_at.y, jump_look_at.z,
-				  up_dir.x, up_dir.y, up_dir.z);
-		glutPostRedisplay();
-	} else {
-		glutKeyboardFunc(handle_key_jumped);
-		glutIdleFunc(NULL);
+bool update_scenery() {
+	bool busy = false;
+	if (!use_raycaster || jump_view) {
+		update_chunks(chunks, player_level, eye_position.x, eye_position.z,
+				eye_theta, jump_view && maze_levels == 1 ? IMPOSTOR_FAR :
+				CHUNK_RADIUS);
+		busy = chunks_busy(chunks);
 	}
+	update_impostor(impostor, eye_position.x, eye_position.z,
+			view_plane_far);
+	return busy || impostor_busy(impostor);
 }
 
-/** Handle a display request by clearing the screen, drawing the maze, and
- * printing the player's position and heading.
+/** Draw a frame by clearing the screen, drawing the maze, and
+ * drawing the HUD with the player's position and heading and the frame
+ * statistics.  The time this takes is recorded.
  */
-void handle_display() {
+void draw_frame() {
+	TRACE_SPAN(TRACE_FRAME, "draw_frame");
+	struct timespec frame_start, frame_end;
+	clock_gettime(CLOCK_MONOTONIC, &frame_start);
+	draw_calls = 0;
+	vertices_submitted = 0;
+	walls_culled = 0;
+
     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
     // Light position.
     glLightfv(GL_LIGHT0, GL_POSITION, far_light.position);
     
-	// Display the maze.
-	draw_maze();
+	// Display the maze, or a message while the first one is generated.
+	if (maze == NULL) {
+		char message[32];
+		sprintf(message, "Generating maze... %d%%",
+				__atomic_load_n(&generator_percent, __ATOMIC_RELAXED));
+		if (!headless) draw_message(message);
+	}
+	else {
+		update_scenery();
+		if (use_raycaster && !jump_view) draw_raycast();
+		else draw_maze();
+	}
 
-	// Display the player's position and heading.
-	print_position_heading();
+	// Display the HUD.  There is no font without GLUT, so there is no
+	// HUD when running headless.
+	if (!headless) draw_hud();
 
-    glFlush();
-	glutSwapBuffers();
+	// Wait for the frame to finish when headless, so that its time
+	// includes the rendering itself.
+	if (headless) glFinish();
+	else glFlush();
+
+	trace_counter(TRACE_FRAME, "draw_calls", draw_calls);
+	trace_counter(TRACE_FRAME, "vertices", vertices_submitted);
+
+	clock_gettime(CLOCK_MONOTONIC, &frame_end);
+	record_frame((frame_end.tv_sec-frame_start.tv_sec)*1000.0 +
+			(frame_end.tv_nsec-frame_start.tv_nsec)/1.0e6);
 }
 
 /** Handle keyboard events when in the normal in-maze view:
@@ -269,6 +575,10 @@ void handle_display() {
  *  - SPACE: Animate jumping to an overhead view of the maze. Movement 
  *			 is	disabled
  *			 until the player switches back to the in-maze view.
+ *  - n: Generate a new maze in the background and switch to it when it
+ *		 is ready.
+ *  - u, d: Climb up or down the shaft in the player's cell, if there is
+ *		 one.
  *
  *  @param key the key that was pressed.
  *  @param x the mouse x-position when <code>key</code> was pressed.
@@ -278,11 +588,25 @@ void handle_key_norm(unsigned char key, int x, int y) {
 	debug("handle_key_norm()");
 
     if (key == ' ') {
-		glutKeyboardFunc(NULL);
-		glutSpecialFunc(NULL);
+		set_key_funcs(NULL, NULL);
+		release_keys();
 		set_jump_look_at();
-		glutIdleFunc(animate_jump);
-    }
+		set_animation(animate_jump);
+    } else if (key == 'n') {
+		start_generation(maze_seed+1);
+	} else if (key == 'h') {
+		show_hints = !show_hints;
+		update_hints(player_row(), floor(camera_position.z));
+		glutPostRedisplay();
+	} else if (key == 'u' || key == 'd') {
+		cell_t *cell = get_level_cell(maze, player_level,
+				floor(camera_position.x), floor(camera_position.z));
+		if (!has_path(maze, cell, key == 'u' ? UP : DOWN)) return;
+		climb_level = player_level + (key == 'u' ? 1 : -1);
+		set_key_funcs(NULL, NULL);
+		release_keys();
+		set_animation(animate_climb);
+	}
 }
 
 /** Handle keyboard events when in the overhead view:
@@ -297,14 +621,21 @@ void handle_key_jumped(unsigned char key, int x, int y) {
 	debug("handle_key_jumped");
 	if (key == ' ') {
 		debug("Space pressed");
-		glutIdleFunc(animate_fall);
+		set_key_funcs(NULL, NULL);
+		set_animation(animate_fall);
+	} else if (key == 'h') {
+		show_hints = !show_hints;
+		update_hints(player_row(), floor(camera_position.z));
+		glutPostRedisplay();
 	}
 }
 
-/** Handle keyboard events when in the normal maze view:
+/** Handle arrow keys being pressed in the normal maze view.  The key is
+ *  recorded as held, and the player turns or moves on every simulation
+ *  step until it is released (see <code>move_player</code>):
  *
- *	-LEFT: Rotate the camera <code>EYE_THETA_INCR</code> degrees to the left.
- *	-RIGHT: Rotate the camera <code>EYE_THETA_INCR</code> degrees to the right.
+ *	-LEFT: Rotate the camera to the left.
+ *	-RIGHT: Rotate the camera to the right.
  *	-UP: Move the camera forward if possible.
  *	-DOWN: Move the camera backwards if possible.
  *
@@ -315,34 +646,46 @@ void handle_key_jumped(unsigned char key, int x, int y) {
 void handle_special_key(int key, int x, int y) {
 	switch (key) {
 		case GLUT_KEY_LEFT:
-			theta += EYE_THETA_INCR;
-			if (theta >= 360) theta -= 360;
+			keys_down[KeyLeft] = true;
 			break;
 		case GLUT_KEY_RIGHT:
-			theta -= EYE_THETA_INCR;
-		    if (theta < 0) theta += 360;
+			keys_down[KeyRight] = true;
 			break;
-		case GLUT_KEY_UP: {
-			point3_t new_posn;
-			get_new_posn(Forward, &new_posn);
-            if (!is_collision(&new_posn))
-				camera_position = new_posn;
-			process_cell();
+		case GLUT_KEY_UP:
+			keys_down[KeyUp] = true;
 			break;
-		}
-		case GLUT_KEY_DOWN: {
-			point3_t new_posn;
-			get_new_posn(Backward, &new_posn);
-		    if (!is_collision(&new_posn))
-				camera_position = new_posn;
-			process_cell();
+		case GLUT_KEY_DOWN:
+			keys_down[KeyDown] = true;
+			break;
+		default:
+			return;
+	}
+	start_timer();
+}
+
+/** Handle arrow keys being released by clearing their held state.
+ *
+ *	@param key the key that was released.
+ *	@param x the mouse x-position when <code>key</code> was released.
+ *	@param y the mouse y-position when <code>key</code> was released.
+ */
+void handle_special_key_up(int key, int x, int y) {
+	switch (key) {
+		case GLUT_KEY_LEFT:
+			keys_down[KeyLeft] = false;
+			break;
+		case GLUT_KEY_RIGHT:
+			keys_down[KeyRight] = false;
+			break;
+		case GLUT_KEY_UP:
+			keys_down[KeyUp] = false;
+			break;
+		case GLUT_KEY_DOWN:
+			keys_down[KeyDown] = false;
 			break;
-		}
 		default:
 			break;
 	}
-	set_camera();
-	glutPostRedisplay();
 }
 
 /** Handle a resize event by recording the new width and height.
@@ -359,6 +702,110 @@ void handle_resize(int width, int height) {
     glutPostRedisplay();
 }
 
+/** Advance the simulation by however many fixed steps have elapsed since
+ *  the last call, set the camera for the interpolated state and request a
+ *  redisplay.  Re-registers itself as long as an animation is running or
+ *  an arrow key is held.
+ *
+ *  @param value unused.
+ */
+void handle_timer(int value) {
+	int now = glutGet(GLUT_ELAPSED_TIME);
+	advance_simulation(now - last_tick_time);
+	last_tick_time = now;
+
+	swap_world();
+
+	set_camera();
+	glutPostRedisplay();
+
+	bool key_held = false;
+	for (int i=0; i<NUM_HELD_KEYS; i++) key_held = key_held || keys_down[i];
+	if (animation != NULL || key_held || generating || chunks_busy(chunks) ||
+			impostor_busy(impostor)) {
+		glutTimerFunc(FRAME_MS, handle_timer, 0);
+	} else {
+		// Nothing is moving, so settle on the final state and stop.
+		prev_camera_position = camera_position;
+		prev_theta = theta;
+		render_alpha = 0.0f;
+		set_camera();
+		timer_running = false;
+	}
+}
+
+// ANIMATIONS
+
+/** Animate climbing a shaft to <code>climb_level</code>, then put the
+ *  player on that level and give them control.
+ *
+ *  @param dt the length of the simulation step in seconds.
+ */
+void animate_climb(float dt) {
+	float target = level_base(climb_level) + NORM_HEIGHT;
+	float step = CLIMB_SPEED*dt;
+	if (fabsf(target-camera_position.y) > step) {
+		camera_position.y += target > camera_position.y ? step : -step;
+		return;
+	}
+
+	camera_position.y = target;
+	player_level = climb_level;
+	set_animation(NULL);
+	set_key_funcs(handle_key_norm, handle_special_key);
+	process_cell();
+}
+
+/** Animate the end of the maze by spinning the camera around and lifting
+ *  it up until it reaches <code>END_HEIGHT</code> above its level.
+ *
+ *  @param dt the length of the simulation step in seconds.
+ */
+void animate_end(float dt) {
+	theta += END_SPIN_SPEED*dt;
+	if (theta >= 360) theta -= 360;
+	camera_position.y += END_RISE_SPEED*dt;
+	if (camera_position.y >= level_base(player_level) + END_HEIGHT) {
+		camera_position.y = level_base(player_level) + END_HEIGHT;
+		set_animation(NULL);
+	}
+}
+
+/** Animate falling back to the normal in-maze view from the overhead view.
+ *
+ *  @param dt the length of the simulation step in seconds.
+ */
+void animate_fall(float dt) {
+	debug("animate_fall()");
+
+	camera_position.y -= JUMP_SPEED*dt;
+	if (camera_position.y <= level_base(player_level) + NORM_HEIGHT) {
+		// Stop animating and return control to the player.
+		camera_position.y = level_base(player_level) + NORM_HEIGHT;
+		jump_view = false;
+		set_animation(NULL);
+		set_key_funcs(handle_key_norm, handle_special_key);
+	}
+}
+
+/** Animate jumping to the overhead view.
+ *
+ *  @param dt the length of the simulation step in seconds.
+ */
+void animate_jump(float dt) {
+	debug("animate_jump()");
+
+	// Rise at JUMP_SPEED until we reach JUMP_HEIGHT.  Then we're done
+	// animating, so set the keyboard callback to allow the player to
+	// return to the normal view.
+	camera_position.y += JUMP_SPEED*dt;
+	if (camera_position.y >= level_base(player_level) + JUMP_HEIGHT) {
+		camera_position.y = level_base(player_level) + JUMP_HEIGHT;
+		set_animation(NULL);
+		set_key_funcs(handle_key_jumped, NULL);
+	}
+}
+
 
 
 
@@ -376,66 +823,260 @@ void gl_init() {
     glLightModeli(GL_LIGHT_MODEL_LOCAL_VIEWER, 1);
     glLightModelfv(GL_LIGHT_MODEL_AMBIENT, global_ambient);
 	glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
+
+	chunks = make_chunk_cache(CHUNK_BUDGET_MB << 20, CHUNK_UPLOAD_MB << 20,
+			sysconf(_SC_NPROCESSORS_ONLN)-1);
+	impostor = make_impostor();
+
+	// The HUD font comes from GLUT, which is not initialized when running
+	// headless, and there is no HUD then anyway.
+	if (!headless) init_glyphs();
 }
 
-/** Create the maze and visited array, set the lights, and set the camera.
+/** Start generating the maze, set the lights, and set the camera.  When
+ * running headless, wait for the maze instead.
  */
 void init() {
     debug("init()");
 
-	initialize_maze();
-	visited = calloc(maze_width*maze_height, sizeof(bool));
-	debug("total cells: %d", maze_width*maze_height);
+	// Set the lights
+	set_lights();
+
+    // Set the viewpoint.
+    set_camera();
+
+	if (headless) {
+		world_t *w = make_world(maze_seed);
+		if (w == NULL) exit(EXIT_FAILURE);
+		install_world(w);
+	} else {
+		set_key_funcs(NULL, NULL);
+		start_generation(maze_seed);
+	}
+}
+
+/** Make the world for the current maze size and a given seed:  generate
+ * the maze and its visited set.  Runs on the generator thread, so must
+ * not call GL.  The maze is made a step at a time, so that the progress
+ * can be shown.
+ *
+ * @param seed the seed for the maze.
+ * @return the world, or NULL if there was not enough memory for it.
+ */
+world_t *make_world(long seed) {
+	debug("make_world()");
+	TRACE_SPAN(TRACE_WORLD, "make_world");
+
+	world_t *w = calloc(1, sizeof(world_t));
+	maze_opts_t opts = {MAZE_ROW_MAJOR, 0, maze_levels};
+	maze_gen_t *gen = w != NULL ?
+		start_maze(maze_height, maze_width, seed, &opts) : NULL;
+	if (gen != NULL) {
+		while (!step_maze(gen, 0, GENERATOR_STEP_US)) {
+			__atomic_store_n(&generator_percent,
+					(int)(100*get_gen_progress(gen)), __ATOMIC_RELAXED);
+		}
+		__atomic_store_n(&generator_percent, 0, __ATOMIC_RELAXED);
+		w->maze = finish_maze(gen);
+	}
+	size_t ncells = (size_t)maze_levels*maze_width*maze_height;
+	if (w != NULL && w->maze != NULL) {
+		w->seed = seed;
+		w->visited = calloc((ncells+WORD_BITS-1)/WORD_BITS,
+				sizeof(unsigned long));
+		w->next_hops = make_next_hops(w->maze, get_end(w->maze));
+	}
+	if (w == NULL || w->maze == NULL || w->visited == NULL ||
+			w->next_hops == NULL) {
+		fprintf(stderr, "Not enough memory for a %dx%d maze\n",
+				maze_height, maze_width);
+		if (w != NULL) {
+			free_maze(w->maze);
+			free(w->visited);
+			free(w->next_hops);
+			free(w);
+		}
+		return NULL;
+	}
+	debug("total cells: %zu", ncells);
+	return w;
+}
+
+/** Make a world the current one, freeing the old one, and put the player
+ * on its start cell.
+ *
+ * @param w the new world.
+ */
+void install_world(world_t *w) {
+	TRACE_SPAN(TRACE_WORLD, "install_world");
+	set_chunk_maze(chunks, w->maze);
+	set_impostor_maze(impostor, maze_levels == 1 ? w->maze : NULL);
+	free_maze(maze);
+	free(visited);
+	free(next_hops);
+
+	maze_seed = w->seed;
+	maze = w->maze;
+	visited = w->visited;
+	next_hops = w->next_hops;
+	hint_cell = -1;
+	start = get_start(maze);
+	end = get_end(maze);
+	free(w);
+
+	reset_player();
+}
 
+/** Put the player on the start cell in the normal view, facing along the
+ * x-axis, and give them control.
+ */
+void reset_player() {
 	cell_t *start = get_start(maze);
 
 	// Viewpoint position.
     theta = 0;
+	player_level = start->level;
     camera_position.x = start->r+0.5;
-    camera_position.y = NORM_HEIGHT;
+    camera_position.y = level_base(player_level) + NORM_HEIGHT;
     camera_position.z = start->c+0.5;
+	prev_theta = theta;
+	prev_camera_position = camera_position;
+	jump_view = false;
+	animation = NULL;
+	release_keys();
+	set_key_funcs(handle_key_norm, handle_special_key);
+	update_hints(player_row(), start->c);
 
-    // Set the viewpoint.
     set_camera();
+}
 
-	// Set the lights
-	set_lights();
+/** Start generating a new world on the generator thread, unless one is
+ * already being generated.  It is swapped in by <code>swap_world</code>.
+ *
+ * @param seed the seed for the new maze.
+ */
+void start_generation(long seed) {
+	if (generating) return;
+	generating = true;
+	generator_seed = seed;
+	pthread_create(&generator, NULL, run_generator, NULL);
+	start_timer();
 }
 
-/*  Initialize the maze by building all possible walls and set the global
- *  start and end cell pointers.
+/** The generator thread:  make a world and leave it in
+ * <code>next_world</code>, or leave that NULL if it could not be made.
+ *
+ * @param arg unused.
+ * @return NULL.
  */
-void initialize_maze() {
-    maze = make_maze(maze_height, maze_width, time(NULL));
-	start = get_start(maze);
-	end = get_end(maze);
+void *run_generator(void *arg) {
+	world_t *w = make_world(generator_seed);
+	pthread_mutex_lock(&world_lock);
+	next_world = w;
+	world_done = true;
+	pthread_mutex_unlock(&world_lock);
+	return NULL;
+}
+
+/** If the generator thread has finished, swap in the world it made.  If
+ * it could not make one, the current world stays; without one, there is
+ * nothing to play, so the program exits.
+ *
+ * @return true if a new world was swapped in, false otherwise.
+ */
+bool swap_world() {
+	pthread_mutex_lock(&world_lock);
+	bool done = world_done;
+	world_t *w = next_world;
+	world_done = false;
+	next_world = NULL;
+	pthread_mutex_unlock(&world_lock);
+	if (!done) return false;
+
+	pthread_join(generator, NULL);
+	generating = false;
+	if (w == NULL) {
+		if (maze == NULL) exit(EXIT_FAILURE);
+		return false;
+	}
+	install_world(w);
+	return true;
+}
+
+/** Compile a display list for each ASCII glyph of the HUD font.
+ */
+void init_glyphs() {
+	glyph_base = glGenLists(NUM_GLYPHS);
+	for (int i=0; i<NUM_GLYPHS; i++) {
+		glNewList(glyph_base+i, GL_COMPILE);
+		glutBitmapCharacter(HUD_FONT, i);
+		glEndList();
+	}
+}
+
+/** Close the frame-time CSV file, flushing anything still buffered.
+ */
+void close_csv() {
+	if (csv_file != NULL) fclose(csv_file);
+	csv_file = NULL;
+}
+
+/** Write the trace to the trace file.
+ */
+void close_trace() {
+	trace_mask = 0;
+	if (!trace_dump(trace_file)) perror(trace_file);
 }
 
 // APPLICATION FUNCTIONS
 
-/** Draw bright gold square markers on the floor of all visited cells.
+/** Draw bright gold square markers on the floor of all visited cells on
+ * the player's level.
  */
 void draw_breadcrumbs() {
 	glMatrixMode(GL_MODELVIEW);
 
-	for (int i=0; i<maze_width; i++) {
-		for (int j=0; j<maze_height; j++) {
-			if (is_visited(j, i)) {
-				glPushMatrix();
-				glTranslatef(j+.5, 0.0, i+.5);
-				glScalef(.25, 1.0, .25);
-				draw_square(&bright_gold);
-				glPopMatrix();
-			}
+	// Skip over the level's part of the visited set a word at a time.
+	size_t level_cells = (size_t)maze_width*maze_height;
+	size_t first = player_level*level_cells, last = first+level_cells;
+	for (size_t w=first/WORD_BITS; w<(last+WORD_BITS-1)/WORD_BITS; w++) {
+		for (unsigned long bits=visited[w]; bits != 0; bits &= bits-1) {
+			size_t k = w*WORD_BITS + __builtin_ctzl(bits);
+			if (k < first || k >= last) continue;
+			int j = (k-first)/maze_width, i = k%maze_width;
+			glPushMatrix();
+			glTranslatef(j+.5, level_base(player_level), i+.5);
+			glScalef(.25, 1.0, .25);
+			draw_square(&bright_gold);
+			glPopMatrix();
 		}
 	}
 }
 
-/** Draw the maze by first drawing the west and south exterior walls, then
- * drawing any north or east walls of each cell.
+/** Draw the route hint as one line strip from a vertex array.
+ */
+void draw_hints() {
+	if (!show_hints || hint_route_len < 2) return;
+
+	glPushAttrib(GL_ENABLE_BIT | GL_CURRENT_BIT | GL_LINE_BIT);
+	glDisable(GL_LIGHTING);
+	glColor3f(1.0f, 1.0f, 0.0f);
+	glLineWidth(3.0f);
+	glEnableClientState(GL_VERTEX_ARRAY);
+	glVertexPointer(3, GL_FLOAT, 0, hint_route);
+	glDrawArrays(GL_LINE_STRIP, 0, hint_route_len);
+	glDisableClientState(GL_VERTEX_ARRAY);
+	glPopAttrib();
+	draw_calls++;
+	vertices_submitted += hint_route_len;
+}
+
+/** Draw the maze:  the markers on the player's level, then the walls of
+ * that level and, dimmer, those of the levels above and below it.
  */
 void draw_maze() {
 	debug("draw_maze()");
+	TRACE_SPAN(TRACE_FRAME, "draw_maze");
 	
 	glMatrixMode(GL_MODELVIEW);
 
@@ -445,39 +1086,126 @@ void draw_maze() {
 	// Draw the breadcrumbs.
 	draw_breadcrumbs();	
 
+	// Draw the shafts near the player.
+	draw_shafts();
+
+	// Draw the route to the end.
+	draw_hints();
+
+	if (player_level > 0) draw_walls(player_level-1);
+	if (player_level < maze_levels-1) draw_walls(player_level+1);
+	draw_walls(player_level);
+}
+
+/** Draw the walls of a level by first drawing the west and south exterior
+ * walls, then drawing the chunks of the wall mesh that are loaded and might
+ * be in view.  The player's level is drawn in blue and the others dimmer.
+ * In the overhead view of a maze with one level, only the chunks within
+ * IMPOSTOR_FAR are drawn, and the impostor is drawn over them.
+ *
+ * @param level the level.
+ */
+void draw_walls(int level) {
+	material_t *material =
+		level == player_level ? &blue_plastic : &dim_plastic;
+
 	// Draw the west and south exterior walls. 
 	glPushMatrix();
-	glTranslatef(maze_height/2.0, 0.5, 0.0);
+	glTranslatef(maze_height/2.0, level_base(level)+0.5, 0.0);
 	glScalef(maze_height+0.25, 1.0, 1.0);
 	draw_wall();
 	glPopMatrix();
 	glPushMatrix();
-	glTranslatef(0.0, 0.5, maze_width/2.0);
+	glTranslatef(0.0, level_base(level)+0.5, maze_width/2.0);
 	glScalef(1.0, 1.0, maze_width+0.25);
 	glRotatef(90, 0.0, 1.0, 0.0);
 	draw_wall();
 	glPopMatrix();
 
-	// Draw any north or east walls of each cell.
-	for (int i=0; i<maze_width; i++) {
-		for (int j=0; j<maze_height; j++) {
-			if (has_wall(maze, get_cell(maze, j, i), NORTH)) {
-				glPushMatrix();
-				glTranslatef(j+1, 0.5, i+0.5);
-				glScalef(1.0, 1.0, 1.25);
-				glRotatef(90, 0.0, 1.0, 0.0);
-				draw_wall();
-				glPopMatrix();
-			}
-			if (has_wall(maze, get_cell(maze, j, i), EAST)) {
-				glPushMatrix();
-				glTranslatef(j+0.5, 0.5, i+1);
-				glScalef(1.25, 1.0, 1.0);
-				draw_wall();
-				glPopMatrix();
-			}
-		}
+	// Draw the north and east walls.
+	set_material(material);
+	if (!jump_view || maze_levels > 1) {
+		draw_chunks(chunks, level, is_culled, &draw_calls,
+				&vertices_submitted, &walls_culled);
+		return;
 	}
+	draw_chunks(chunks, level, is_culled_lod, &draw_calls,
+			&vertices_submitted, &walls_culled);
+	float eye[3] = {eye_position.x, eye_position.y, eye_position.z};
+	draw_impostor(impostor, eye, IMPOSTOR_NEAR, IMPOSTOR_FAR, is_culled,
+			&draw_calls, &vertices_submitted);
+}
+
+/** Draw a message in the middle of the window.
+ *
+ * @param message the message.
+ */
+void draw_message(char *message) {
+	glColor3f(1.0f, 1.0f, 1.0f);
+	glWindowPos2s(win_width/2 - 4*strlen(message), win_height/2);
+	draw_string(message);
+}
+
+/** Draw the in-maze view with the raycaster and present its framebuffer
+ * as a texture on a quad covering the window.  The raycaster and texture
+ * are made on first use and resized to follow the window.
+ */
+void draw_raycast() {
+	if (raycaster == NULL) {
+		raycaster = make_raycaster(win_width, win_height,
+				sysconf(_SC_NPROCESSORS_ONLN));
+		glGenTextures(1, &raycast_texture);
+	}
+
+	glBindTexture(GL_TEXTURE_2D, raycast_texture);
+	if (raycast_width != win_width || raycast_height != win_height) {
+		resize_raycaster(raycaster, win_width, win_height);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, win_width, win_height, 0,
+				GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+		raycast_width = win_width;
+		raycast_height = win_height;
+	}
+
+	raycast(raycaster, maze, eye_position.x + player_level*maze_height,
+			eye_position.y - level_base(player_level), eye_position.z,
+			eye_theta, FOV_Y);
+	glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, win_width, win_height, GL_RGBA,
+			GL_UNSIGNED_BYTE, get_raycast_pixels(raycaster));
+
+	// Draw the texture on a quad that fills the window.
+	glPushAttrib(GL_ENABLE_BIT);
+	glDisable(GL_LIGHTING);
+	glDisable(GL_DEPTH_TEST);
+	glDisable(GL_CULL_FACE);
+	glEnable(GL_TEXTURE_2D);
+	glTexEnvi(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_REPLACE);
+	glMatrixMode(GL_PROJECTION);
+	glPushMatrix();
+	glLoadIdentity();
+	glMatrixMode(GL_MODELVIEW);
+	glPushMatrix();
+	glLoadIdentity();
+
+	glBegin(GL_QUADS);
+	draw_calls++;
+	vertices_submitted += 4;
+	glTexCoord2f(0.0, 0.0);
+	glVertex2f(-1.0, -1.0);
+	glTexCoord2f(1.0, 0.0);
+	glVertex2f(1.0, -1.0);
+	glTexCoord2f(1.0, 1.0);
+	glVertex2f(1.0, 1.0);
+	glTexCoord2f(0.0, 1.0);
+	glVertex2f(-1.0, 1.0);
+	glEnd();
+
+	glPopMatrix();
+	glMatrixMode(GL_PROJECTION);
+	glPopMatrix();
+	glMatrixMode(GL_MODELVIEW);
+	glPopAttrib();
 }
 
 /** Draw a sqaure of side length 2 in the xz plane centered at the origin
@@ -490,6 +1218,8 @@ void draw_square(material_t *material) {
 
 	// Draw the square.
 	glBegin(GL_QUADS);
+	draw_calls++;
+	vertices_submitted += 4;
 
 	glNormal3f(0.0, 1.0, 0.0);
 	glVertex3f(1.0, 0.0, 1.0);
@@ -500,30 +1230,130 @@ void draw_square(material_t *material) {
 	glEnd();
 }
 
-/** Draw a green square marker on the start cell and a red one on the end cell.
+/** Draw a cyan square marker on the floor of each cell near the player
+ * with a shaft up and a magenta one on each with a shaft down.
+ */
+void draw_shafts() {
+	if (maze_levels == 1) return;
+
+	int r0 = floor(camera_position.x) - SHAFT_VIEW;
+	int r1 = floor(camera_position.x) + SHAFT_VIEW + 1;
+	int c0 = floor(camera_position.z) - SHAFT_VIEW;
+	int c1 = floor(camera_position.z) + SHAFT_VIEW + 1;
+	if (r0 < 0) r0 = 0;
+	if (c0 < 0) c0 = 0;
+	if (r1 > maze_height) r1 = maze_height;
+	if (c1 > maze_width) c1 = maze_width;
+	if (r0 >= r1 || c0 >= c1) return;
+
+	const unsigned char *cells =
+		get_row_span(maze, player_level*maze_height + r0, r1-r0);
+	for (int r=r0; r<r1; r++) {
+		for (int c=c0; c<c1; c++) {
+			unsigned char p = cells[(r-r0)*maze_width + c];
+			if (!(p & (UP|DOWN))) continue;
+			glPushMatrix();
+			glTranslatef(r+.5, level_base(player_level), c+.5);
+			glScalef(.35, 1.0, .35);
+			draw_square(p & UP ? &bright_cyan : &bright_magenta);
+			glPopMatrix();
+		}
+	}
+}
+
+/** Draw a green square marker on the start cell and a red one on the end
+ * cell, if they are on the player's level.
  */
 void draw_start_end() {
-	glPushMatrix();
-	glTranslatef(start->r+0.5, 0.0, start->c+0.5);
-	glScalef(0.5, 0.0, 0.5);
-	draw_square(&bright_green);
-	glPopMatrix();
+	if (start->level == player_level) {
+		glPushMatrix();
+		glTranslatef(start->r+0.5, level_base(start->level), start->c+0.5);
+		glScalef(0.5, 0.0, 0.5);
+		draw_square(&bright_green);
+		glPopMatrix();
+	}
+	if (end->level != player_level) return;
 	
 	glPushMatrix();
-	glTranslatef(end->r+0.5, 0.0, end->c+0.5);
+	glTranslatef(end->r+0.5, level_base(end->level), end->c+0.5);
 	glScalef(0.5, 0.0, 0.5);
 	draw_square(&bright_red);
 	glPopMatrix();
 }
 
+/** Compare two doubles for qsort.
+ */
+static int double_cmp(const void *a, const void *b) {
+	double x = *(const double*)a;
+	double y = *(const double*)b;
+	return (x > y) - (x < y);
+}
+
+/** Draw the HUD: the player's position (camera_position) and heading
+ * (theta), the CPU frame time with its percentiles over the last
+ * <code>FRAME_HISTORY</code> frames and the counts for the last frame, and
+ * the state of the chunk cache.
+ * The counts are taken before the HUD itself is drawn.
+ */
+void draw_hud() {
+	debug("draw_hud()");
+	int last_draw_calls = draw_calls;
+	int last_vertices = vertices_submitted;
+	int last_culled = walls_culled;
+
+	// Percentiles of the recorded frame times.
+	int n = frame_count < FRAME_HISTORY ? frame_count : FRAME_HISTORY;
+	double sorted[FRAME_HISTORY];
+	double last_ms = 0.0, p50 = 0.0, p95 = 0.0, p99 = 0.0;
+	if (n > 0) {
+		memcpy(sorted, frame_times, n*sizeof(double));
+		qsort(sorted, n, sizeof(double), double_cmp);
+		last_ms = frame_times[(frame_count-1)%FRAME_HISTORY];
+		p50 = sorted[n*50/100];
+		p95 = sorted[n*95/100];
+		p99 = sorted[n*99/100];
+	}
+
+	char s[128];
+	glColor3f(1.0f, 1.0f, 1.0f);
+
+	glWindowPos2s(10, 10+4*HUD_LINE_HEIGHT);
+	snprintf(s, sizeof(s), "Location: (%f, %f, %f)  Level: %d",
+			camera_position.x, camera_position.y, camera_position.z,
+			player_level);
+	draw_string(s);
+
+	glWindowPos2s(10, 10+3*HUD_LINE_HEIGHT);
+	snprintf(s, sizeof(s), "Heading: %.0f", theta);
+	draw_string(s);
+
+	glWindowPos2s(10, 10+2*HUD_LINE_HEIGHT);
+	snprintf(s, sizeof(s), "CPU frame: %.2f ms  p50 %.2f  p95 %.2f  p99 %.2f",
+			last_ms, p50, p95, p99);
+	draw_string(s);
+
+	glWindowPos2s(10, 10+HUD_LINE_HEIGHT);
+	snprintf(s, sizeof(s), "Draw calls: %d  Vertices: %d  Walls culled: %d",
+			last_draw_calls, last_vertices, last_culled);
+	draw_string(s);
+
+	chunk_stats_t stats;
+	get_chunk_stats(chunks, &stats);
+	glWindowPos2s(10, 10);
+	snprintf(s, sizeof(s), "Chunks: %d resident (%.1f MB)  %d pending  "
+			"+%d -%d  Impostor tiles: %d", stats.resident,
+			stats.resident_bytes/1048576.0, stats.pending, stats.uploaded,
+			stats.evicted, get_impostor_tiles(impostor));
+	draw_string(s);
+}
+
 /* Draw a string at the current raster position.
  * 
  *@param the_string the string to display.
  */
 void draw_string(char *the_string) {
-	for (int i=0; i<strlen(the_string); i++) {
-		glutBitmapCharacter(GLUT_BITMAP_HELVETICA_12, the_string[i]);
-	}
+	glListBase(glyph_base);
+	glCallLists(strlen(the_string), GL_UNSIGNED_BYTE, the_string);
 }
 
 /** Draw a canonical rectangular solid of length 1, height 1, and width .25
@@ -535,6 +1365,8 @@ void draw_wall() {
 
 	// Draw the wall as a sequence of GL_QUADS
 	glBegin(GL_QUADS);
+	draw_calls++;
+	vertices_submitted += 24;
 
 	// x=.5 plane
 	glNormal3f(1.0, 0.0, 0.0);
@@ -584,15 +1416,16 @@ void draw_wall() {
 }
 
 /** Set a <code>point3_t</code> representing the result of moving the camera
- * <code>CAMERA_POSN_INCR</code> forward or backward.
+ * a given distance forward or backward.
  *
  * @param dir the direction.
+ * @param distance the distance to move.
  * @param new_posn the <code>point3_t</code> to be filled in with the result of
- *		moving <code>CAMERA_POSN_INCR</code> in direction <code>dir</code>.
+ *		moving <code>distance</code> in direction <code>dir</code>.
  */
-void get_new_posn(movement_dir_t dir, point3_t *new_posn) {
-	float x_incr = CAMERA_POSN_INCR*cos(D2R(theta));
-	float z_incr = CAMERA_POSN_INCR*sin(D2R(-theta));
+void get_new_posn(movement_dir_t dir, float distance, point3_t *new_posn) {
+	float x_incr = distance*cos(D2R(theta));
+	float z_incr = distance*sin(D2R(-theta));
 	new_posn->y = camera_position.y;
 
 	if (dir == Forward) {
@@ -604,77 +1437,109 @@ void get_new_posn(movement_dir_t dir, point3_t *new_posn) {
 	}
 }
 
-/** Check if a point collides with any walls.
- *
- * @param posn the point for which to check collision.
- * @return true if <code>posn</code> collides with any walls, false otherwise.
- */
-bool is_collision(point3_t *posn) {    
-    // Get the cell in which posn is located.
-    int r = floor(posn->x);
-    int c = floor(posn->z);
-    cell_t *cell = get_cell(maze, r, c);
-
-	// Iterate through all wall directions and check collision with each
-	// wall that this cell has. If posn collides with any of them,
-	// return true.
-	unsigned char current_dir;
-	point3_t closest_wall_pt = {0.0, NORM_HEIGHT, 0.0};
-	for (int i=0; i<NUM_WALL_DIRS; i++) {
-		current_dir = wall_dirs[i];
-		if (has_wall(maze, cell, current_dir)) {
-			switch(current_dir) {
-				case NORTH:
-					closest_wall_pt.x = cell->r+1-WALL_THICKNESS/2;
-					closest_wall_pt.z = posn->z;
-					break;
-				case SOUTH:
-					closest_wall_pt.x = cell->r+WALL_THICKNESS/2;
-					closest_wall_pt.z = posn->z;
-					break;
-				case EAST:
-					closest_wall_pt.x = posn->x;
-					closest_wall_pt.z = cell->c+1-WALL_THICKNESS/2;
-					break;
-				case WEST:
-					closest_wall_pt.x = posn->x;
-					closest_wall_pt.z = cell->c+WALL_THICKNESS/2;
-			}
-			if (dist(posn, &closest_wall_pt) < COLLISION_THRESHOLD)
-				return true;
-		}
-	}
-	// We've checked all the walls without returning, so
-	// there are no collisions.
-	return false;
+/** Determine whether a region is certainly out of view, so that its walls
+ * need not be drawn.  A region is culled if it is farther away than the far
+ * plane or, in the normal view, if it lies entirely outside the
+ * horizontal field of view.
+ *
+ * @param x the x-coordinate of the region's center.
+ * @param z the z-coordinate of the region's center.
+ * @param radius the radius of a circle around the center containing the
+ *		region and its walls.
+ * @return true if the region is out of view, false otherwise.
+ */
+bool is_culled(float x, float z, float radius) {
+	float dx = x-eye_position.x;
+	float dy = eye_position.y-level_base(player_level);
+	float dz = z-eye_position.z;
+	float far_dist = view_plane_far+radius;
+	if (dx*dx+dy*dy+dz*dz > far_dist*far_dist) return true;
+
+	// The field of view is only a wedge in the xz plane when we are
+	// looking horizontally.
+	if (jump_view) return false;
+
+	// Signed distances from the cell center to the left and right sides
+	// of the view wedge.
+	float half_fov = atan(tan(D2R(FOV_Y/2))*win_width/win_height);
+	float fwd = dx*cos(D2R(eye_theta)) + dz*sin(D2R(-eye_theta));
+	float side = -dx*sin(D2R(-eye_theta)) + dz*cos(D2R(eye_theta));
+	float c = cos(half_fov), s = sin(half_fov);
+	return (side*c - fwd*s > radius) || (-side*c - fwd*s > radius);
+}
+
+/** Determine whether a region is out of view or wholly beyond
+ * IMPOSTOR_FAR from the eye, where the impostor stands in for its walls.
+ *
+ * @param x the x-coordinate of the region's center.
+ * @param z the z-coordinate of the region's center.
+ * @param radius the radius of a circle around the center containing the
+ *		region and its walls.
+ * @return true if the region's walls need not be drawn, false otherwise.
+ */
+bool is_culled_lod(float x, float z, float radius) {
+	float dx = x-eye_position.x;
+	float dy = eye_position.y-level_base(player_level);
+	float dz = z-eye_position.z;
+	float far_dist = IMPOSTOR_FAR+radius;
+	if (dx*dx+dy*dy+dz*dz > far_dist*far_dist) return true;
+	return is_culled(x, z, radius);
 }
 
 /** Determine whether or not a given cell in the maze has been visted.
  *
- * @param r the row of the cell.
+ * @param r the row of the cell, counting the rows of all levels.
  * @param c the column of the cell.
  */
 bool is_visited(int r, int c) {
-	return *(visited+r*maze_width+c);
+	size_t k = (size_t)r*maze_width+c;
+	return (visited[k/WORD_BITS] >> (k%WORD_BITS)) & 1;
 }
 
-/** Print the position (camera_position) and heading (theta) of the player.
+/** Turn and move the player according to the arrow keys that are held
+ *  down.  Opposing keys cancel out.  The player stops at walls and slides
+ *  along them.
+ *
+ *  @param dt the length of the simulation step in seconds.
  */
-void print_position_heading() {
-	debug("print_position_heading()");
-	glColor3f(1.0f, 1.0f, 1.0f);
+void move_player(float dt) {
+	if (keys_down[KeyLeft] != keys_down[KeyRight]) {
+		theta += (keys_down[KeyLeft] ? TURN_SPEED : -TURN_SPEED)*dt;
+		if (theta >= 360) theta -= 360;
+		if (theta < 0) theta += 360;
+	}
 
-	glWindowPos2s(10, 30);
-	char *s;
-	asprintf(&s, "Location: (%f, %f, %f)", camera_position.x, 
-			camera_position.y, camera_position.z);
-	draw_string(s);
-	free(s);
+	if (keys_down[KeyUp] != keys_down[KeyDown]) {
+		point3_t new_posn;
+		get_new_posn(keys_down[KeyUp] ? Forward : Backward, MOVE_SPEED*dt,
+				&new_posn);
+		// Collide in the rows of the player's level; the walls between
+		// levels keep the player on it.
+		float offset = player_level*maze_height;
+		float x = camera_position.x + offset;
+		move_circle(maze, &x, &camera_position.z,
+				new_posn.x-camera_position.x, new_posn.z-camera_position.z,
+				COLLISION_RADIUS);
+		camera_position.x = x - offset;
+		process_cell();
+	}
+}
 
-	glWindowPos2s(10, 10);
-	asprintf(&s, "Heading: %d", theta);
-	draw_string(s);
-	free(s);
+/** Get the player's row, counting the rows of the levels below.
+ *
+ * @return the row.
+ */
+int player_row() {
+	return player_level*maze_height + (int)floor(camera_position.x);
+}
+
+/** Get the height of the floor of a level.
+ *
+ * @param level the level.
+ * @return the height.
+ */
+float level_base(int level) {
+	return level*LEVEL_HEIGHT;
 }
 
 /** Determine if the current cell is a newly visited cell. If so, and it is not
@@ -685,9 +1550,9 @@ void print_position_heading() {
  */
 void process_cell() {
 	// Get the current cell.
-	int r = floor(camera_position.x);
+	int r = player_row();
 	int c = floor(camera_position.z);
-	cell_t *cell = get_cell(maze, r, c);
+	cell_t *cell = get_level_cell(maze, player_level, r%maze_height, c);
 	
 	// If this is a newly visited cell that isn't the start or end cell, 
 	// set it as visited.
@@ -697,42 +1562,122 @@ void process_cell() {
 	else if (!is_visited(r, c) && cell_cmp(cell, start) != 0) { 
 		set_visited(r, c);
 	}
+
+	update_hints(r, c);
+}
+
+/** Rebuild the route hint from a cell by following the next hops to the
+ * end, unless hints are hidden or the route already starts there.
+ *
+ * @param r the row of the player's cell, counting the rows of all levels.
+ * @param c the column of the player's cell.
+ */
+void update_hints(int r, int c) {
+	long k = (long)r*maze_width + c;
+	if (!show_hints || k == hint_cell) return;
+	hint_cell = k;
+
+	hint_route_len = 0;
+	while (true) {
+		if (hint_route_len == hint_route_cap) {
+			hint_route_cap = hint_route_cap == 0 ? 256 : 2*hint_route_cap;
+			hint_route = realloc(hint_route, 3*hint_route_cap*sizeof(GLfloat));
+		}
+		GLfloat *v = hint_route + 3*hint_route_len++;
+		v[0] = r%maze_height+0.5f;
+		v[1] = level_base(r/maze_height) + HINT_HEIGHT;
+		v[2] = c+0.5f;
+
+		unsigned char d = next_hops[(size_t)r*maze_width + c];
+		if (d == NORTH) r++;
+		else if (d == EAST) c++;
+		else if (d == SOUTH) r--;
+		else if (d == WEST) c--;
+		else if (d == UP) r += maze_height;
+		else if (d == DOWN) r -= maze_height;
+		else break;
+	}
+}
+
+/** Clear the held state of all arrow keys.
+ */
+void release_keys() {
+	for (int i=0; i<NUM_HELD_KEYS; i++) keys_down[i] = false;
 }
 
 // Method called when player reaches the end of the maze.
 void reached_end() {
-    glutKeyboardFunc(NULL);
-    glutSpecialFunc(NULL);
+	set_key_funcs(NULL, NULL);
+	release_keys();
 
-    glutIdleFunc(animate_end);
+	set_animation(animate_end);
 }
 
-// Maze ending animation.
-void animate_end() {
-    if (camera_position.y >= 50.0) {
-        glutIdleFunc(NULL);
-    }
-    // Spin camera around and lift it up.
-    theta += 1;
-    if (theta >= 360) theta -= 360;
-    camera_position.y += 0.001;
-    
-    set_camera();
-    glutPostRedisplay();
+/** Set the keyboard callbacks, registering them with GLUT unless we are
+ *  running headless.
+ *
+ *  @param keys the callback for ASCII keys, or <code>NULL</code>.
+ *  @param special the callback for special keys, or <code>NULL</code>.
+ */
+void set_key_funcs(void (*keys)(unsigned char, int, int),
+		void (*special)(int, int, int)) {
+	key_func = keys;
+	special_func = special;
+	if (!headless) {
+		glutKeyboardFunc(keys);
+		glutSpecialFunc(special);
+	}
+}
+
+/** Set the current animation and make sure the simulation timer is
+ *  running.
+ *
+ *  @param anim the animation, or <code>NULL</code> to stop animating.
+ */
+void set_animation(void (*anim)(float)) {
+	animation = anim;
+	if (anim != NULL) start_timer();
 }
 
 /** Set the camera transform. The viewpoint is given by the eye coordinates,
  * and we look in angle theta-90 around the y-axis (theta is the angle the
- * view direction makes with the x-axis).
+ * view direction makes with the x-axis).  While jumping, we look at
+ * <code>jump_look_at</code> instead.
+ *
+ * The eye and angle are interpolated between the previous and current
+ * simulation states by <code>render_alpha</code>.
  */
 void set_camera() {
 	debug("set_camera()");
 
+	point3_t eye;
+	eye.x = prev_camera_position.x +
+		render_alpha*(camera_position.x-prev_camera_position.x);
+	eye.y = prev_camera_position.y +
+		render_alpha*(camera_position.y-prev_camera_position.y);
+	eye.z = prev_camera_position.z +
+		render_alpha*(camera_position.z-prev_camera_position.z);
+
+	// Interpolate the heading the short way around the circle.
+	float dtheta = theta-prev_theta;
+	if (dtheta > 180) dtheta -= 360;
+	if (dtheta < -180) dtheta += 360;
+	eye_theta = prev_theta + render_alpha*dtheta;
+	if (eye_theta >= 360) eye_theta -= 360;
+	if (eye_theta < 0) eye_theta += 360;
+	eye_position = eye;
+
     // Set the camera transform.
 	glMatrixMode(GL_MODELVIEW);
 	glLoadIdentity();
-    glRotatef(360-(theta-90), 0.0, 1.0, 0.0);
-    glTranslatef(-camera_position.x, -camera_position.y, -camera_position.z);
+	if (jump_view) {
+		gluLookAt(eye.x, eye.y, eye.z,
+				  jump_look_at.x, jump_look_at.y, jump_look_at.z,
+				  up_dir.x, up_dir.y, up_dir.z);
+	} else {
+		glRotatef(360-(eye_theta-90), 0.0, 1.0, 0.0);
+		glTranslatef(-eye.x, -eye.y, -eye.z);
+	}
 }
 
 /** Set the look-at point for a jump animation. We look at a point that is
@@ -742,6 +1687,7 @@ void set_jump_look_at() {
 	jump_look_at.x = camera_position.x + cos(D2R(theta));
 	jump_look_at.y = camera_position.y;
 	jump_look_at.z = camera_position.z + sin(D2R(-theta));
+	jump_view = true;
 }
 
 /** Set the light colors.  Since the position of the light
@@ -782,7 +1728,7 @@ void set_projection_viewport() {
 	// Set perspective projection transform.
 	glMatrixMode(GL_PROJECTION);
 	glLoadIdentity();
-	gluPerspective(60.0, (GLdouble)win_width/win_height, view_plane_near,
+	gluPerspective(FOV_Y, (GLdouble)win_width/win_height, view_plane_near,
 			view_plane_far);
 
 	// Set the viewport transform.
@@ -791,11 +1737,177 @@ void set_projection_viewport() {
 
 /** Mark a cell as visited.
  *
- * @param r the row of the cell.
+ * @param r the row of the cell, counting the rows of all levels.
  * @param c the column of the cell.
  */
 void set_visited(int r, int c) {
 	debug("set_visited()");
-	*(visited+r*maze_width+c) = true;
+	size_t k = (size_t)r*maze_width+c;
+	visited[k/WORD_BITS] |= 1UL << (k%WORD_BITS);
+}
+
+/** Start the simulation timer if it is not already running.
+ */
+void start_timer() {
+	if (timer_running || headless) return;
+	timer_running = true;
+	last_tick_time = glutGet(GLUT_ELAPSED_TIME);
+	tick_accumulator = 0;
+	glutTimerFunc(0, handle_timer, 0);
+}
+
+/** Advance the simulation by one fixed step, remembering the previous
+ *  state for interpolation.
+ *
+ *  @param dt the length of the step in seconds.
+ */
+void step_simulation(float dt) {
+	TRACE_SPAN(TRACE_FRAME, "step_simulation");
+	prev_camera_position = camera_position;
+	prev_theta = theta;
+
+	if (animation != NULL) animation(dt);
+	else move_player(dt);
+}
+
+/** Record the CPU time of a frame in the history and, if requested, the
+ *  CSV file.
+ *
+ *  @param ms the time spent drawing the frame, in milliseconds.
+ */
+void record_frame(double ms) {
+	frame_times[frame_count%FRAME_HISTORY] = ms;
+	if (csv_file != NULL) {
+		fprintf(csv_file, "%d,%.4f,%d,%d,%d\n", frame_count, ms, draw_calls,
+				vertices_submitted, walls_culled);
+	}
+	frame_count++;
+}
+
+/** Advance the simulation by however many fixed steps fit in the elapsed
+ *  time plus whatever was left over from last time, and set
+ *  <code>render_alpha</code> for the remainder.
+ *
+ *  @param elapsed_ms the time elapsed since the last call, in milliseconds.
+ */
+void advance_simulation(int elapsed_ms) {
+	tick_accumulator += elapsed_ms;
+
+	// Don't try to catch up after a long stall (e.g. the window being
+	// dragged); just drop the time.
+	if (tick_accumulator > MAX_CATCHUP_MS) tick_accumulator = MAX_CATCHUP_MS;
+
+	while (tick_accumulator >= TICK_MS) {
+		step_simulation(TICK_SECS);
+		tick_accumulator -= TICK_MS;
+	}
+	render_alpha = (float)tick_accumulator/TICK_MS;
+}
+
+/** Replay the camera script offscreen, drawing one frame every
+ *  <code>FRAME_MS</code> milliseconds of simulated time.  Per-frame
+ *  timings go to the CSV file (standard output if none was given) and a
+ *  summary goes to standard error.
+ *
+ *  @return the process exit status.
+ */
+int run_headless() {
+#ifdef HAVE_OSMESA
+	win_width = DEFAULT_WIN_WIDTH;
+	win_height = DEFAULT_WIN_HEIGHT;
+
+	OSMesaContext ctx = OSMesaCreateContextExt(OSMESA_RGBA, 24, 0, 0, NULL);
+	GLubyte *buffer = malloc(win_width*win_height*4);
+	if (ctx == NULL || buffer == NULL ||
+			!OSMesaMakeCurrent(ctx, buffer, GL_UNSIGNED_BYTE, win_width,
+				win_height)) {
+		fprintf(stderr, "Could not create an offscreen GL context\n");
+		return EXIT_FAILURE;
+	}
+
+	if (csv_file == NULL) {
+		csv_file = stdout;
+		fprintf(csv_file, "frame,cpu_ms,draw_calls,vertices,walls_culled\n");
+	}
+
+	gl_init();
+	init();
+	set_key_funcs(handle_key_norm, handle_special_key);
+	set_projection_viewport();
+
+	for (int i=0; i<NUM_SCRIPT_STEPS; i++) {
+		script_step_t *step = &camera_script[i];
+		if (step->ascii != 0 && key_func != NULL)
+			key_func(step->ascii, 0, 0);
+		if (step->special != 0 && special_func != NULL)
+			special_func(step->special, 0, 0);
+
+		for (int f=0; f<step->frames; f++) {
+			advance_simulation(FRAME_MS);
+			set_camera();
+			int polls = 0;
+			while (update_scenery() && ++polls < LOAD_MAX_POLLS)
+				usleep(LOAD_POLL_US);
+			if (polls == LOAD_MAX_POLLS)
+				fprintf(stderr, "Frame %d drawn before its scenery "
+						"finished loading\n", frame_count);
+			draw_frame();
+			if (ppm_dir != NULL && !write_ppm(frame_count-1))
+				return EXIT_FAILURE;
+		}
+
+		if (step->special != 0) handle_special_key_up(step->special, 0, 0);
+	}
+
+	// Summarize.
+	int n = frame_count < FRAME_HISTORY ? frame_count : FRAME_HISTORY;
+	double sorted[FRAME_HISTORY];
+	memcpy(sorted, frame_times, n*sizeof(double));
+	qsort(sorted, n, sizeof(double), double_cmp);
+	fprintf(stderr, "%d frames at %dx%d, seed %ld: "
+			"p50 %.3f ms, p95 %.3f ms, p99 %.3f ms (last %d frames)\n",
+			frame_count, win_width, win_height, maze_seed,
+			sorted[n*50/100], sorted[n*95/100], sorted[n*99/100], n);
+	fprintf(stderr, "maze counters: ");
+	write_maze_counters(stderr);
+	fprintf(stderr, "\n");
+
+	fflush(csv_file);
+	OSMesaDestroyContext(ctx);
+	free(buffer);
+	return EXIT_SUCCESS;
+#else
+	fprintf(stderr, "hw4 was built without OSMesa; use hw4-headless\n");
+	return EXIT_FAILURE;
+#endif
 }
 
+/** Save the current color buffer as a binary PPM image named
+ *  <code>frame_NNNNN.ppm</code> in <code>ppm_dir</code>.
+ *
+ *  @param frame the frame number.
+ *  @return true if the image was written, false otherwise.
+ */
+bool write_ppm(int frame) {
+	char path[1024];
+	snprintf(path, sizeof(path), "%s/frame_%05d.ppm", ppm_dir, frame);
+	FILE *f = fopen(path, "wb");
+	if (f == NULL) {
+		perror(path);
+		return false;
+	}
+
+	GLubyte *pixels = malloc(win_width*win_height*3);
+	glPixelStorei(GL_PACK_ALIGNMENT, 1);
+	glReadPixels(0, 0, win_width, win_height, GL_RGB, GL_UNSIGNED_BYTE,
+			pixels);
+
+	// GL rows are bottom-up; PPM rows are top-down.
+	fprintf(f, "P6\n%d %d\n255\n", win_width, win_height);
+	for (int y=win_height-1; y>=0; y--) {
+		fwrite(pixels+y*win_width*3, 3, win_width, f);
+	}
+	free(pixels);
+	fclose(f);
+	return true;
+}
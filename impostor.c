@@ -0,0 +1,340 @@
+/** impostor.c:  a flat stand-in for the distant walls of a maze.
+ *
+ *  Tiles are TILE_PIXELS pixels of level 0 of the maze's image on a side,
+ *  so TILE_CELLS cells.  Each resident tile has a mipmapped alpha texture,
+ *  and is drawn as a grid of squares GRID_CELLS cells on a side so that
+ *  the fade can be worked out per vertex and squares out of view can be
+ *  skipped.
+ */
+
+#include <math.h>
+#include <stdbool.h>
+#include <stdlib.h>
+
+#ifdef __MACOSX__
+#include <OpenGL/gl.h>
+#elif defined __LINUX__ || defined __CYGWIN__
+#define GL_GLEXT_PROTOTYPES
+#include <GL/gl.h>
+#endif
+
+#include "impostor.h"
+#include "maze.h"
+#include "maze_image.h"
+
+#define TILE_PIXELS 512
+#define TILE_CELLS (TILE_PIXELS/2)
+#define GRID_CELLS 16
+#define GRID_RADIUS (GRID_CELLS*0.7072f)
+
+// The number of shells under the roof, and the texture coverage above
+// which a shell is drawn.  At full resolution coverage falls from 1 at
+// the middle of a wall to 0 half a unit away, so 0.75 gives walls their
+// true thickness of a quarter unit.
+#define NUM_SHELLS 4
+#define SHELL_COVERAGE 0.75f
+
+// Tiles uploaded per update, and how much further than the wanted radius
+// a tile must be before it is freed.
+#define UPLOADS_PER_UPDATE 1
+#define EVICT_MARGIN TILE_CELLS
+
+/** Type of an impostor.
+ */
+struct _impostor_t {
+    /** The maze and its size in tiles.
+     */
+    maze_t* maze ;
+    int tile_rows, tile_cols ;
+
+    /** The texture of each tile, or 0 if it is not resident.
+     */
+    GLuint* textures ;
+    int resident ;
+
+    /** The number of wanted tiles left to upload after the last update.
+     */
+    int missing ;
+
+    /** The pixels of the tile being baked.
+     */
+    unsigned char* pixels ;
+} ;
+
+/** Make an impostor; see impostor.h.
+ */
+impostor_t* make_impostor() {
+    impostor_t* imp = calloc(1, sizeof(impostor_t)) ;
+    if (imp == NULL) return NULL ;
+    imp->pixels = malloc(TILE_PIXELS*TILE_PIXELS) ;
+    if (imp->pixels == NULL) {
+        free(imp) ;
+        return NULL ;
+    }
+    return imp ;
+}
+
+/** Free an impostor; see impostor.h.
+ */
+void free_impostor(impostor_t* imp) {
+    set_impostor_maze(imp, NULL) ;
+    free(imp->pixels) ;
+    free(imp) ;
+}
+
+/** Switch an impostor to a new maze; see impostor.h.
+ */
+void set_impostor_maze(impostor_t* imp, maze_t* m) {
+    int ntiles = imp->tile_rows*imp->tile_cols ;
+    for (int t=0; t<ntiles; ++t) {
+        if (imp->textures[t] != 0) glDeleteTextures(1, &imp->textures[t]) ;
+    }
+    free(imp->textures) ;
+    imp->textures = NULL ;
+    imp->tile_rows = imp->tile_cols = 0 ;
+    imp->resident = imp->missing = 0 ;
+
+    imp->maze = m ;
+    if (m == NULL) return ;
+    imp->tile_rows = (2*get_nrows(m)+1 + TILE_PIXELS-1)/TILE_PIXELS ;
+    imp->tile_cols = (2*get_ncols(m)+1 + TILE_PIXELS-1)/TILE_PIXELS ;
+    imp->textures = calloc(imp->tile_rows*imp->tile_cols, sizeof(GLuint)) ;
+}
+
+/** Get the world-space corner of a tile.  Pixel p of the maze image
+ *  covers [p/2-1/4, p/2+1/4], so the tile's first pixel starts a quarter
+ *  unit before its first cell.
+ *
+ *  @param tr the row of the tile.
+ *  @param tc the column of the tile.
+ *  @param x0 set to the smallest x-coordinate in the tile.
+ *  @param z0 set to the smallest z-coordinate in the tile.
+ */
+static void tile_corner(int tr, int tc, float* x0, float* z0) {
+    *x0 = tr*TILE_CELLS - 0.25f ;
+    *z0 = tc*TILE_CELLS - 0.25f ;
+}
+
+/** Get the distance from a point to the nearest point of a tile.
+ */
+static float tile_dist(int tr, int tc, float x, float z) {
+    float x0, z0 ;
+    tile_corner(tr, tc, &x0, &z0) ;
+    float dx = fmaxf(fmaxf(x0-x, x-(x0+TILE_CELLS)), 0.0f) ;
+    float dz = fmaxf(fmaxf(z0-z, z-(z0+TILE_CELLS)), 0.0f) ;
+    return sqrtf(dx*dx + dz*dz) ;
+}
+
+/** Bake a tile's pixels and upload them into a new mipmapped texture.
+ *
+ *  @param imp the impostor.
+ *  @param tr the row of the tile.
+ *  @param tc the column of the tile.
+ */
+static void upload_tile(impostor_t* imp, int tr, int tc) {
+    draw_maze_image_rect(imp->maze, tc*TILE_PIXELS, tr*TILE_PIXELS,
+            TILE_PIXELS, TILE_PIXELS, imp->pixels) ;
+
+    GLuint* tex = &imp->textures[tr*imp->tile_cols + tc] ;
+    glGenTextures(1, tex) ;
+    glBindTexture(GL_TEXTURE_2D, *tex) ;
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER,
+            GL_LINEAR_MIPMAP_LINEAR) ;
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR) ;
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE) ;
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE) ;
+    glTexParameteri(GL_TEXTURE_2D, GL_GENERATE_MIPMAP, GL_TRUE) ;
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1) ;
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_ALPHA, TILE_PIXELS, TILE_PIXELS, 0,
+            GL_ALPHA, GL_UNSIGNED_BYTE, imp->pixels) ;
+    imp->resident++ ;
+}
+
+/** Update the resident tiles; see impostor.h.
+ */
+void update_impostor(impostor_t* imp, float x, float z, float radius) {
+    if (imp->maze == NULL) return ;
+
+    // Free the tiles left behind, and find the nearest wanted tiles that
+    // are not resident.
+    int nearest[UPLOADS_PER_UPDATE] ;
+    float nearest_dist[UPLOADS_PER_UPDATE] ;
+    int nnearest = 0 ;
+    imp->missing = 0 ;
+    for (int tr=0; tr<imp->tile_rows; ++tr) {
+        for (int tc=0; tc<imp->tile_cols; ++tc) {
+            int t = tr*imp->tile_cols + tc ;
+            float d = tile_dist(tr, tc, x, z) ;
+            if (imp->textures[t] != 0) {
+                if (d > radius+EVICT_MARGIN) {
+                    glDeleteTextures(1, &imp->textures[t]) ;
+                    imp->textures[t] = 0 ;
+                    imp->resident-- ;
+                }
+                continue ;
+            }
+            if (d > radius) continue ;
+
+            // Keep the nearest few in order.
+            imp->missing++ ;
+            int i = nnearest < UPLOADS_PER_UPDATE ? nnearest++ :
+                    UPLOADS_PER_UPDATE ;
+            for (; i > 0 && nearest_dist[i-1] > d; --i) {
+                if (i == UPLOADS_PER_UPDATE) continue ;
+                nearest[i] = nearest[i-1] ;
+                nearest_dist[i] = nearest_dist[i-1] ;
+            }
+            if (i < UPLOADS_PER_UPDATE) {
+                nearest[i] = t ;
+                nearest_dist[i] = d ;
+            }
+        }
+    }
+
+    for (int i=0; i<nnearest; ++i) {
+        int t = nearest[i] ;
+        upload_tile(imp, t/imp->tile_cols, t%imp->tile_cols) ;
+        imp->missing-- ;
+    }
+}
+
+/** Get the roof's alpha at a point:  0 up to <code>near</code> from the
+ *  eye, rising to 1 at <code>far</code>.
+ */
+static float roof_alpha(const float eye[3], float x, float z, float near,
+        float far) {
+    float dx = x-eye[0], dy = 1.0f-eye[1], dz = z-eye[2] ;
+    float a = (sqrtf(dx*dx + dy*dy + dz*dz) - near)/(far-near) ;
+    return a < 0.0f ? 0.0f : a > 1.0f ? 1.0f : a ;
+}
+
+/** Draw one square of a tile's grid at a height.
+ *
+ *  @param x0 the smallest x-coordinate of the square.
+ *  @param z0 the smallest z-coordinate of the square.
+ *  @param tx0 the x-coordinate of the tile's corner.
+ *  @param tz0 the z-coordinate of the tile's corner.
+ *  @param y the height.
+ *  @param color the color, whose alpha is replaced by
+ *      <code>alpha</code> when that is given.
+ *  @param alpha the alpha at each corner in the order drawn, or
+ *      <code>NULL</code>.
+ */
+static void draw_grid_square(float x0, float z0, float tx0, float tz0,
+        float y, const GLfloat color[4], const float* alpha) {
+    static const int corners[4][2] = {{0, 0}, {0, 1}, {1, 1}, {1, 0}} ;
+    for (int k=0; k<4; ++k) {
+        float x = x0 + corners[k][0]*GRID_CELLS ;
+        float z = z0 + corners[k][1]*GRID_CELLS ;
+        if (alpha != NULL) glColor4f(color[0], color[1], color[2], alpha[k]) ;
+        glTexCoord2f((z-tz0)/TILE_CELLS, (x-tx0)/TILE_CELLS) ;
+        glVertex3f(x, y, z) ;
+    }
+}
+
+/** Draw an impostor; see impostor.h.  Shells are drawn first and write
+ *  depth like the walls they stand in for; the roof is blended over them
+ *  and the nearby geometry without writing depth, and pulled slightly
+ *  toward the eye so that it is not hidden by the tops of the walls.
+ */
+void draw_impostor(impostor_t* imp, const float eye[3], float near, float far,
+        bool (*is_culled)(float, float, float), int* draw_calls,
+        int* vertices) {
+    if (imp->maze == NULL || imp->resident == 0) return ;
+
+    GLfloat color[4] ;
+    glGetMaterialfv(GL_FRONT, GL_DIFFUSE, color) ;
+
+    glPushAttrib(GL_ENABLE_BIT | GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT |
+            GL_LIGHTING_BIT | GL_POLYGON_BIT | GL_TEXTURE_BIT) ;
+    glDisable(GL_CULL_FACE) ;
+    glEnable(GL_TEXTURE_2D) ;
+    glTexEnvi(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_MODULATE) ;
+    glEnable(GL_COLOR_MATERIAL) ;
+    glColorMaterial(GL_FRONT, GL_AMBIENT_AND_DIFFUSE) ;
+    glNormal3f(0.0f, 1.0f, 0.0f) ;
+
+    for (int tr=0; tr<imp->tile_rows; ++tr) {
+        for (int tc=0; tc<imp->tile_cols; ++tc) {
+            GLuint tex = imp->textures[tr*imp->tile_cols + tc] ;
+            if (tex == 0) continue ;
+            glBindTexture(GL_TEXTURE_2D, tex) ;
+            float tx0, tz0 ;
+            tile_corner(tr, tc, &tx0, &tz0) ;
+
+            // The squares in view that reach past far get shells, and
+            // those that reach past near get the roof.
+            for (int pass=0; pass<2; ++pass) {
+                bool roof = pass == 1 ;
+                if (roof) {
+                    glDisable(GL_ALPHA_TEST) ;
+                    glEnable(GL_BLEND) ;
+                    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA) ;
+                    glDepthMask(GL_FALSE) ;
+                    glEnable(GL_POLYGON_OFFSET_FILL) ;
+                    glPolygonOffset(-1.0f, -1.0f) ;
+                }
+                else {
+                    glEnable(GL_ALPHA_TEST) ;
+                    glAlphaFunc(GL_GREATER, SHELL_COVERAGE) ;
+                    glColor4f(color[0], color[1], color[2], 1.0f) ;
+                }
+
+                int nverts = 0 ;
+                glBegin(GL_QUADS) ;
+                for (int i=0; i<TILE_CELLS; i+=GRID_CELLS) {
+                    for (int j=0; j<TILE_CELLS; j+=GRID_CELLS) {
+                        float x0 = tx0+i, z0 = tz0+j ;
+                        float cx = x0 + GRID_CELLS/2.0f ;
+                        float cz = z0 + GRID_CELLS/2.0f ;
+                        if (is_culled(cx, cz, GRID_RADIUS)) continue ;
+
+                        float dx = cx-eye[0], dy = eye[1], dz = cz-eye[2] ;
+                        float d = sqrtf(dx*dx + dy*dy + dz*dz) + GRID_RADIUS ;
+                        if (d <= (roof ? near : far)) continue ;
+
+                        if (roof) {
+                            float alpha[4] = {
+                                roof_alpha(eye, x0, z0, near, far),
+                                roof_alpha(eye, x0, z0+GRID_CELLS, near, far),
+                                roof_alpha(eye, x0+GRID_CELLS, z0+GRID_CELLS,
+                                        near, far),
+                                roof_alpha(eye, x0+GRID_CELLS, z0, near, far)
+                            } ;
+                            draw_grid_square(x0, z0, tx0, tz0, 1.0f, color,
+                                    alpha) ;
+                            nverts += 4 ;
+                        }
+                        else {
+                            for (int s=0; s<NUM_SHELLS; ++s) {
+                                draw_grid_square(x0, z0, tx0, tz0,
+                                        (s+0.5f)/NUM_SHELLS, color, NULL) ;
+                            }
+                            nverts += 4*NUM_SHELLS ;
+                        }
+                    }
+                }
+                glEnd() ;
+                if (nverts > 0) (*draw_calls)++ ;
+                *vertices += nverts ;
+            }
+            glDepthMask(GL_TRUE) ;
+            glDisable(GL_BLEND) ;
+            glDisable(GL_POLYGON_OFFSET_FILL) ;
+        }
+    }
+
+    glPopAttrib() ;
+}
+
+/** Check for tiles to upload; see impostor.h.
+ */
+bool impostor_busy(impostor_t* imp) {
+    return imp->missing > 0 ;
+}
+
+/** Get the number of resident tiles; see impostor.h.
+ */
+int get_impostor_tiles(impostor_t* imp) {
+    return imp->resident ;
+}
@@ -0,0 +1,98 @@
+/** @file impostor.h a flat stand-in for the distant walls of a maze.
+ *
+ *  From far enough away, walls a quarter unit thick are only a few pixels
+ *  wide, and drawing them as geometry costs far more than it shows.  An
+ *  impostor draws them instead from the maze's image (see maze_image.h),
+ *  baked into textures of square tiles of the maze:  a roof plane at the
+ *  height of the wall tops, blended by wall coverage, and a stack of
+ *  alpha-tested shells below it that give the walls their height when
+ *  seen from an angle.
+ *
+ *  The impostor is meant to be drawn together with the wall geometry of
+ *  the nearby maze.  Between a near and a far distance from the eye the
+ *  roof fades in over the geometry, and from the far distance on the
+ *  shells take over from it, so the geometry only needs to be drawn out
+ *  to the far distance.
+ *
+ *  Positions use the frame of the 3D maze view:  x runs along rows and z
+ *  along columns.  All functions must be called on the GL thread with a
+ *  current context.
+ */
+
+#ifndef IMPOSTOR_H
+#define IMPOSTOR_H
+
+#include <stdbool.h>
+
+#include "maze.h"
+
+/** The type of an impostor.
+ */
+typedef struct _impostor_t impostor_t ;
+
+/** Make an impostor with no maze.
+ *
+ *  @return the impostor.
+ */
+impostor_t* make_impostor() ;
+
+/** Free an impostor and its textures.
+ *
+ *  @param imp an impostor.
+ */
+void free_impostor(impostor_t* imp) ;
+
+/** Switch an impostor to a new maze, dropping the tiles of the old one.
+ *  The old maze is not used again once this returns.
+ *
+ *  @param imp an impostor.
+ *  @param m the new maze, or <code>NULL</code>.
+ */
+void set_impostor_maze(impostor_t* imp, maze_t* m) ;
+
+/** Bake and upload the textures of the tiles within a distance of the
+ *  camera, nearest first and a few per update, and free those of tiles
+ *  that have been left well behind.
+ *
+ *  @param imp an impostor.
+ *  @param x the x-coordinate of the camera.
+ *  @param z the z-coordinate of the camera.
+ *  @param radius how far from the camera tiles are wanted.
+ */
+void update_impostor(impostor_t* imp, float x, float z, float radius) ;
+
+/** Draw the resident tiles of an impostor with the current material.
+ *
+ *  @param imp an impostor.
+ *  @param eye the position of the eye.
+ *  @param near the distance from the eye at which the roof starts to fade
+ *      in.
+ *  @param far the distance from the eye at which the roof is fully faded
+ *      in and beyond which the shells are drawn.
+ *  @param is_culled a function that is given the center and radius of a
+ *      region in (x, z) and returns true if it is out of view.
+ *  @param draw_calls incremented for each batch of quads drawn.
+ *  @param vertices incremented by the number of vertices drawn.
+ */
+void draw_impostor(impostor_t* imp, const float eye[3], float near, float far,
+        bool (*is_culled)(float, float, float), int* draw_calls,
+        int* vertices) ;
+
+/** Check whether an impostor has wanted tiles still to upload.
+ *
+ *  @param imp an impostor.
+ *
+ *  @return true if more updates are needed to upload every tile last
+ *      wanted, false otherwise.
+ */
+bool impostor_busy(impostor_t* imp) ;
+
+/** Get the number of tiles with a texture.
+ *
+ *  @param imp an impostor.
+ *
+ *  @return the number of resident tiles of <code>imp</code>.
+ */
+int get_impostor_tiles(impostor_t* imp) ;
+
+#endif
@@ -4,32 +4,158 @@
  */
 
 #include <assert.h>
+#ifdef __BMI2__
+#include <immintrin.h>
+#endif
+#include <math.h>
+#include <pthread.h>
 #include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
 #include <stdio.h>
 #include "stdlib.h"
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
 #include <time.h>
-
-#include "list356.h"
+#include <unistd.h>
 
 #include "debug.h"
 #include "maze.h"
 
 // Directions.
 #define EMPTY 0x0
-unsigned char directions[] = {NORTH, EAST, SOUTH, WEST} ;
+unsigned char directions[] = {NORTH, EAST, SOUTH, WEST, UP, DOWN} ;
 
 // Offset into the maze cells based on row and column position.
-#define CELL(m, r, c) (*(m->cells + (r*(m->ncols)) + c))
+#define CELL(m, r, c) ((m)->cells[cell_index(m, r, c)])
 
 // Offset into the maze cells based on a cell_t.
-#define MAZECELL(m, cc) (*(m->cells + (cc->r)*(m->ncols) + (cc->c)))
+#define MAZECELL(m, cc) CELL(m, (cc)->level*(m)->nrows + (cc)->r, (cc)->c)
+
+// Z-order mazes are laid out in tiles of 2^TILE_BITS cells on a side.
+#define TILE_BITS 8
+#define TILE_MASK ((1 << TILE_BITS)-1)
+
+// The cells next_cells tests for a match at once.
+#define SCAN_BLOCK 64
+
+// The column step and the opposite of each direction, by index in
+// directions.  The row steps depend on the maze; see row_step in maze_t.
+static const int dir_dc[] = {0, 1, 0, -1, 0, 0} ;
+static const int dir_opposite[] = {2, 3, 0, 1, 5, 4} ;
+
+// The most rows a maze may have in all its levels together, so that a row
+// fits in a frontier edge.
+#define MAX_ROWS (1 << 30)
+
+/** Type of a frontier edge for Prim's algorithm:  the edge from the cell
+ *  at row <code>EDGE_ROW(e)</code> (counting the rows of all levels) and
+ *  column <code>EDGE_COL(e)</code> (which is in the tree) in the direction
+ *  with index <code>EDGE_DIR(e)</code>, packed into 64 bits.
+ */
+typedef uint64_t edge_t ;
+#define MAKE_EDGE(r, c, d) ((uint64_t)(r) << 34 | (uint64_t)(c) << 3 | (d))
+#define EDGE_ROW(e) ((int)((e) >> 34))
+#define EDGE_COL(e) ((int)((e) >> 3 & 0x7fffffff))
+#define EDGE_DIR(e) ((int)((e) & 7))
+
+// The frontier starts with room for FRONTIER_START edges and doubles as
+// needed.
+#define FRONTIER_START 1024
+
+/** Type of the frontier for Prim's algorithm.
+ */
+typedef struct _frontier_t {
+    edge_t* edges ;
+    size_t n, cap ;
+
+    /** The rows of the level being built, first to last (exclusive);
+     *  only edges within it are added.
+     */
+    int first, last ;
+
+    /** The most edges the frontier has held, and the stale edges chosen,
+     *  for the counters.
+     */
+    size_t peak, stale ;
+} frontier_t ;
+
+// Each level above the first is joined to the one below by a shaft for
+// about every SHAFT_CELLS cells.
+#define SHAFT_CELLS 64
+
+// The index of DOWN in directions.
+#define DOWN_INDEX 5
+
+// Cell objects are made in pages of CELL_PAGE cells.
+#define CELL_PAGE_BITS 12
+#define CELL_PAGE (1 << CELL_PAGE_BITS)
+
+// Arrays of at least BIG_BYTES are mapped in whole huge pages of
+// HUGE_PAGE bytes.
+#define HUGE_PAGE (1 << 21)
+#define BIG_BYTES HUGE_PAGE
+
+/** Type of a block of memory for a large array, which may be mapped
+ *  rather than allocated.
+ */
+typedef struct _block_t {
+    void* p ;
+    size_t bytes ;
+    bool mapped ;
+} block_t ;
+
+/** Type of a node of a link-cut forest, one for each cell.  The forest
+ *  is kept as splay trees of paths, each ordered from the top of its path
+ *  down, and linked by the parent of its root to the parent of the top of
+ *  the path in the forest.  Nodes are numbered by their cells' offsets in
+ *  a row-major copy of the cells; NO_LINK is no node.
+ */
+typedef struct _link_node_t {
+    size_t parent, child[2] ;
+
+    /** The nodes in this node's splay tree, including itself.
+     */
+    size_t size ;
+
+    /** Whether the children of the splay tree are to be swapped, all the
+     *  way down, which reverses its path.
+     */
+    bool flip ;
+
+    /** Which sides of a search for a replacement passage have seen the
+     *  node; see find_replacement.
+     */
+    unsigned char seen ;
+} link_node_t ;
+
+#define NO_LINK SIZE_MAX
+
+/** The header of a maze file; see maze.h.  The cells follow at offset
+ *  MAZE_FILE_HEADER.
+ */
+typedef struct _maze_file_header_t {
+    char magic[8] ;
+    int32_t nrows, ncols, nlevels ;
+
+    /** MAZE_FILE_PERFECT if the maze is perfect.
+     */
+    uint32_t flags ;
+
+    /** The offsets of the start and end cells in the cells.
+     */
+    uint64_t start, end ;
+} maze_file_header_t ;
+
+#define MAZE_FILE_MAGIC "MAZEv1"
+#define MAZE_FILE_PERFECT 0x1
 
-/** Type of an edge between two cells, for use in Prim's algorithm.
+/** State of the random number generator used to build a maze.  Each maze
+ *  has its own, so that mazes can be built concurrently.
  */
-typedef struct _edge_t {
-    cell_t* a ;
-    cell_t* b ;
-} edge_t ;
+typedef uint64_t rng_t ;
 
 /** Type of a maze.
  */
@@ -43,31 +169,239 @@ struct _maze_t {
      */
     int nrows, ncols ;
 
+    /** Number of levels, and of rows in all of them.  The levels are kept
+     *  one after another, so that the cells of level l are those of rows
+     *  l*nrows to (l+1)*nrows-1, and CELL takes these rows.
+     */
+    int nlevels, all_rows ;
+
+    /** The step in rows of each direction, by index in directions.
+     */
+    int row_step[6] ;
+
+    /** The memory of the cells.
+     */
+    block_t cells_block ;
+
+    /** The cell objects.  We do our own "memory management" for cells by 
+     *  maintaining pages of cell_t objects, row by row, each made the
+     *  first time a cell in it is asked for; use get_cell to get the
+     *  appropriate object given a row and column.
+     */
+    cell_t** cell_pages ;
+    size_t npages ;
+
     /** The start and end cells of the maze.
      */
     cell_t *start, *end ;
+
+    /** How the cells are laid out, and for MAZE_Z_ORDER the number of
+     *  tiles in each row of tiles; see cell_index.
+     */
+    maze_layout_t layout ;
+    int tile_cols ;
+
+    /** For layouts other than row-major, a row-major copy of the cells,
+     *  made by get_row_span the first time it is needed, and the lock
+     *  that guards making it.
+     */
+    unsigned char* rows ;
+    block_t rows_block ;
+    pthread_mutex_t rows_lock ;
+
+    /** Whether the maze is perfect; see is_perfect.
+     */
+    bool perfect ;
+
+    /** For edits, a link-cut forest spanning the passages, made by
+     *  make_links the first time it is needed, the number of trees in it,
+     *  and the number of passages that are not in it.  The maze is perfect
+     *  when there is one tree and no other passages.
+     */
+    link_node_t* links ;
+    block_t links_block ;
+    size_t ntrees, nextra ;
+
+    /** Whether the cells are in a read-only mapping of a maze file, and
+     *  so cannot be edited.
+     */
+    bool read_only ;
 } ;
 
-/** Build a maze using Prim's algorithm.  After calling, walls will have
- *  been removed from <code>maze</code> to ensure that there is exactly
- *  one path between any pair of cells.
- *  
- *  @param maze the maze.  All walls must be present.
+/** The phases of making a maze; see step_maze.
+ */
+typedef enum _gen_phase_t {
+    GEN_SEED,
+    GEN_ROWS,
+    GEN_GROW,
+    GEN_SHAFTS,
+    GEN_PICK,
+    GEN_OPEN,
+    GEN_DONE
+} gen_phase_t ;
+
+/** Type of a maze being made.
+ */
+struct _maze_gen_t {
+    maze_t* maze ;
+    rng_t rng ;
+    gen_phase_t phase ;
+
+    /** The frontier, and the level it is growing.
+     */
+    frontier_t frontier ;
+    int level ;
+
+    /** The cells left to join to the tree on the level, and the shafts
+     *  left to sink into it.
+     */
+    size_t left, shafts ;
+
+    /** For a row generator, the keys of its random numbers (see
+     *  row_band_t).  The rows from row up are made.
+     */
+    maze_algorithm_t algorithm ;
+    uint64_t row_key, run_key ;
+
+    /** The fraction of dead ends to braid; for the braiding passes, the
+     *  picks, the key and bound of the random numbers of the cells (see
+     *  braid_band_t), and the next row to braid; and the passages opened.
+     */
+    float braid ;
+    block_t picks ;
+    uint64_t key, limit ;
+    int row ;
+    size_t opened ;
+
+    /** The work done so far, in cells joined and cells braided, and the
+     *  work there is in all; see get_gen_progress.
+     */
+    size_t done, total ;
+} ;
+
+/** Interleave the bits of two numbers of TILE_BITS bits.
+ *
+ *  @param r the number for the odd bits.
+ *  @param c the number for the even bits.
+ *
+ *  @return the Morton code of (r, c).
+ */
+static inline unsigned interleave(unsigned r, unsigned c) {
+#ifdef __BMI2__
+    return _pdep_u32(r, 0xaaaa) | _pdep_u32(c, 0x5555) ;
+#else
+    r = (r | r << 4) & 0x0f0f ;
+    r = (r | r << 2) & 0x3333 ;
+    r = (r | r << 1) & 0x5555 ;
+    c = (c | c << 4) & 0x0f0f ;
+    c = (c | c << 2) & 0x3333 ;
+    c = (c | c << 1) & 0x5555 ;
+    return r << 1 | c ;
+#endif
+}
+
+/** Get the offset of a cell's passages in the cells of a maze.  Row-major
+ *  mazes keep their cells row by row.  Z-order mazes keep them in square
+ *  tiles, row by row, with the cells of each tile in Morton order, so
+ *  that the four neighbors of a cell are usually in the same tile.
+ *
+ *  @param m a maze.
+ *  @param r a row.
+ *  @param c a column.
+ *
+ *  @return the offset of the cell at row <code>r</code> and column
+ *      <code>c</code> in <code>m->cells</code>.
+ */
+static inline size_t cell_index(maze_t* m, int r, int c) {
+    if (m->layout == MAZE_ROW_MAJOR) return (size_t)r*m->ncols + c ;
+    size_t tile = (size_t)(r >> TILE_BITS)*m->tile_cols + (c >> TILE_BITS) ;
+    return tile << 2*TILE_BITS | interleave(r & TILE_MASK, c & TILE_MASK) ;
+}
+
+/** Get the offset of a cell in a row-major copy of the cells.
  */
-static void build_prim(maze_t* maze) ;
+static uint64_t row_major_index(maze_t* m, cell_t* cell) {
+    return ((uint64_t)cell->level*m->nrows + cell->r)*m->ncols + cell->c ;
+}
+
+static void copy_rows(maze_t* m, unsigned char* rows) ;
+
+// Counters; see maze.h.  COUNT adds to a counter of the calling thread,
+// and COUNT_MAX raises one.
+static uint64_t now_ns() ;
+#ifndef MAZE_NO_COUNTERS
+static maze_counters_t* thread_counters() ;
+#define COUNT(field, n) do { \
+    maze_counters_t* k = thread_counters() ; \
+    __atomic_store_n(&k->field, k->field + (n), __ATOMIC_RELAXED) ; \
+} while (0)
+#define COUNT_MAX(field, n) do { \
+    maze_counters_t* k = thread_counters() ; \
+    if ((uint64_t)(n) > k->field) \
+        __atomic_store_n(&k->field, (n), __ATOMIC_RELAXED) ; \
+} while (0)
+#define COUNT_TIME(var) uint64_t var = now_ns()
+#else
+#define COUNT(field, n)
+#define COUNT_MAX(field, n)
+#define COUNT_TIME(var)
+#endif
 
 // CELL AND EDGE FUNCTIONS.
 
-/** The cell objects.  We do our own "memory management" for cells by 
- *  maintaining a 2D array of cell_t objects; use get_cell to get the
- *  appropriate object given a row and column.
+/** Make a page of cell objects, unless another thread makes it first.
+ *
+ *  @param m a maze.
+ *  @param p the index of the page.
+ *
+ *  @return the page.
  */
-cell_t* cells = NULL ;;
+static cell_t* make_cell_page(maze_t* m, size_t p) {
+    size_t first = p << CELL_PAGE_BITS ;
+    size_t ncells = (size_t)m->all_rows*m->ncols ;
+    size_t n = ncells-first < CELL_PAGE ? ncells-first : CELL_PAGE ;
+    cell_t* page = malloc(n*sizeof(cell_t)) ;
+    assert(page != NULL) ;
+
+    int row = first/m->ncols ;
+    int level = row/m->nrows, r = row%m->nrows, c = first%m->ncols ;
+    for (size_t i=0; i<n; ++i) {
+        page[i].r = r ;
+        page[i].c = c ;
+        page[i].level = level ;
+        if (++c == m->ncols) {
+            c = 0 ;
+            if (++r == m->nrows) {
+                r = 0 ;
+                ++level ;
+            }
+        }
+    }
+
+    cell_t* made = NULL ;
+    if (!__atomic_compare_exchange_n(&m->cell_pages[p], &made, page, false,
+                __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+        free(page) ;
+        return made ;
+    }
+    COUNT(bytes_allocated, n*sizeof(cell_t)) ;
+    return page ;
+}
 
 /** Get a cell given row and column; see maze.h.
  */
 cell_t* get_cell(maze_t* m, int r, int c) {
-    return &cells[r*m->ncols+c] ;
+    return get_level_cell(m, 0, r, c) ;
+}
+
+/** Get a cell given level, row and column; see maze.h.
+ */
+cell_t* get_level_cell(maze_t* m, int level, int r, int c) {
+    size_t k = ((size_t)level*m->nrows + r)*m->ncols + c ;
+    size_t p = k >> CELL_PAGE_BITS ;
+    cell_t* page = __atomic_load_n(&m->cell_pages[p], __ATOMIC_ACQUIRE) ;
+    if (page == NULL) page = make_cell_page(m, p) ;
+    return &page[k & (CELL_PAGE-1)] ;
 }
 
 /** Test two cells for equality; see maze.h.
@@ -76,73 +410,252 @@ int cell_cmp(void* c, void* d) {
     return c == d ? 0 : 1 ;
 }
 
-/** Test two edges for equality.
+/** Mix the bits of a number (one step of splitmix64), so that numbers
+ *  that differ a little give results that differ a lot.  Mixing
+ *  <code>key + i*0x9e3779b97f4a7c15</code> gives the i-th number of a
+ *  random stream that can be read in any order.
+ *
+ *  @param z a number.
+ *
+ *  @return the number mixed.
+ */
+static uint64_t mix(uint64_t z) {
+    z += 0x9e3779b97f4a7c15ULL ;
+    z = (z ^ (z >> 30))*0xbf58476d1ce4e5b9ULL ;
+    z = (z ^ (z >> 27))*0x94d049bb133111ebULL ;
+    return z ^ (z >> 31) ;
+}
+
+/** Seed a random number generator.
+ *
+ *  @param rng the generator.
+ *  @param seed the seed.
+ */
+static void seed_random(rng_t* rng, long seed) {
+    // Any state but 0 will do; mix the seed so that nearby seeds give
+    // unrelated sequences.
+    uint64_t z = mix((uint64_t)seed) ;
+    *rng = z != 0 ? z : 1 ;
+}
+
+/** Get the next random number from a generator.
  *
- *  @param x1 one edge
- *  @param x2 another edge
+ *  @param rng the random number generator (xorshift64*).
  *
- *  @return 0 if the two edges are equal (i.e., have the same cells
- *      as endpoints in either order), non-0 otherwise.
+ *  @return 64 random bits.
  */
-static int edge_cmp(void* x1, void* x2) {
-    edge_t* e1 = x1 ;
-    edge_t* e2 = x2 ;
-    return (cell_cmp(e1->a, e2->a) + cell_cmp(e1->b, e2->b))*
-        (cell_cmp(e1->a, e2->b) + cell_cmp(e1->b, e2->a)) ;
+static uint64_t next_random(rng_t* rng) {
+    *rng ^= *rng >> 12 ;
+    *rng ^= *rng << 25 ;
+    *rng ^= *rng >> 27 ;
+    return *rng*0x2545f4914f6cdd1dULL ;
 }
 
 /** Get a random integer within a given range.
  *
+ *  @param rng the random number generator (xorshift64*).
  *  @param lower the lower limit of the range.
  *  @param upper the upper limit of the range.
  *
  *  @return a random number in [lower, upper).
  */
-static int random_limit(int lower, int upper) {
-    int val = lower+random()%(upper-lower) ;
+static int random_limit(rng_t* rng, int lower, int upper) {
+    uint64_t r = next_random(rng) ;
+    int val = lower+(int)((r >> 32)%(uint64_t)(upper-lower)) ;
     return val ;
 }
 
-/** Make a maze.  See maze.h.
+/** Get a random index below a bound, which may be past the range of an
+ *  int.  Below 2^32 this gives what <code>random_limit</code> would.
+ *
+ *  @param rng the random number generator (xorshift64*).
+ *  @param n the bound.
+ *
+ *  @return a random number in [0, n).
  */
-maze_t* make_maze(int nrows, int ncols, long seed) {
+static size_t random_index(rng_t* rng, size_t n) {
+    uint64_t r = next_random(rng) ;
+    return n <= UINT32_MAX ? (r >> 32)%n : r%n ;
+}
 
-    // Allocate the array of cell objects.
-    if (cells != NULL) free(cells) ;
-    cells = malloc(nrows*ncols*sizeof(cell_t)) ;
-    for (int r=0; r<nrows; ++r) {
-        for (int c=0; c<ncols; ++c) {
-            cells[r*ncols+c].r = r ;
-            cells[r*ncols+c].c = c ;
+/** Allocate a zeroed block of memory for a large array.  Blocks of at
+ *  least BIG_BYTES are mapped:  with huge pages if the system has some
+ *  reserved, and otherwise aligned to huge pages and marked for
+ *  transparent huge pages, so that walking a large maze does not miss in
+ *  the TLB at every step.  Smaller blocks are allocated.
+ *
+ *  @param b filled in with the block.
+ *  @param bytes the size of the block.
+ *
+ *  @return true if the block was made, false if there is no memory for it.
+ */
+static bool alloc_block(block_t* b, size_t bytes) {
+    b->mapped = false ;
+    b->bytes = bytes ;
+    if (bytes >= BIG_BYTES && bytes <= SIZE_MAX-2*HUGE_PAGE) {
+        size_t len = (bytes+HUGE_PAGE-1) & ~(size_t)(HUGE_PAGE-1) ;
+        void* p = MAP_FAILED ;
+#ifdef MAP_HUGETLB
+        p = mmap(NULL, len, PROT_READ|PROT_WRITE,
+                MAP_PRIVATE|MAP_ANONYMOUS|MAP_HUGETLB, -1, 0) ;
+#endif
+        if (p == MAP_FAILED) {
+            // Map a huge page more than needed and trim it to alignment.
+            char* raw = mmap(NULL, len+HUGE_PAGE, PROT_READ|PROT_WRITE,
+                    MAP_PRIVATE|MAP_ANONYMOUS, -1, 0) ;
+            if (raw != MAP_FAILED) {
+                char* q = (char*)(((uintptr_t)raw + HUGE_PAGE-1) &
+                        ~(uintptr_t)(HUGE_PAGE-1)) ;
+                if (q > raw) munmap(raw, q-raw) ;
+                if (raw+HUGE_PAGE > q) munmap(q+len, raw+HUGE_PAGE-q) ;
+#ifdef MADV_HUGEPAGE
+                madvise(q, len, MADV_HUGEPAGE) ;
+#endif
+                p = q ;
+            }
+        }
+        if (p != MAP_FAILED) {
+            b->p = p ;
+            b->bytes = len ;
+            b->mapped = true ;
+            return true ;
         }
     }
+    b->p = calloc(bytes, 1) ;
+    return b->p != NULL || bytes == 0 ;
+}
+
+/** Free a block made by <code>alloc_block</code>.
+ *
+ *  @param b the block.
+ */
+static void free_block(block_t* b) {
+    if (b->mapped) munmap(b->p, b->bytes) ;
+    else free(b->p) ;
+    b->p = NULL ;
+}
 
-    srandom(seed) ;
+/** Make a maze.  See maze.h.
+ */
+maze_t* make_maze(int nrows, int ncols, long seed) {
+    return make_maze_opts(nrows, ncols, seed, NULL) ;
+}
 
-    // Choose start and end cells at random, ensuring that they are not the
-    // same cell.
-    maze_t* m = malloc(sizeof(maze_t)) ;
-    m->cells = malloc(nrows*ncols*sizeof(unsigned char)) ;
+/** Make a maze with options.  See maze.h.
+ */
+maze_t* make_maze_opts(int nrows, int ncols, long seed,
+        const maze_opts_t* opts) {
+    maze_gen_t* g = start_maze(nrows, ncols, seed, opts) ;
+    return g != NULL ? finish_maze(g) : NULL ;
+}
+
+/** Start making a maze; see maze.h.
+ */
+maze_gen_t* start_maze(int nrows, int ncols, long seed,
+        const maze_opts_t* opts) {
+    COUNT_TIME(setup_start) ;
+    if (nrows < 1 || ncols < 1) return NULL ;
+
+    maze_gen_t* g = calloc(1, sizeof(maze_gen_t)) ;
+    maze_t* m = calloc(1, sizeof(maze_t)) ;
+    if (g == NULL || m == NULL) {
+        free(g) ;
+        free(m) ;
+        return NULL ;
+    }
+    g->maze = m ;
+    int nlevels = opts != NULL && opts->nlevels > 1 ? opts->nlevels : 1 ;
     m->nrows = nrows ;
     m->ncols = ncols ;
-    m->start = get_cell(m, random_limit(0, nrows), random_limit(0, ncols)) ;
+    m->nlevels = nlevels ;
+    m->layout = opts != NULL ? opts->layout : MAZE_ROW_MAJOR ;
+    pthread_mutex_init(&m->rows_lock, NULL) ;
+
+    // Size the cells, padding Z-order mazes out to whole tiles.
+    size_t ncells = 0, nslots ;
+    bool too_big = (size_t)nlevels*nrows > MAX_ROWS ||
+        __builtin_mul_overflow((size_t)nlevels*nrows, (size_t)ncols, &ncells) ;
+    m->all_rows = too_big ? 0 : nlevels*nrows ;
+    nslots = ncells ;
+    if (m->layout == MAZE_Z_ORDER) {
+        size_t tile_rows = ((size_t)m->all_rows+TILE_MASK) >> TILE_BITS ;
+        m->tile_cols = ((size_t)ncols+TILE_MASK) >> TILE_BITS ;
+        too_big = too_big ||
+            __builtin_mul_overflow(tile_rows, (size_t)m->tile_cols, &nslots) ||
+            nslots > SIZE_MAX >> 2*TILE_BITS ;
+        nslots <<= 2*TILE_BITS ;
+    }
+
+    // Make the cells, with all possible walls (blocks are zeroed), and
+    // the table of pages of cell objects.
+    m->npages = (ncells+CELL_PAGE-1) >> CELL_PAGE_BITS ;
+    if (too_big || !alloc_block(&m->cells_block, nslots) ||
+            (m->cell_pages = calloc(m->npages, sizeof(cell_t*))) == NULL) {
+        free_maze_gen(g) ;
+        return NULL ;
+    }
+    m->cells = m->cells_block.p ;
+    int row_step[] = {1, 0, -1, 0, nrows, -nrows} ;
+    memcpy(m->row_step, row_step, sizeof(row_step)) ;
+
+    rng_t* rng = &g->rng ;
+    seed_random(rng, seed) ;
+
+    // Choose start and end cells at random, ensuring that they are not the
+    // same cell unless the maze has only one.  The start is on the bottom
+    // level and the end on the top.
+    m->start = get_cell(m, random_limit(rng, 0, nrows),
+            random_limit(rng, 0, ncols)) ;
     cell_t* end_cell ;
     do {
-        end_cell = get_cell(m, random_limit(0, nrows), random_limit(0, ncols)) ;
-    } while (end_cell == m->start) ;
+        end_cell = get_level_cell(m, nlevels-1, random_limit(rng, 0, nrows),
+                random_limit(rng, 0, ncols)) ;
+    } while (end_cell == m->start && ncells > 1) ;
     m->end = end_cell ;
 
-    // Add all possible walls to the maze.
-    for (int r=0; r<nrows; ++r) {
-        for (int c=0; c<ncols; ++c) {
-            CELL(m, r, c) = EMPTY ;
-        }
+    // The frontier.  It holds far fewer edges than there are cells, since
+    // stale edges are discarded as they are chosen, so it starts small
+    // and grows as needed.
+    g->frontier = (frontier_t){malloc(FRONTIER_START*sizeof(edge_t)), 0,
+        FRONTIER_START, 0, nrows} ;
+    if (g->frontier.edges == NULL) {
+        free_maze_gen(g) ;
+        return NULL ;
     }
+    g->phase = GEN_SEED ;
+    g->algorithm = opts != NULL ? opts->algorithm : MAZE_PRIM ;
+    if (g->algorithm != MAZE_PRIM) {
+        g->row_key = next_random(rng) ;
+        g->run_key = next_random(rng) ;
+        g->row = m->all_rows ;
+        g->phase = GEN_ROWS ;
+    }
+    g->braid = opts != NULL && opts->braid > 0 ? opts->braid : 0 ;
+    g->total = g->braid > 0 ? 3*ncells : ncells ;
 
-    // Generate the maze.
-    build_prim(m) ;
+    COUNT(mazes, 1) ;
+    COUNT(cells_generated, ncells) ;
+    COUNT(bytes_allocated, sizeof(maze_t) + sizeof(maze_gen_t) + nslots +
+            m->npages*sizeof(cell_t*)) ;
+    COUNT_TIME(setup_end) ;
+    COUNT(setup_ns, setup_end-setup_start) ;
 
-    return m ;
+    return g ;
+}
+
+/** Free a maze; see maze.h.
+ */
+void free_maze(maze_t* m) {
+    if (m == NULL) return ;
+    free_block(&m->cells_block) ;
+    free_block(&m->rows_block) ;
+    free_block(&m->links_block) ;
+    pthread_mutex_destroy(&m->rows_lock) ;
+    if (m->cell_pages != NULL) {
+        for (size_t p=0; p<m->npages; ++p) free(m->cell_pages[p]) ;
+        free(m->cell_pages) ;
+    }
+    free(m) ;
 }
 
 /** Get the start cell of a maze; see maze.h.
@@ -169,9 +682,22 @@ int get_ncols(maze_t* m) {
     return m->ncols ;
 }
 
+/** Get the number of levels; see maze.h.
+ */
+int get_nlevels(maze_t* m) {
+    return m->nlevels ;
+}
+
+/** Check whether a maze is perfect; see maze.h.
+ */
+bool is_perfect(maze_t* m) {
+    return m->perfect ;
+}
+
 /** Check for a path to an adjacent cell; see maze.h.
  */
 bool has_path(maze_t* m, cell_t* c, unsigned char d) {
+    COUNT(has_path_calls, 1) ;
     return (MAZECELL(m, c) & d) != 0 ;
 }
 
@@ -181,49 +707,68 @@ bool has_wall(maze_t* m, cell_t* c, unsigned char d) {
     return !has_path(m, c, d) ;
 }
 
-/** Get the cell in a given direction from a given cell.
- *  
- *  @param cell the given cell.
- *  @param direction the direction
- *
- *  @return the cell that is adjacent to <code>cell</code> in direction 
- *      <code>direction</code>.
+/** Get the passage masks of a range of rows; see maze.h.
  */
-static cell_t* get_neighbor(maze_t* m, cell_t* cell, unsigned char direction) {
-    switch (direction) {
-        case NORTH:
-            return get_cell(m, 1+cell->r, cell->c) ;
-        case EAST:
-            return get_cell(m, cell->r, 1+cell->c) ;
-        case SOUTH:
-            return get_cell(m, cell->r-1, cell->c) ;
-        case WEST:
-            return get_cell(m, cell->r, cell->c-1) ;
-        default:
-            assert(0) ;
+const unsigned char* get_row_span(maze_t* m, int first, int count) {
+    assert(first >= 0 && count >= 0 && first+count <= m->all_rows) ;
+    if (m->layout == MAZE_ROW_MAJOR) {
+        return m->cells + (size_t)first*m->ncols ;
     }
-    assert(0) ;
-    
-    // Kill "control reaches end" compiler warnings with -DNDEBUG.
-    return NULL ;
+
+    unsigned char* rows = __atomic_load_n(&m->rows, __ATOMIC_ACQUIRE) ;
+    if (rows == NULL) {
+        pthread_mutex_lock(&m->rows_lock) ;
+        rows = m->rows ;
+        if (rows == NULL) {
+            size_t ncells = (size_t)m->all_rows*m->ncols ;
+            bool made = alloc_block(&m->rows_block, ncells) ;
+            assert(made) ;
+            rows = m->rows_block.p ;
+            COUNT(bytes_allocated, ncells) ;
+            copy_rows(m, rows) ;
+            __atomic_store_n(&m->rows, rows, __ATOMIC_RELEASE) ;
+        }
+        pthread_mutex_unlock(&m->rows_lock) ;
+    }
+    return rows + (size_t)first*m->ncols ;
 }
 
-/** Get the direction from one cell to another.
- *  
- *  @param a a cell.
- *  @param b a cell that is adjacent to a.
+/** Copy the cells of a maze, row by row.
  *
- *  @return the direction from a to b.
+ *  @param m a maze.
+ *  @param rows the copy, of a byte for each cell.
  */
-static unsigned char get_direction(cell_t* a, cell_t* b) {
-    if (b->r == a->r+1) return NORTH ;
-    if (b->r == a->r-1) return SOUTH ;
-    if (b->c == a->c+1) return EAST ;
-    if (b->c == a->c-1) return WEST ;
-    assert(0) ;
-    
-    // Kill "control reaches end" compiler warnings with -DNDEBUG.
-    return 0 ;
+static void copy_rows(maze_t* m, unsigned char* rows) {
+    for (int r=0; r<m->all_rows; ++r) {
+        for (int c=0; c<m->ncols; ++c) {
+            rows[(size_t)r*m->ncols + c] = CELL(m, r, c) ;
+        }
+    }
+}
+
+/** Find the next cells matching a pattern; see maze.h.  Each block is
+ *  first tested for any match with a loop that the compiler can
+ *  vectorize, and only blocks with a match are searched cell by cell.
+ */
+size_t next_cells(maze_t* m, unsigned char care, unsigned char want,
+        size_t* cursor, size_t* out, size_t max) {
+    const unsigned char* cells = get_row_span(m, 0, m->all_rows) ;
+    size_t ncells = (size_t)m->all_rows*m->ncols ;
+    size_t k = *cursor, n = 0 ;
+    while (k < ncells && n < max) {
+        size_t end = k+SCAN_BLOCK < ncells ? k+SCAN_BLOCK : ncells ;
+        unsigned char any = 0 ;
+        for (size_t i=k; i<end; ++i) any |= (cells[i] & care) == want ;
+        if (!any) {
+            k = end ;
+            continue ;
+        }
+        for (; k<end && n<max; ++k) {
+            if ((cells[k] & care) == want) out[n++] = k ;
+        }
+    }
+    *cursor = k ;
+    return n ;
 }
 
 /** Get the opposite direction from a given direction.
@@ -242,6 +787,10 @@ static unsigned char opposite(unsigned char direction) {
             return NORTH; 
         case WEST:
             return EAST ;
+        case UP:
+            return DOWN ;
+        case DOWN:
+            return UP ;
     }
     assert(0) ;
     
@@ -249,135 +798,2098 @@ static unsigned char opposite(unsigned char direction) {
     return 0 ;
 }
 
-/** Check whether there is a cell in the given direction from a given
- *  cell.
- *
+/** Open the wall between a cell and its neighbor in a direction.
+ *  
  *  @param m a maze.
- *  @param c a cell in <code>m</code>.
- *  @param d a direction.
- *
- *  @return <code>true</code> if there is a cell in direction <code>d</code>
- *      from <code>c</code>, <code>false</code> otherwise.
+ *  @param r the row of a cell.
+ *  @param c the column of the cell.
+ *  @param d the index of a direction in which the cell has a neighbor.
  */
-static bool is_cell(maze_t* m, cell_t* c, unsigned char d) {
-    switch(d) {
-        case NORTH:
-            return (c->r < m->nrows-1) ;
-        case EAST:
-            return (c->c < m->ncols-1) ;
-        case SOUTH:
-            return (c->r >= 1) ;
-        case WEST:
-            return (c->c >= 1) ;
+static void carve(maze_t* m, int r, int c, int d) {
+    int nr = r+m->row_step[d], nc = c+dir_dc[d] ;
+    CELL(m, r, c) |= directions[d] ;
+    CELL(m, nr, nc) |= directions[dir_opposite[d]] ;
+    if (m->rows != NULL) {
+        m->rows[(size_t)r*m->ncols + c] |= directions[d] ;
+        m->rows[(size_t)nr*m->ncols + nc] |= directions[dir_opposite[d]] ;
     }
-    assert(0) ;
-    
-    // Kill "control reaches end" compiler warnings with -DNDEBUG.
-    return false ;
 }
 
-/** Remove a wall from the maze.
- *  
- *  @param m a maze.
- *  @param c a cell in <code>m</code>.
- *  @param d a direction.
+/** Add the edges from a cell that has just joined the tree to each
+ *  neighbor on the same level that is not yet in the tree.
+ *
+ *  @param maze the maze.
+ *  @param r the row of the cell, counting the rows of all levels.
+ *  @param c the column of the cell.
+ *  @param frontier the frontier; grown if needed.
  */
-static void remove_wall(maze_t* m, cell_t* c, unsigned char d) {
-    MAZECELL(m, c) |= d ;
-    cell_t* adj = get_neighbor(m, c, d) ;
-    MAZECELL(m, adj) |= opposite(d) ;
+static void add_frontier(maze_t* maze, int r, int c, frontier_t* frontier) {
+    if (frontier->cap - frontier->n < 4) {
+        frontier->cap *= 2 ;
+        frontier->edges = realloc(frontier->edges,
+                frontier->cap*sizeof(edge_t)) ;
+        assert(frontier->edges != NULL) ;
+    }
 
+    // Which directions have a cell on the level, by index in directions.
+    bool inside[] = {
+        r < frontier->last-1, c < maze->ncols-1, r > frontier->first, c > 0
+    } ;
+    for (int d=0; d<4; ++d) {
+        if (inside[d] &&
+                CELL(maze, r+maze->row_step[d], c+dir_dc[d]) == EMPTY) {
+            frontier->edges[frontier->n++] = MAKE_EDGE(r, c, d) ;
+        }
+    }
 }
 
-/** Build the maze by removing walls according to Prim's algorithm.
+/** Grow the tree on a level by Prim's algorithm until a given number of
+ *  cells have joined it.
  *
- *  @param maze a maze with all walls present.
+ *  @param maze the maze.
+ *  @param rng the random number generator.
+ *  @param frontier the frontier of the level.
+ *  @param n the number of cells to join to the tree.
  */
-static void build_prim(maze_t* maze) {
-    // MST edges and cells.  If (a, b) in mst_edges, then (b, a) not in
-    // mst_edges.  (a, b) in mst_edges iff a, b both in mst_cells.
-    list356_t* mst_edges = make_list() ;
-    list356_t* mst_cells = make_list() ;
+static void grow_prim(maze_t* maze, rng_t* rng, frontier_t* frontier,
+        size_t n) {
+    // As long as we don't have all the cells in the MST, choose an
+    // edge in the frontier at random.  Put the edge in the MST
+    // and compute the new edges to add to the frontier.
+    while (n > 0) {
+#ifndef MAZE_NO_COUNTERS
+        if (frontier->n > frontier->peak) frontier->peak = frontier->n ;
+#endif
+        size_t p = random_index(rng, frontier->n) ;
+        edge_t edge = frontier->edges[p] ;
+        frontier->edges[p] = frontier->edges[--frontier->n] ;
 
-    // The frontier.  This is the collection of edges between cells in the MST
-    // and cells not in the MST.  If (a, b) in frontier, then a in mst_cells
-    // and b not in mst_cells.
-    list356_t* frontier = make_list() ;
+        int r = EDGE_ROW(edge) ;
+        int c = EDGE_COL(edge) ;
+        int d = EDGE_DIR(edge) ;
+        int nr = r+maze->row_step[d], nc = c+dir_dc[d] ;
+        if (CELL(maze, nr, nc) != EMPTY) {
+#ifndef MAZE_NO_COUNTERS
+            frontier->stale++ ;
+#endif
+            continue ;
+        }
 
-    // Choose two adjacent cells at random to put into the MST, then
-    // populate the frontier accordinately.  For simplicitly, choose a
-    // cell in the interior of the maze, then randomly choose a direction
-    // for the other cell.
-    cell_t* start = 
-        get_cell(maze, random_limit(1, maze->nrows-1), 
-                random_limit(1, maze->ncols-1));
-    unsigned char direction = 1 << random_limit(0, 4) ;
+        carve(maze, r, c, d) ;
+        n-- ;
+        add_frontier(maze, nr, nc, frontier) ;
+    }
+}
 
-    cell_t* next = get_neighbor(maze, start, direction) ;
-    /*
-    debug("Removing (%d, %d) - (%d, %d).\n",
-            start->r, start->c, next->r, next->c) ;
-    */
-    remove_wall(maze, start, direction) ;
+// BRAIDING FUNCTIONS.
+//
+// A maze is braided in two passes over bands of rows, one thread to a
+// band.  The first pass decides, for each dead end, whether to braid it
+// and which wall to open, from the passages the maze had before braiding
+// and a random number for the cell, and records the direction in a
+// row-major array of picks.  The second opens, in each cell, the
+// passages that it or its neighbors picked.  Each pass writes only to the
+// cells of its own band, and neither reads what the other writes, so the
+// bands need no locks and the maze does not depend on how it was split.
 
-    edge_t init_edge = (edge_t){start, next} ;
-    lst_add(mst_edges, &init_edge) ;
-    lst_add(mst_cells, start) ;
-    lst_add(mst_cells, next) ;
+// Mazes are braided on one thread for every BRAID_CELLS cells.  No pass
+// over bands of rows runs on more than MAX_BAND_THREADS threads.
+#define BRAID_CELLS (1 << 18)
+#define MAX_BAND_THREADS 64
 
-    for (int d=0; d<4; ++d) {
-        if (directions[d] != direction && is_cell(maze, start, directions[d])) {
-            cell_t* c = get_neighbor(maze, start, directions[d]) ;
-            edge_t* e = malloc(sizeof(edge_t)) ;
-            e->a = start ; e->b = c ;
-            lst_add(frontier, e) ;
-        }
-    }
+/** Type of a band of rows being braided.
+ */
+typedef struct _braid_band_t {
+    maze_t* maze ;
+    unsigned char* picks ;
 
-    for (int d=0; d<4; ++d) {
-        if (directions[d] != opposite(direction) 
-                && is_cell(maze, next, directions[d])) {
-            cell_t* c = get_neighbor(maze, next, directions[d]) ;
-            edge_t* e = malloc(sizeof(edge_t)) ;
-            e->a = next ; e->b = c ;
-            lst_add(frontier, e) ;
+    /** The key of the random numbers of the cells, and the bound up to
+     *  which a dead end's random number chooses it for braiding.
+     */
+    uint64_t key, limit ;
+
+    /** The rows of the band, first to last (exclusive).
+     */
+    int first, last ;
+
+    /** The passages the second pass opened in the band's cells.
+     */
+    size_t opened ;
+} braid_band_t ;
+
+/** Get the bound up to which a dead end's random number chooses it for
+ *  braiding.
+ *
+ *  @param fraction the fraction of dead ends to braid.
+ */
+static uint64_t braid_limit(float fraction) {
+    return fraction >= 1 ? UINT64_MAX :
+        (uint64_t)(fraction*18446744073709551616.0) ;
+}
+
+/** Choose the dead ends of a band to braid, and the walls they open.
+ *
+ *  @param arg the band.
+ *
+ *  @return NULL.
+ */
+static void* pick_band(void* arg) {
+    braid_band_t* band = arg ;
+    maze_t* m = band->maze ;
+    for (int r=band->first; r<band->last; ++r) {
+        int level_r = r%m->nrows ;
+        for (int c=0; c<m->ncols; ++c) {
+            size_t k = (size_t)r*m->ncols + c ;
+            unsigned char p = CELL(m, r, c), pick = EMPTY ;
+            uint64_t x ;
+            if ((p & (p-1)) == 0 &&
+                    (x = mix(band->key + k*0x9e3779b97f4a7c15ULL)) <=
+                    band->limit) {
+                // The walls of the cell with a cell on the other side on
+                // the same level.
+                unsigned char walls = (level_r < m->nrows-1 ? NORTH : 0) |
+                    (c < m->ncols-1 ? EAST : 0) |
+                    (level_r > 0 ? SOUTH : 0) | (c > 0 ? WEST : 0) ;
+                walls &= ~p ;
+                int nwalls = __builtin_popcount(walls) ;
+                if (nwalls > 0) {
+                    for (int i=(uint32_t)x % nwalls; i>0; --i) {
+                        walls &= walls-1 ;
+                    }
+                    pick = walls & -walls ;
+                }
+            }
+            band->picks[k] = pick ;
         }
     }
+    return NULL ;
+}
 
-    // As long as we don't have all the cells in the MST, choose an
-    // edge in the frontier at random.  Put the edge in the MST
-    // and compute the new edges to add to the frontier.
-    while (lst_size(mst_cells) < (maze->nrows)*(maze->ncols)) {
-        int p = random_limit(0, lst_size(frontier)) ;
-        edge_t* edge = lst_get(frontier, p) ;
-        cell_t* old_cell = edge->a ;
-        cell_t* new_cell = edge->b ;
-        /*
-        debug("Removing (%d, %d) - (%d, %d).\n",
-                old_cell->r, old_cell->c, new_cell->r, new_cell->c) ;
-        */
-        remove_wall(maze, old_cell, get_direction(old_cell, new_cell)) ;
-
-        lst_add(mst_edges, edge) ;
-        lst_add(mst_cells, new_cell) ;
-
-        for (int d=0; d<4; ++d) {
-            unsigned char dir = directions[d] ;
-            if (is_cell(maze, new_cell, dir)) {
-                cell_t* adj_cell = get_neighbor(maze, new_cell, dir) ;
-                edge_t* edge2 = malloc(sizeof(edge_t)) ;
-                edge2->a = new_cell ; edge2->b = adj_cell ;
-                if (lst_contains(mst_cells, adj_cell, cell_cmp)) {
-                    lst_remove(frontier, edge2, edge_cmp) ;
-                    if (adj_cell != old_cell) free(edge2) ;
-                }
-                else {
-                    lst_add(frontier, edge2) ;
-                }
+/** Open the passages of the cells of a band that the cells or their
+ *  neighbors picked.
+ *
+ *  @param arg the band.
+ *
+ *  @return NULL.
+ */
+static void* open_band(void* arg) {
+    braid_band_t* band = arg ;
+    maze_t* m = band->maze ;
+    const unsigned char* picks = band->picks ;
+    for (int r=band->first; r<band->last; ++r) {
+        int level_r = r%m->nrows ;
+        for (int c=0; c<m->ncols; ++c) {
+            size_t k = (size_t)r*m->ncols + c ;
+            unsigned char open = picks[k] ;
+            if (level_r < m->nrows-1 && picks[k+m->ncols] == SOUTH) {
+                open |= NORTH ;
             }
+            if (c < m->ncols-1 && picks[k+1] == WEST) open |= EAST ;
+            if (level_r > 0 && picks[k-m->ncols] == NORTH) open |= SOUTH ;
+            if (c > 0 && picks[k-1] == EAST) open |= WEST ;
+            if (open == EMPTY) continue ;
+            band->opened += __builtin_popcount(open & ~CELL(m, r, c)) ;
+            CELL(m, r, c) |= open ;
         }
     }
+    return NULL ;
+}
+
+/** Run a pass over every band, each on a thread of its own but the first,
+ *  which runs on the calling thread.  A band whose thread cannot be made
+ *  runs on the calling thread too.
+ *
+ *  @param bands the bands, an array of structures of any type.
+ *  @param size the size of a band's structure.
+ *  @param nbands the number of bands, at most MAX_BAND_THREADS.
+ *  @param pass the pass, which is given a pointer to its band.
+ */
+static void run_bands(void* bands, size_t size, int nbands,
+        void* (*pass)(void*)) {
+    char* band = bands ;
+    pthread_t threads[MAX_BAND_THREADS] ;
+    bool threaded[MAX_BAND_THREADS] ;
+    for (int i=1; i<nbands; ++i) {
+        threaded[i] = pthread_create(&threads[i], NULL, pass,
+                band + i*size) == 0 ;
+        if (!threaded[i]) pass(band + i*size) ;
+    }
+    pass(band) ;
+    for (int i=1; i<nbands; ++i) {
+        if (threaded[i]) pthread_join(threads[i], NULL) ;
+    }
+}
+
+/** Braid a perfect maze, and record whether it is still perfect.
+ *
+ *  @param maze the maze.
+ *  @param fraction the fraction of dead ends to braid; see maze_opts_t.
+ *  @param key the key of the random numbers of the cells.
+ */
+static void braid(maze_t* maze, float fraction, uint64_t key) {
+    size_t ncells = (size_t)maze->all_rows*maze->ncols ;
+    block_t picks ;
+    if (!alloc_block(&picks, ncells)) {
+        // Without room to pick, leave the maze perfect.
+        return ;
+    }
+    COUNT(bytes_allocated, ncells) ;
+
+    long nthreads = sysconf(_SC_NPROCESSORS_ONLN) ;
+    if (nthreads > (long)(ncells/BRAID_CELLS)) nthreads = ncells/BRAID_CELLS ;
+    if (nthreads > maze->all_rows) nthreads = maze->all_rows ;
+    if (nthreads > MAX_BAND_THREADS) nthreads = MAX_BAND_THREADS ;
+    if (nthreads < 1) nthreads = 1 ;
+
+    braid_band_t bands[MAX_BAND_THREADS] ;
+    for (int i=0; i<nthreads; ++i) {
+        bands[i] = (braid_band_t){
+            .maze = maze,
+            .picks = picks.p,
+            .key = key,
+            .limit = braid_limit(fraction),
+            .first = (int)((long long)maze->all_rows*i/nthreads),
+            .last = (int)((long long)maze->all_rows*(i+1)/nthreads)
+        } ;
+    }
 
+    run_bands(bands, sizeof(bands[0]), nthreads, pick_band) ;
+    run_bands(bands, sizeof(bands[0]), nthreads, open_band) ;
 
+    size_t opened = 0 ;
+    for (int i=0; i<nthreads; ++i) opened += bands[i].opened ;
+    free_block(&picks) ;
+
+    // Each wall opened is two passages opened, one on each side.
+    maze->perfect = opened == 0 ;
+    COUNT(walls_removed, opened/2) ;
 }
 
+// ROW GENERATOR FUNCTIONS.
+//
+// Binary-tree and sidewinder mazes are made a row at a time, each row from
+// random numbers of its own, read from a stream that can be read in any
+// order (see mix), so rows can be made in any order and on any number of
+// threads.  A row is first decided as two sets of bits, 64 cells to a
+// word:  the cells with a passage north and those with a passage east.
+// In a binary tree each cell goes north or east at random; in a sidewinder
+// each cell goes east at random, and one cell of each run of cells joined
+// east, chosen at random, goes north.  The passage masks of the row then
+// follow from its bits and the north bits of the row below, 8 cells to a
+// 64-bit word.  The top row of each level runs east all the way, and the
+// top rows of neighboring levels are joined by a shaft at a random
+// column, so each level is a tree and the whole maze is one.
+//
+// Rows are made from the top down.  A row made on its own has no passages
+// into the rows below it, which are not made yet, and opens the passages
+// back into it of the rows above, so a maze made a step at a time is whole
+// between steps.  Rows made in bands on threads are made whole instead,
+// each with the passages into the rows below, so that no thread writes to
+// another's rows.
+
+// Binary-tree and sidewinder mazes are made on one thread for every
+// ROW_CELLS cells.
+#define ROW_CELLS (1 << 20)
+
+/** Type of a band of rows being made by a row generator.
+ */
+typedef struct _row_band_t {
+    maze_t* maze ;
+    maze_algorithm_t algorithm ;
+
+    /** The key of the random numbers of the rows' bits, and that of the
+     *  runs of sidewinder rows and the columns of the shafts.
+     */
+    uint64_t key, run_key ;
+
+    /** The rows of the band, first to last (exclusive), and whether they
+     *  are made whole.
+     */
+    int first, last ;
+    bool whole ;
+} row_band_t ;
+
+/** Spread 8 bits into the low bits of the 8 bytes of a word, in order.
+ */
+static inline uint64_t spread_bits(unsigned b) {
+#ifdef __BMI2__
+    return _pdep_u64(b, 0x0101010101010101ULL) ;
+#else
+    uint64_t x = (b*0x0101010101010101ULL) & 0x8040201008040201ULL ;
+    return (x + 0x7f7f7f7f7f7f7f7fULL) >> 7 & 0x0101010101010101ULL ;
+#endif
+}
+
+/** Get the column of the shaft down from the top row of a level.
+ */
+static int shaft_column(const row_band_t* band, int level) {
+    maze_t* m = band->maze ;
+    uint64_t x = mix(band->run_key + ((uint64_t)m->all_rows*m->ncols +
+                level)*0x9e3779b97f4a7c15ULL) ;
+    return (int)(((x >> 32)*m->ncols) >> 32) ;
+}
+
+/** Decide the passages of a row north and east.
+ *
+ *  @param band the band of the row.
+ *  @param r the row, counting the rows of all levels.
+ *  @param north set to the bits of the cells with a passage north.
+ *  @param east set to the bits of the cells with a passage east.
+ */
+static void row_bits(const row_band_t* band, int r, uint64_t* north,
+        uint64_t* east) {
+    maze_t* m = band->maze ;
+    size_t nwords = ((size_t)m->ncols+63)/64 ;
+    bool top = r%m->nrows == m->nrows-1 ;
+    bool tree = band->algorithm == MAZE_BINARY_TREE ;
+    for (size_t w=0; w<nwords; ++w) {
+        uint64_t x = top ? 0 : mix(band->key +
+                ((uint64_t)r*nwords + w)*0x9e3779b97f4a7c15ULL) ;
+        north[w] = tree ? x : 0 ;
+        east[w] = top ? UINT64_MAX : tree ? ~x : x ;
+    }
+
+    // Clear the bits past the last column, which has no passage east and
+    // in a binary tree goes north instead.
+    size_t lw = ((size_t)m->ncols-1)/64 ;
+    uint64_t lb = 1ull << (m->ncols-1)%64 ;
+    north[lw] &= lb | (lb-1) ;
+    east[lw] &= lb-1 ;
+    if (top) return ;
+    if (tree) {
+        north[lw] |= lb ;
+        return ;
+    }
+
+    // Close each run of a sidewinder row where it stops going east, going
+    // north from one of its cells.
+    size_t start = 0 ;
+    for (size_t w=0; w<=lw; ++w) {
+        uint64_t ends = ~east[w] & (w < lw ? UINT64_MAX : lb | (lb-1)) ;
+        while (ends != 0) {
+            size_t end = w*64 + __builtin_ctzll(ends) ;
+            ends &= ends-1 ;
+            uint64_t x = mix(band->run_key +
+                    ((uint64_t)r*m->ncols + end)*0x9e3779b97f4a7c15ULL) ;
+            size_t pick = start + (((x >> 32)*(end-start+1)) >> 32) ;
+            north[pick/64] |= 1ull << pick%64 ;
+            start = end+1 ;
+        }
+    }
+}
+
+/** Write the passage masks of a row.
+ *
+ *  @param m the maze.
+ *  @param north the bits of the row's cells with a passage north.
+ *  @param east the bits of its cells with a passage east.
+ *  @param south the bits of the cells of the row below with a passage
+ *      north, or NULL for no passages south.
+ *  @param row set to the masks.
+ */
+static void write_row(maze_t* m, const uint64_t* north, const uint64_t* east,
+        const uint64_t* south, unsigned char* row) {
+    size_t nwords = ((size_t)m->ncols+63)/64 ;
+    uint64_t carry = 0 ;
+    for (size_t w=0; w<nwords; ++w) {
+        uint64_t n = north[w], e = east[w], s = south != NULL ? south[w] : 0 ;
+        uint64_t west = e << 1 | carry ;
+        carry = e >> 63 ;
+        for (int g=0; g<8; ++g) {
+            size_t c = w*64 + 8*g ;
+            if (c >= (size_t)m->ncols) break ;
+            uint64_t masks = spread_bits(n >> 8*g & 0xff)*NORTH |
+                spread_bits(e >> 8*g & 0xff)*EAST |
+                spread_bits(s >> 8*g & 0xff)*SOUTH |
+                spread_bits(west >> 8*g & 0xff)*WEST ;
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+            masks = __builtin_bswap64(masks) ;
+#endif
+            size_t bytes = m->ncols-c < 8 ? m->ncols-c : 8 ;
+            memcpy(row + c, &masks, bytes) ;
+        }
+    }
+}
+
+/** Open a passage on one side of a wall, in the cells of a maze and in
+ *  the row-major copy of them, if there is one.
+ */
+static void open_side(maze_t* m, int r, int c, unsigned char d) {
+    CELL(m, r, c) |= d ;
+    if (m->rows != NULL) m->rows[(size_t)r*m->ncols + c] |= d ;
+}
+
+/** Make the rows of a band, from the top down.
+ *
+ *  @param arg the band.
+ *
+ *  @return NULL.
+ */
+static void* make_rows(void* arg) {
+    row_band_t* band = arg ;
+    maze_t* m = band->maze ;
+    size_t nwords = ((size_t)m->ncols+63)/64 ;
+    uint64_t* bits = malloc(4*nwords*sizeof(uint64_t)) ;
+    unsigned char* copy = m->layout != MAZE_ROW_MAJOR ? malloc(m->ncols) :
+        NULL ;
+    assert(bits != NULL && (m->layout == MAZE_ROW_MAJOR || copy != NULL)) ;
+    uint64_t *north = bits, *east = bits+nwords ;
+    uint64_t *below_north = bits+2*nwords, *below_east = bits+3*nwords ;
+
+    row_bits(band, band->last-1, north, east) ;
+    for (int r=band->last-1; r>=band->first; --r) {
+        int level = r/m->nrows, level_r = r%m->nrows ;
+        bool whole = band->whole && level_r > 0 ;
+        if (whole) row_bits(band, r-1, below_north, below_east) ;
+
+        unsigned char* row = copy != NULL ? copy :
+            m->cells + (size_t)r*m->ncols ;
+        write_row(m, north, east, whole ? below_north : NULL, row) ;
+        if (level_r == m->nrows-1 && level < m->nlevels-1) {
+            row[shaft_column(band, level+1)] |= UP ;
+        }
+        if (level_r == m->nrows-1 && level > 0 && band->whole) {
+            row[shaft_column(band, level)] |= DOWN ;
+        }
+        if (copy != NULL) {
+            for (int c=0; c<m->ncols; ++c) CELL(m, r, c) = copy[c] ;
+            if (m->rows != NULL) {
+                memcpy(m->rows + (size_t)r*m->ncols, copy, m->ncols) ;
+            }
+        }
+
+        // Open the passages back into this row from the rows above.
+        if (!band->whole && level_r < m->nrows-1) {
+            for (size_t w=0; w<nwords; ++w) {
+                for (uint64_t n=north[w]; n != 0; n &= n-1) {
+                    open_side(m, r+1, w*64 + __builtin_ctzll(n), SOUTH) ;
+                }
+            }
+        }
+        if (!band->whole && level_r == m->nrows-1 && level < m->nlevels-1) {
+            open_side(m, r+m->nrows, shaft_column(band, level+1), DOWN) ;
+        }
+
+        if (r > band->first) {
+            if (whole) {
+                uint64_t* t = north ;
+                north = below_north ;
+                below_north = t ;
+                t = east ;
+                east = below_east ;
+                below_east = t ;
+            } else {
+                row_bits(band, r-1, north, east) ;
+            }
+        }
+    }
+
+    free(bits) ;
+    free(copy) ;
+    return NULL ;
+}
+
+/** Make the rows of a maze by a row generator, on as many threads as
+ *  help.
+ *
+ *  @param maze the maze.
+ *  @param algorithm the generator.
+ *  @param key the key of the random numbers of the rows' bits.
+ *  @param run_key the key of the random numbers of the runs and shafts.
+ */
+static void make_all_rows(maze_t* maze, maze_algorithm_t algorithm,
+        uint64_t key, uint64_t run_key) {
+    size_t ncells = (size_t)maze->all_rows*maze->ncols ;
+    long nthreads = sysconf(_SC_NPROCESSORS_ONLN) ;
+    if (nthreads > (long)(ncells/ROW_CELLS)) nthreads = ncells/ROW_CELLS ;
+    if (nthreads > maze->all_rows) nthreads = maze->all_rows ;
+    if (nthreads > MAX_BAND_THREADS) nthreads = MAX_BAND_THREADS ;
+    if (nthreads < 1) nthreads = 1 ;
+
+    row_band_t bands[MAX_BAND_THREADS] ;
+    for (int i=0; i<nthreads; ++i) {
+        bands[i] = (row_band_t){
+            .maze = maze,
+            .algorithm = algorithm,
+            .key = key,
+            .run_key = run_key,
+            .first = (int)((long long)maze->all_rows*i/nthreads),
+            .last = (int)((long long)maze->all_rows*(i+1)/nthreads),
+            .whole = true
+        } ;
+    }
+    run_bands(bands, sizeof(bands[0]), nthreads, make_rows) ;
+    COUNT(bytes_allocated, nthreads*(((size_t)maze->ncols+63)/64*32 +
+                (maze->layout != MAZE_ROW_MAJOR ? maze->ncols : 0))) ;
+}
+
+// GENERATOR FUNCTIONS.
+//
+// A maze is built by Prim's algorithm, removing walls until there is
+// exactly one path between any pair of cells.  A cell is in the tree
+// exactly when it has a passage, so the cells themselves record the tree.
+// Frontier edges are not removed when the cell they lead to joins the
+// tree by another edge; instead such stale edges are discarded when they
+// are chosen.  Choosing uniformly among all edges and discarding the
+// stale ones chooses uniformly among the live ones, so this is still
+// Prim's algorithm with random weights, but each step takes constant
+// time.
+//
+// The levels of a layered maze are built one at a time from the bottom.
+// The first is a tree of its own; each one above is grown from shafts
+// down from cells chosen at random, all at once, so that it is a forest
+// whose trees each have one shaft into the tree below, and the whole maze
+// is still a tree.  The frontier only ever holds the edges of one level,
+// which keeps it small and the cells it reaches near each other.
+//
+// The building is done in phases, and each phase in pieces of any size,
+// drawing the same random numbers in the same order however it is split,
+// so that a maze made in steps is the same as one made all at once.  The
+// cells joined so far always form a tree, and braiding opens each wall
+// from both sides at once, so the maze is whole between steps.
+
+// Steps check the time after every STEP_CELLS cells of work.
+#define STEP_CELLS 4096
+
+/** Open the passages that the cells of some rows picked, on both sides.
+ *  This opens the same passages as open_band does for every band, but
+ *  leaves no passage open on one side only, even partway through.
+ *
+ *  @param m the maze.
+ *  @param picks the picks.
+ *  @param first the first row.
+ *  @param last the last row (exclusive).
+ *
+ *  @return the number of passages opened, counting each side.
+ */
+static size_t open_rows(maze_t* m, const unsigned char* picks, int first,
+        int last) {
+    size_t opened = 0 ;
+    for (int r=first; r<last; ++r) {
+        for (int c=0; c<m->ncols; ++c) {
+            unsigned char pick = picks[(size_t)r*m->ncols + c] ;
+            if (pick == EMPTY) continue ;
+            int d = __builtin_ctz(pick) ;
+            int nr = r+m->row_step[d], nc = c+dir_dc[d] ;
+            opened += (CELL(m, r, c) & pick) == 0 ;
+            opened += (CELL(m, nr, nc) & directions[dir_opposite[d]]) == 0 ;
+            carve(m, r, c, d) ;
+        }
+    }
+    return opened ;
+}
+
+/** Finish building the tree:  count what it took, and start braiding it
+ *  if the maze is to be braided.
+ *
+ *  @param g the maze being made.
+ */
+static void end_tree(maze_gen_t* g) {
+    maze_t* m = g->maze ;
+    COUNT(bytes_allocated, g->frontier.cap*sizeof(edge_t)) ;
+    free(g->frontier.edges) ;
+    g->frontier.edges = NULL ;
+    COUNT(walls_removed, (size_t)m->all_rows*m->ncols-1) ;
+    COUNT(stale_edges, g->frontier.stale) ;
+    COUNT_MAX(frontier_peak, g->frontier.peak) ;
+    m->perfect = true ;
+
+    if (g->braid > 0) {
+        g->key = next_random(&g->rng) ;
+        g->limit = braid_limit(g->braid) ;
+        g->row = 0 ;
+        g->phase = GEN_PICK ;
+    } else {
+        g->phase = GEN_DONE ;
+    }
+}
+
+/** Do some of the work of the current phase of making a maze.
+ *
+ *  @param g the maze being made.
+ *  @param n the most work to do, in cells; SIZE_MAX for no limit.  While
+ *      braiding, work is done a row at a time, and may go past this by up
+ *      to a row.
+ *
+ *  @return the work done, which is 0 only if the phase ended.
+ */
+static size_t run_phase(maze_gen_t* g, size_t n) {
+    maze_t* m = g->maze ;
+    frontier_t* frontier = &g->frontier ;
+    size_t level_cells = (size_t)m->nrows*m->ncols ;
+    size_t work = 0 ;
+    int r, c, d ;
+
+    switch (g->phase) {
+        case GEN_SEED:
+            // Choose two adjacent cells at random to put into the MST,
+            // then populate the frontier accordinately.  For simplicitly,
+            // choose a cell in the interior of the maze, then randomly
+            // choose a direction for the other cell.
+            // The column is chosen first so that each seed still makes
+            // the maze it always has.
+            if (m->nrows > 2 && m->ncols > 2) {
+                c = random_limit(&g->rng, 1, m->ncols-1) ;
+                r = random_limit(&g->rng, 1, m->nrows-1) ;
+                d = random_limit(&g->rng, 0, 4) ;
+            } else {
+                // A maze one or two cells wide has no interior, so choose
+                // any cell, and a direction that stays on the grid.  A
+                // single cell is the whole tree.
+                c = random_limit(&g->rng, 0, m->ncols) ;
+                r = random_limit(&g->rng, 0, m->nrows) ;
+                bool inside[] = {
+                    r < m->nrows-1, c < m->ncols-1, r > 0, c > 0
+                } ;
+                int ninside = 0 ;
+                for (d=0; d<4; ++d) ninside += inside[d] ;
+                if (ninside == 0) {
+                    add_frontier(m, r, c, frontier) ;
+                    g->left = 0 ;
+                    g->done++ ;
+                    g->phase = GEN_GROW ;
+                    return 1 ;
+                }
+                int k = random_limit(&g->rng, 0, ninside) ;
+                for (d=0; !inside[d] || k-- > 0; ++d) ;
+            }
+            carve(m, r, c, d) ;
+            add_frontier(m, r, c, frontier) ;
+            add_frontier(m, r+m->row_step[d], c+dir_dc[d], frontier) ;
+            g->left = level_cells-2 ;
+            g->done += 2 ;
+            g->phase = GEN_GROW ;
+            return 2 ;
+
+        case GEN_ROWS:
+            if (g->row == m->all_rows && n == SIZE_MAX) {
+                // With no limit, make the rows on as many threads as help.
+                make_all_rows(m, g->algorithm, g->row_key, g->run_key) ;
+                work = level_cells*m->nlevels ;
+                g->row = 0 ;
+            } else {
+                int nrows = n/m->ncols < (size_t)g->row ? n/m->ncols : g->row ;
+                if (nrows < 1) nrows = 1 ;
+                row_band_t band = {
+                    .maze = m, .algorithm = g->algorithm, .key = g->row_key,
+                    .run_key = g->run_key, .first = g->row-nrows,
+                    .last = g->row, .whole = false
+                } ;
+                make_rows(&band) ;
+                g->row -= nrows ;
+                work = (size_t)nrows*m->ncols ;
+            }
+            g->done += work ;
+            if (g->row == 0) end_tree(g) ;
+            return work ;
+
+        case GEN_GROW:
+            work = g->left < n ? g->left : n ;
+            grow_prim(m, &g->rng, frontier, work) ;
+            g->left -= work ;
+            g->done += work ;
+            if (g->left > 0) return work ;
+            if (++g->level == m->nlevels) {
+                end_tree(g) ;
+                return work ;
+            }
+
+            // Sink the shafts of the next level, skipping cells chosen
+            // twice.
+            frontier->n = 0 ;
+            frontier->first = g->level*m->nrows ;
+            frontier->last = frontier->first + m->nrows ;
+            g->left = level_cells ;
+            g->shafts = level_cells/SHAFT_CELLS > 0 ?
+                level_cells/SHAFT_CELLS : 1 ;
+            g->phase = GEN_SHAFTS ;
+            return work ;
+
+        case GEN_SHAFTS:
+            for (; work < n && g->shafts > 0; ++work, --g->shafts) {
+                c = random_limit(&g->rng, 0, m->ncols) ;
+                r = frontier->first + random_limit(&g->rng, 0, m->nrows) ;
+                if (CELL(m, r, c) != EMPTY) continue ;
+                carve(m, r, c, DOWN_INDEX) ;
+                add_frontier(m, r, c, frontier) ;
+                g->left-- ;
+                g->done++ ;
+            }
+            if (g->shafts == 0) g->phase = GEN_GROW ;
+            return work ;
+
+        case GEN_PICK:
+            if (g->row == 0 && n == SIZE_MAX) {
+                // With no limit, braid on as many threads as help.
+                braid(m, g->braid, g->key) ;
+                if (m->rows != NULL) copy_rows(m, m->rows) ;
+                g->done = g->total ;
+                g->phase = GEN_DONE ;
+                return level_cells*m->nlevels ;
+            }
+            if (g->row == 0) {
+                if (!alloc_block(&g->picks, level_cells*m->nlevels)) {
+                    // Without room to pick, leave the maze perfect.
+                    g->phase = GEN_DONE ;
+                    return 0 ;
+                }
+                COUNT(bytes_allocated, g->picks.bytes) ;
+            }
+            // Fall through.
+
+        case GEN_OPEN: {
+            int nrows = n/m->ncols < (size_t)(m->all_rows-g->row) ?
+                n/m->ncols : m->all_rows-g->row ;
+            if (nrows < 1) nrows = 1 ;
+            if (g->phase == GEN_PICK) {
+                braid_band_t band = {
+                    .maze = m, .picks = g->picks.p, .key = g->key,
+                    .limit = g->limit, .first = g->row,
+                    .last = g->row+nrows
+                } ;
+                pick_band(&band) ;
+            } else {
+                g->opened += open_rows(m, g->picks.p, g->row, g->row+nrows) ;
+            }
+            g->row += nrows ;
+            work = (size_t)nrows*m->ncols ;
+            g->done += work ;
+            if (g->row < m->all_rows) return work ;
+
+            g->row = 0 ;
+            if (g->phase == GEN_PICK) {
+                g->phase = GEN_OPEN ;
+                return work ;
+            }
+            free_block(&g->picks) ;
+            m->perfect = g->opened == 0 ;
+            COUNT(walls_removed, g->opened/2) ;
+            g->phase = GEN_DONE ;
+            return work ;
+        }
+
+        case GEN_DONE:
+            break ;
+    }
+    return 0 ;
+}
+
+/** Make some of a maze; see maze.h.
+ */
+bool step_maze(maze_gen_t* g, size_t max_cells, long max_us) {
+    COUNT_TIME(step_start) ;
+    bool timed = max_us > 0 ;
+    uint64_t deadline = timed ? now_ns() + (uint64_t)max_us*1000 : 0 ;
+    size_t budget = max_cells > 0 ? max_cells : SIZE_MAX ;
+
+    while (g->phase != GEN_DONE && budget > 0) {
+        size_t n = budget ;
+        if (timed && n > STEP_CELLS) n = STEP_CELLS ;
+        size_t work = run_phase(g, n) ;
+        if (budget != SIZE_MAX) budget -= work < budget ? work : budget ;
+        if (timed && now_ns() >= deadline) break ;
+    }
+
+    COUNT_TIME(step_end) ;
+    COUNT(build_ns, step_end-step_start) ;
+    return g->phase == GEN_DONE ;
+}
+
+/** Get the maze being made; see maze.h.
+ */
+maze_t* get_gen_maze(maze_gen_t* g) {
+    return g->maze ;
+}
+
+/** Get how much of a maze has been made; see maze.h.
+ */
+float get_gen_progress(maze_gen_t* g) {
+    return g->total > 0 ? (float)g->done/g->total : 1 ;
+}
+
+/** Finish making a maze; see maze.h.
+ */
+maze_t* finish_maze(maze_gen_t* g) {
+    step_maze(g, 0, 0) ;
+    maze_t* m = g->maze ;
+    g->maze = NULL ;
+    free_maze_gen(g) ;
+    return m ;
+}
+
+/** Stop making a maze; see maze.h.
+ */
+void free_maze_gen(maze_gen_t* g) {
+    if (g == NULL) return ;
+    free(g->frontier.edges) ;
+    free_block(&g->picks) ;
+    free_maze(g->maze) ;
+    free(g) ;
+}
+
+// VALIDATION FUNCTIONS.
+//
+// A maze is checked in one pass over bands of rows, one thread to a band.
+// Each band checks the passages of its cells against the edges of the
+// maze and the passages of their neighbors, and unions the cells joined
+// by each passage north, east or up in a union-find forest that all the
+// bands share.  The forest is lock-free:  a root is linked under a root
+// of higher index with a compare-and-swap, which fails if another thread
+// got there first, and finds halve the paths they walk.  Parents only
+// ever grow, so the forest never has a cycle, and the number of unions
+// that succeed does not depend on the order in which they are made.
+
+// Mazes are checked on one thread for every CHECK_CELLS cells.
+#define CHECK_CELLS (1 << 16)
+
+/** Type of a band of rows being checked.
+ */
+typedef struct _check_band_t {
+    maze_t* maze ;
+    const unsigned char* cells ;
+    size_t* parent ;
+
+    /** The rows of the band, first to last (exclusive).
+     */
+    int first, last ;
+
+    /** What the band found; see maze_check_t.  Passages that joined two
+     *  trees of the forest are counted in unions.
+     */
+    size_t asymmetric, off_grid, passages, unions ;
+} check_band_t ;
+
+/** Find the root of a cell's tree in a union-find forest, halving the
+ *  path to it.
+ *
+ *  @param parent the parents of the cells.
+ *  @param x a cell.
+ *
+ *  @return the root of the tree of <code>x</code>, as of some moment
+ *      during the call.
+ */
+static size_t find_root(size_t* parent, size_t x) {
+    size_t p ;
+    while ((p = __atomic_load_n(&parent[x], __ATOMIC_ACQUIRE)) != x) {
+        size_t g = __atomic_load_n(&parent[p], __ATOMIC_ACQUIRE) ;
+        if (g != p) {
+            __atomic_compare_exchange_n(&parent[x], &p, g, false,
+                    __ATOMIC_RELEASE, __ATOMIC_RELAXED) ;
+        }
+        x = g ;
+    }
+    return x ;
+}
+
+/** Join the trees of two cells in a union-find forest.
+ *
+ *  @param parent the parents of the cells.
+ *  @param x a cell.
+ *  @param y another cell.
+ *
+ *  @return true if the cells were in different trees, false if they were
+ *      already in the same one.
+ */
+static bool join_roots(size_t* parent, size_t x, size_t y) {
+    while (true) {
+        x = find_root(parent, x) ;
+        y = find_root(parent, y) ;
+        if (x == y) return false ;
+        if (x > y) {
+            size_t t = x ;
+            x = y ;
+            y = t ;
+        }
+        size_t expected = x ;
+        if (__atomic_compare_exchange_n(&parent[x], &expected, y, false,
+                    __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)) {
+            return true ;
+        }
+    }
+}
+
+/** Check the cells of a band.
+ *
+ *  @param arg the band.
+ *
+ *  @return NULL.
+ */
+static void* check_band(void* arg) {
+    check_band_t* band = arg ;
+    maze_t* m = band->maze ;
+    const unsigned char* cells = band->cells ;
+    ptrdiff_t level = (ptrdiff_t)m->nrows*m->ncols ;
+    ptrdiff_t step[] = {m->ncols, 1, -(ptrdiff_t)m->ncols, -1, level, -level} ;
+    unsigned char all = NORTH|EAST|SOUTH|WEST|UP|DOWN ;
+
+    for (int r=band->first; r<band->last; ++r) {
+        int level_r = r%m->nrows ;
+        for (int c=0; c<m->ncols; ++c) {
+            size_t k = (size_t)r*m->ncols + c ;
+            unsigned char p = cells[k] ;
+            if (p & ~all) band->off_grid++ ;
+
+            // Which directions have a cell, by index in directions.
+            bool inside[] = {
+                level_r < m->nrows-1, c < m->ncols-1, level_r > 0, c > 0,
+                r+m->nrows < m->all_rows, r >= m->nrows
+            } ;
+            for (int d=0; d<6; ++d) {
+                if (!(p & directions[d])) continue ;
+                if (!inside[d]) {
+                    band->off_grid++ ;
+                    continue ;
+                }
+                size_t n = k + step[d] ;
+                if (!(cells[n] & directions[dir_opposite[d]])) {
+                    band->asymmetric++ ;
+                }
+
+                // Count each passage from its cell to the north, east or
+                // up.
+                if (d == 0 || d == 1 || d == 4) {
+                    band->passages++ ;
+                    band->unions += join_roots(band->parent, k, n) ;
+                }
+            }
+        }
+    }
+    return NULL ;
+}
+
+/** Check a maze; see maze.h.
+ */
+bool check_maze(maze_t* m, int nthreads, maze_check_t* check) {
+    size_t ncells = (size_t)m->all_rows*m->ncols ;
+    memset(check, 0, sizeof(*check)) ;
+    block_t parent_block ;
+    if (!alloc_block(&parent_block, ncells*sizeof(size_t))) return false ;
+    size_t* parent = parent_block.p ;
+    for (size_t k=0; k<ncells; ++k) parent[k] = k ;
+    COUNT(bytes_allocated, ncells*sizeof(size_t)) ;
+
+    if (nthreads < 1) nthreads = sysconf(_SC_NPROCESSORS_ONLN) ;
+    if (nthreads > (long)(ncells/CHECK_CELLS)) nthreads = ncells/CHECK_CELLS ;
+    if (nthreads > m->all_rows) nthreads = m->all_rows ;
+    if (nthreads > MAX_BAND_THREADS) nthreads = MAX_BAND_THREADS ;
+    if (nthreads < 1) nthreads = 1 ;
+
+    check_band_t bands[MAX_BAND_THREADS] ;
+    const unsigned char* cells = get_row_span(m, 0, m->all_rows) ;
+    for (int i=0; i<nthreads; ++i) {
+        bands[i] = (check_band_t){
+            .maze = m,
+            .cells = cells,
+            .parent = parent,
+            .first = (int)((long long)m->all_rows*i/nthreads),
+            .last = (int)((long long)m->all_rows*(i+1)/nthreads)
+        } ;
+    }
+    run_bands(bands, sizeof(bands[0]), nthreads, check_band) ;
+    free_block(&parent_block) ;
+
+    size_t unions = 0 ;
+    for (int i=0; i<nthreads; ++i) {
+        check->asymmetric += bands[i].asymmetric ;
+        check->off_grid += bands[i].off_grid ;
+        check->passages += bands[i].passages ;
+        unions += bands[i].unions ;
+    }
+    check->components = ncells - unions ;
+    check->cycles = check->passages - unions ;
+
+    return check->asymmetric == 0 && check->off_grid == 0 &&
+        check->components == 1 && (!m->perfect || check->cycles == 0) ;
+}
+
+// COLLISION FUNCTIONS.
+
+// How far a moving circle is kept from a wall it stops against, and the
+// most times a move slides along walls before giving up.
+#define SKIN 1e-4f
+#define MAX_SLIDES 4
+
+/** Check whether a wall is present, treating the exterior of the maze as
+ *  having no walls except its own boundary.  Rows -1 and columns -1 stand
+ *  for the outside of the south and west boundaries, whose north and east
+ *  walls are those boundaries.
+ *
+ *  @param m a maze.
+ *  @param r the row of a cell, from -1 to <code>m->all_rows-1</code>.
+ *  @param c the column of a cell, from -1 to <code>m->ncols-1</code>.
+ *  @param d <code>NORTH</code> or <code>EAST</code>.
+ *
+ *  @return true if the cell at row <code>r</code> and column <code>c</code>
+ *      has a wall in direction <code>d</code>.
+ */
+static bool wall_at(maze_t* m, int r, int c, unsigned char d) {
+    if (r >= m->all_rows || c >= m->ncols) return false ;
+    if (r < 0) return d == NORTH && c >= 0 ;
+    if (c < 0) return d == EAST && r >= 0 ;
+    return (CELL(m, r, c) & d) == 0 ;
+}
+
+/** Sweep a point toward a circle.
+ *
+ *  @param p the start of the point.
+ *  @param d the move of the point.
+ *  @param center the center of the circle.
+ *  @param radius the radius of the circle.
+ *  @param t set to the fraction of the move at which the point reaches
+ *      the circle.
+ *
+ *  @return true if the point reaches the circle during the move while
+ *      heading into it, false otherwise.
+ */
+static bool sweep_to_circle(const float p[2], const float d[2],
+        const float center[2], float radius, float* t) {
+    float f[2] = {p[0]-center[0], p[1]-center[1]} ;
+    float a = d[0]*d[0] + d[1]*d[1] ;
+    float b = f[0]*d[0] + f[1]*d[1] ;
+    float c = f[0]*f[0] + f[1]*f[1] - radius*radius ;
+    if (a == 0.0f || b >= 0.0f) return false ;
+    float disc = b*b - a*c ;
+    if (disc < 0.0f) return false ;
+    float t0 = (-b - sqrtf(disc))/a ;
+    if (t0 > 1.0f) return false ;
+    *t = t0 < 0.0f ? 0.0f : t0 ;
+    return true ;
+}
+
+/** Sweep a circle against one wall, keeping the contact if it is earlier
+ *  than the one found so far.  The wall is the segment of the line
+ *  <code>axis</code> = <code>at</code> from <code>from</code> to
+ *  <code>from+1</code> along the other axis, so a circle of radius
+ *  <code>radius</code> touches it when its center reaches the capsule
+ *  around the segment:  either one of the two sides or one of the two
+ *  rounded ends.
+ *
+ *  @param p the start of the center.
+ *  @param d the move of the center.
+ *  @param radius the radius of the circle.
+ *  @param axis 0 for a wall across a row boundary, 1 for a column boundary.
+ *  @param at the coordinate of the wall along <code>axis</code>.
+ *  @param from the lower end of the wall along the other axis.
+ *  @param contact updated if the circle touches the wall first.
+ */
+static void sweep_wall(const float p[2], const float d[2], float radius,
+        int axis, float at, float from, maze_contact_t* contact) {
+    int other = 1-axis ;
+    float t ;
+
+    // A side:  the center reaches the line radius away from the wall, or
+    // is already closer than that and moving further in.
+    float side = p[axis] < at ? -1.0f : 1.0f ;
+    if (d[axis]*side < 0.0f) {
+        t = fabsf(p[axis]-at) < radius ? 0.0f :
+            (at + side*radius - p[axis])/d[axis] ;
+        float along = p[other] + t*d[other] ;
+        if (t < contact->t && along >= from && along <= from+1.0f) {
+            float n[2] = {0.0f, 0.0f} ;
+            n[axis] = side ;
+            contact->t = t ;
+            contact->contact_r = axis == 0 ? at : along ;
+            contact->contact_c = axis == 0 ? along : at ;
+            contact->normal_r = n[0] ;
+            contact->normal_c = n[1] ;
+            return ;
+        }
+    }
+
+    // The ends.
+    for (int e=0; e<2; ++e) {
+        float end[2] ;
+        end[axis] = at ;
+        end[other] = from+e ;
+        if (sweep_to_circle(p, d, end, radius, &t) && t < contact->t) {
+            float q[2] = {p[0]+t*d[0], p[1]+t*d[1]} ;
+            float n[2] = {q[0]-end[0], q[1]-end[1]} ;
+            float len = sqrtf(n[0]*n[0] + n[1]*n[1]) ;
+            if (len == 0.0f) continue ;
+            contact->t = t ;
+            contact->contact_r = end[0] ;
+            contact->contact_c = end[1] ;
+            contact->normal_r = n[0]/len ;
+            contact->normal_c = n[1]/len ;
+        }
+    }
+}
+
+/** Sweep a circle against the walls near one cell:  every wall that a
+ *  circle centered in the cell could touch.
+ *
+ *  @param m a maze.
+ *  @param r the row of the cell (which need not be in the maze).
+ *  @param c the column of the cell (which need not be in the maze).
+ *  @param reach how many cells beyond this one the circle can reach.
+ *  @param p the start of the center.
+ *  @param d the move of the center.
+ *  @param radius the radius of the circle.
+ *  @param contact updated with the earliest contact.
+ */
+static void sweep_near_cell(maze_t* m, int r, int c, int reach,
+        const float p[2], const float d[2], float radius,
+        maze_contact_t* contact) {
+    int r0 = r-reach-1 < -1 ? -1 : r-reach-1 ;
+    int r1 = r+reach < m->all_rows-1 ? r+reach : m->all_rows-1 ;
+    int c0 = c-reach-1 < -1 ? -1 : c-reach-1 ;
+    int c1 = c+reach < m->ncols-1 ? c+reach : m->ncols-1 ;
+    for (int i=r0; i<=r1; ++i) {
+        for (int j=c0; j<=c1; ++j) {
+            if (wall_at(m, i, j, NORTH)) {
+                sweep_wall(p, d, radius, 0, i+1, j, contact) ;
+            }
+            if (wall_at(m, i, j, EAST)) {
+                sweep_wall(p, d, radius, 1, j+1, i, contact) ;
+            }
+        }
+    }
+}
+
+/** Sweep a circle through a maze; see maze.h.  The cells the center
+ *  passes through are walked in order, as in a raycaster, and the walls
+ *  near each are tested.  A wall touched at some point of the move is
+ *  near the cell the center is in at that point, so the walk stops at
+ *  the first cell entered after the earliest contact found so far.
+ */
+bool sweep_circle(maze_t* m, float r, float c, float dr, float dc,
+        float radius, maze_contact_t* contact) {
+    float p[2] = {r, c} ;
+    float d[2] = {dr, dc} ;
+    int reach = (int)ceilf(radius) ;
+    contact->t = 1.0f ;
+
+    int cell[2] = {(int)floorf(r), (int)floorf(c)} ;
+    int step[2] ;
+    float delta[2], next[2] ;
+    for (int a=0; a<2; ++a) {
+        step[a] = d[a] < 0.0f ? -1 : 1 ;
+        delta[a] = d[a] == 0.0f ? INFINITY : fabsf(1.0f/d[a]) ;
+        next[a] = d[a] == 0.0f ? INFINITY :
+            (d[a] < 0.0f ? p[a]-cell[a] : cell[a]+1-p[a])*delta[a] ;
+    }
+
+    bool hit = false ;
+    float entered = 0.0f ;
+    while (entered <= contact->t) {
+        float before = contact->t ;
+        sweep_near_cell(m, cell[0], cell[1], reach, p, d, radius, contact) ;
+        hit = hit || contact->t < before ;
+
+        int a = next[0] < next[1] ? 0 : 1 ;
+        entered = next[a] ;
+        next[a] += delta[a] ;
+        cell[a] += step[a] ;
+    }
+
+    if (!hit) {
+        contact->t = 1.0f ;
+        contact->contact_r = contact->contact_c = 0.0f ;
+        contact->normal_r = contact->normal_c = 0.0f ;
+        contact->slide_r = contact->slide_c = 0.0f ;
+        return false ;
+    }
+
+    // The rest of the move, less the part into the wall.
+    float rest_r = (1.0f-contact->t)*dr ;
+    float rest_c = (1.0f-contact->t)*dc ;
+    float into = rest_r*contact->normal_r + rest_c*contact->normal_c ;
+    if (into > 0.0f) into = 0.0f ;
+    contact->slide_r = rest_r - into*contact->normal_r ;
+    contact->slide_c = rest_c - into*contact->normal_c ;
+    return true ;
+}
+
+/** Move a circle through a maze, sliding along walls; see maze.h.
+ */
+bool move_circle(maze_t* m, float* r, float* c, float dr, float dc,
+        float radius) {
+    bool touched = false ;
+    for (int i=0; i<MAX_SLIDES && (dr != 0.0f || dc != 0.0f); ++i) {
+        maze_contact_t contact ;
+        if (!sweep_circle(m, *r, *c, dr, dc, radius, &contact)) {
+            *r += dr ;
+            *c += dc ;
+            return touched ;
+        }
+        touched = true ;
+        *r += contact.t*dr + SKIN*contact.normal_r ;
+        *c += contact.t*dc + SKIN*contact.normal_c ;
+        dr = contact.slide_r ;
+        dc = contact.slide_c ;
+    }
+    return touched ;
+}
+
+/** Move many circles through a maze; see maze.h.
+ */
+int move_circles(maze_t* m, int n, float* r, float* c, const float* dr,
+        const float* dc, float radius, bool* touched) {
+    int ntouched = 0 ;
+    for (int i=0; i<n; ++i) {
+        bool t = move_circle(m, &r[i], &c[i], dr[i], dc[i], radius) ;
+        if (touched != NULL) touched[i] = t ;
+        ntouched += t ;
+    }
+    return ntouched ;
+}
+
+// ROUTE FUNCTIONS.
+
+/** Make the next-hop table of a maze toward a target cell; see maze.h.
+ *  Each cell is reached from the neighbor that discovered it, so its next
+ *  hop is the direction back to that neighbor.
+ */
+unsigned char* make_next_hops(maze_t* m, cell_t* target) {
+    size_t ncells = (size_t)m->all_rows*m->ncols ;
+    unsigned char* hops = calloc(ncells, sizeof(unsigned char)) ;
+    block_t queue_block ;
+    bool made = alloc_block(&queue_block, ncells*sizeof(size_t)) ;
+    assert(hops != NULL && made) ;
+    size_t* queue = queue_block.p ;
+    COUNT(bytes_allocated, (uint64_t)ncells*(1+sizeof(size_t))) ;
+
+    // Offsets into the cells of a step in each direction.
+    ptrdiff_t level = (ptrdiff_t)m->nrows*m->ncols ;
+    ptrdiff_t step[] = {m->ncols, 1, -(ptrdiff_t)m->ncols, -1, level, -level} ;
+    int ndirs = m->nlevels > 1 ? 6 : 4 ;
+
+    // The queue is a stack for the depth-first traversal of a tree.
+    bool tree = m->perfect ;
+    size_t head = 0, tail = 0 ;
+    size_t t = ((size_t)target->level*m->nrows + target->r)*m->ncols +
+        target->c ;
+    queue[tail++] = t ;
+    while (head < tail) {
+        size_t k = tree ? queue[--tail] : queue[head++] ;
+        int r = k/m->ncols ;
+        unsigned char p = CELL(m, r, k-(size_t)r*m->ncols) ;
+        unsigned char back = hops[k] ;
+        for (int i=0; i<ndirs; ++i) {
+            unsigned char d = directions[i] ;
+            if ((p & d) == 0) continue ;
+            size_t n = k + step[i] ;
+            if (tree ? d == back : n == t || hops[n] != EMPTY) continue ;
+            hops[n] = opposite(d) ;
+            queue[tail++] = n ;
+        }
+    }
+
+    free_block(&queue_block) ;
+    return hops ;
+}
+
+/** Dead-end filling follows a chain of filled cells back at most
+ *  FILL_WINDOW rows behind the sweep, whose pages were read recently.
+ */
+#define FILL_WINDOW 64
+
+// Whether a cell is filled, and filling it.
+#define IS_FILLED(f, k) ((f)[(k) >> 6] >> ((k) & 63) & 1)
+#define FILL(f, k) ((f)[(k) >> 6] |= 1ull << ((k) & 63))
+
+/** Find the one passage of a cell to a neighbor that is not filled, if
+ *  it is a dead end.
+ *
+ *  @param p the passages of the cell.
+ *  @param k the offset of the cell.
+ *  @param filled the filled cells.
+ *  @param step the offset of a step in each direction.
+ *  @param ndirs the number of directions to look in.
+ *  @param next set to the offset of the neighbor, or NO_LINK if there is
+ *      none.
+ *
+ *  @return true if the cell has at most one such passage.
+ */
+static bool find_dead_end(unsigned char p, size_t k, const uint64_t* filled,
+        const ptrdiff_t* step, int ndirs, size_t* next) {
+    *next = NO_LINK ;
+    for (int i=0; i<ndirs; ++i) {
+        if (!(p & directions[i])) continue ;
+        size_t n = k + step[i] ;
+        if (IS_FILLED(filled, n)) continue ;
+        if (*next != NO_LINK) return false ;
+        *next = n ;
+    }
+    return true ;
+}
+
+// Each byte of a word of cells set to a passage mask.
+#define BYTES(x) ((x)*0x0101010101010101ULL)
+
+/** Load a word of 8 cells.
+ */
+static inline uint64_t load_cells(const unsigned char* p) {
+    uint64_t x ;
+    memcpy(&x, p, sizeof(x)) ;
+    return x ;
+}
+
+/** Check that the passages of a row all lead to cells on the maze that
+ *  have passages back, as those of a damaged maze file may not.  Each
+ *  pair of neighbors is compared from the cell to the west, south or
+ *  below, so that checking every row checks every passage.  Cells are
+ *  checked 8 to a word; shifting a word moves a cell's passage to the
+ *  east, north or up onto the bit of its neighbor's passage back, and
+ *  the bits shifted in from the next cell are masked off.
+ *
+ *  @param m a maze.
+ *  @param cells the cells of the maze, row by row.
+ *  @param r the row, counting the rows of all levels.
+ *
+ *  @return true if the passages of the row are all sound.
+ */
+static bool check_row(maze_t* m, const unsigned char* cells, int r) {
+    int ncols = m->ncols, level_r = r%m->nrows ;
+    const unsigned char* row = cells + (size_t)r*ncols ;
+    const unsigned char* north = level_r < m->nrows-1 ? row+ncols : NULL ;
+    const unsigned char* up = r+m->nrows < m->all_rows ?
+        row + (size_t)m->nrows*ncols : NULL ;
+
+    // The passages no cell of the row may have.  A row with no row to
+    // the north or above is compared with itself, which finds a passage
+    // that way as one with no passage back.
+    unsigned char off = ~(NORTH|EAST|SOUTH|WEST|UP|DOWN) ;
+    if (level_r == 0) off |= SOUTH ;
+    if (r < m->nrows) off |= DOWN ;
+    if (north == NULL) {
+        off |= NORTH ;
+        north = row ;
+    }
+    if (up == NULL) {
+        off |= UP ;
+        up = row ;
+    }
+
+    uint64_t bad = (row[0] & WEST) | (row[ncols-1] & EAST) ;
+    int c = 0 ;
+    for (; c+9 <= ncols; c+=8) {
+        uint64_t x = load_cells(row+c) ;
+        bad |= (x & BYTES(off)) |
+            ((x ^ load_cells(row+c+1) >> 2) & BYTES(EAST)) |
+            ((x ^ load_cells(north+c) >> 2) & BYTES(NORTH) & ~BYTES(off)) |
+            ((x ^ load_cells(up+c) >> 1) & BYTES(UP) & ~BYTES(off)) ;
+    }
+    for (; c<ncols; ++c) {
+        unsigned char x = row[c] ;
+        bad |= (x & off) | ((x ^ north[c] >> 2) & NORTH & ~off) |
+            ((x ^ up[c] >> 1) & UP & ~off) ;
+        if (c+1 < ncols) bad |= (x ^ row[c+1] >> 2) & EAST ;
+    }
+    return bad == 0 ;
+}
+
+/** Fill the dead ends of a maze; see maze.h.  Each pass sweeps the cells
+ *  in order, filling each dead end it comes to.  A dead end's neighbor
+ *  later in the sweep is reached by the sweep itself; one earlier, which
+ *  filling may have made a dead end, is filled at once if it is within
+ *  FILL_WINDOW rows, and otherwise left for the next pass.  The rows are
+ *  swept in blocks of FILL_WINDOW, and a pass sweeps only the blocks with
+ *  a cell that filling may have made a dead end, so later passes read
+ *  little.  Words of cells that are all filled are skipped without
+ *  reading their passages.
+ *
+ *  The first pass reaches every row in order before anything in it is
+ *  filled, and checks the row's passages then, before any step is taken
+ *  from it, so that a damaged maze file cannot lead a step out of the
+ *  maze.
+ */
+uint64_t* fill_dead_ends(maze_t* m, maze_fill_t* stats) {
+    *stats = (maze_fill_t){0} ;
+    uint64_t start_ns = now_ns() ;
+    struct rusage usage ;
+    getrusage(RUSAGE_SELF, &usage) ;
+    long faults = usage.ru_majflt, blocks = usage.ru_inblock ;
+
+    size_t ncells = (size_t)m->all_rows*m->ncols ;
+    size_t nwords = (ncells+63)/64 ;
+    size_t nblocks = (m->all_rows+FILL_WINDOW-1)/FILL_WINDOW ;
+    uint64_t* filled = calloc(nwords, sizeof(uint64_t)) ;
+    bool* dirty = malloc(nblocks*sizeof(bool)) ;
+    bool* next_dirty = calloc(nblocks, sizeof(bool)) ;
+    if (filled == NULL || dirty == NULL || next_dirty == NULL) {
+        free(filled) ;
+        free(dirty) ;
+        free(next_dirty) ;
+        return NULL ;
+    }
+    memset(dirty, true, nblocks*sizeof(bool)) ;
+    COUNT(bytes_allocated, nwords*sizeof(uint64_t) + 2*nblocks*sizeof(bool)) ;
+
+    // Read mapped cells ahead, and let the kernel drop them once read.
+    const unsigned char* cells = get_row_span(m, 0, m->all_rows) ;
+    if (m->read_only) madvise(m->cells_block.p, m->cells_block.bytes,
+            MADV_SEQUENTIAL) ;
+
+    ptrdiff_t level = (ptrdiff_t)m->nrows*m->ncols ;
+    ptrdiff_t step[] = {m->ncols, 1, -(ptrdiff_t)m->ncols, -1, level, -level} ;
+    int ndirs = m->nlevels > 1 ? 6 : 4 ;
+    size_t window = (size_t)FILL_WINDOW*m->ncols ;
+    size_t start = row_major_index(m, m->start) ;
+    size_t end = row_major_index(m, m->end) ;
+
+    // The cells of the rows checked so far.
+    size_t checked = 0 ;
+
+    size_t changed ;
+    do {
+        changed = 0 ;
+        for (size_t b=0; b<nblocks && !stats->corrupt; ++b) {
+            if (!dirty[b]) continue ;
+            dirty[b] = false ;
+            size_t first = b*window ;
+            size_t last = first+window < ncells ? first+window : ncells ;
+            for (size_t k=first; k<last; ++k) {
+                if (k == checked) {
+                    if (!check_row(m, cells, k/m->ncols)) {
+                        stats->corrupt = true ;
+                        break ;
+                    }
+                    checked += m->ncols ;
+                }
+                if ((k & 63) == 0 && k+64 <= last &&
+                        filled[k >> 6] == UINT64_MAX) {
+                    k += 63 ;
+                    continue ;
+                }
+                if (IS_FILLED(filled, k) || k == start || k == end) continue ;
+                stats->bytes_read++ ;
+                size_t next ;
+                if (!find_dead_end(cells[k], k, filled, step, ndirs, &next)) {
+                    continue ;
+                }
+
+                // Fill the cell, and the chain of dead ends it leaves
+                // behind in the window.  A neighbor the chain stops at may
+                // be a dead end now, so its block is swept again:  later
+                // in this pass if it is ahead, and in the next if not.
+                size_t x = k ;
+                while (true) {
+                    FILL(filled, x) ;
+                    changed++ ;
+                    if (next == NO_LINK || next == start || next == end) break ;
+                    if (next > k) {
+                        if (next/window > b) dirty[next/window] = true ;
+                        break ;
+                    }
+                    if (next+window < k) {
+                        next_dirty[next/window] = true ;
+                        break ;
+                    }
+                    x = next ;
+                    stats->bytes_read++ ;
+                    if (!find_dead_end(cells[x], x, filled, step, ndirs,
+                                &next)) {
+                        break ;
+                    }
+                }
+            }
+        }
+        stats->passes++ ;
+        stats->filled += changed ;
+        bool* swept = dirty ;
+        dirty = next_dirty ;
+        next_dirty = swept ;
+    } while (changed > 0 && !stats->corrupt) ;
+    free(dirty) ;
+    free(next_dirty) ;
+    if (stats->corrupt) {
+        free(filled) ;
+        return NULL ;
+    }
+
+    // What is left is the route, and any loops.
+    for (size_t w=0; w<nwords; ++w) filled[w] = ~filled[w] ;
+    if (ncells % 64 != 0) filled[nwords-1] &= (1ull << ncells%64) - 1 ;
+    stats->left = ncells - stats->filled ;
+
+    getrusage(RUSAGE_SELF, &usage) ;
+    stats->major_faults = usage.ru_majflt - faults ;
+    stats->bytes_in = (uint64_t)(usage.ru_inblock - blocks)*512 ;
+    stats->ns = now_ns() - start_ns ;
+    return filled ;
+}
+
+// MAZE FILE FUNCTIONS.
+
+/** Write all of a buffer to a file, however many writes it takes.
+ *
+ *  @param fd the file.
+ *  @param buf the buffer.
+ *  @param n the number of bytes to write.
+ *
+ *  @return true if they were all written, false otherwise.
+ */
+static bool write_all(int fd, const void* buf, size_t n) {
+    const char* p = buf ;
+    while (n > 0) {
+        ssize_t w = write(fd, p, n) ;
+        if (w < 0) return false ;
+        p += w ;
+        n -= w ;
+    }
+    return true ;
+}
+
+/** Write a maze to a file; see maze.h.
+ */
+bool write_maze_file(maze_t* m, int fd) {
+    maze_file_header_t h = {
+        MAZE_FILE_MAGIC, m->nrows, m->ncols, m->nlevels,
+        m->perfect ? MAZE_FILE_PERFECT : 0,
+        row_major_index(m, m->start), row_major_index(m, m->end)
+    } ;
+    char buf[MAZE_FILE_HEADER] = {0} ;
+    memcpy(buf, &h, sizeof(h)) ;
+
+    return write_all(fd, buf, sizeof(buf)) &&
+        write_all(fd, get_row_span(m, 0, m->all_rows),
+                (size_t)m->all_rows*m->ncols) ;
+}
+
+/** Map a maze file; see maze.h.
+ */
+maze_t* map_maze_file(int fd) {
+    struct stat st ;
+    if (fstat(fd, &st) < 0 || (size_t)st.st_size < MAZE_FILE_HEADER) {
+        return NULL ;
+    }
+    size_t bytes = st.st_size ;
+    unsigned char* base = mmap(NULL, bytes, PROT_READ, MAP_SHARED, fd, 0) ;
+    if (base == MAP_FAILED) return NULL ;
+
+    // Check the header against itself and the size of the file.
+    maze_file_header_t h ;
+    memcpy(&h, base, sizeof(h)) ;
+    size_t ncells ;
+    bool ok = memcmp(h.magic, MAZE_FILE_MAGIC, sizeof(MAZE_FILE_MAGIC)) == 0
+        && h.nrows > 0 && h.ncols > 0 && h.nlevels > 0
+        && (size_t)h.nlevels*h.nrows <= MAX_ROWS
+        && !__builtin_mul_overflow((size_t)h.nlevels*h.nrows,
+                (size_t)h.ncols, &ncells)
+        && bytes-MAZE_FILE_HEADER >= ncells
+        && h.start < ncells && h.end < ncells ;
+    maze_t* m = ok ? calloc(1, sizeof(maze_t)) : NULL ;
+    if (m == NULL) {
+        munmap(base, bytes) ;
+        return NULL ;
+    }
+
+    m->nrows = h.nrows ;
+    m->ncols = h.ncols ;
+    m->nlevels = h.nlevels ;
+    m->all_rows = h.nlevels*h.nrows ;
+    int row_step[] = {1, 0, -1, 0, h.nrows, -h.nrows} ;
+    memcpy(m->row_step, row_step, sizeof(row_step)) ;
+    m->layout = MAZE_ROW_MAJOR ;
+    m->perfect = (h.flags & MAZE_FILE_PERFECT) != 0 ;
+    m->read_only = true ;
+    pthread_mutex_init(&m->rows_lock, NULL) ;
+
+    // The cells stay in the mapping, which the maze frees.
+    m->cells_block = (block_t){base, bytes, true} ;
+    m->cells = base + MAZE_FILE_HEADER ;
+    m->npages = (ncells+CELL_PAGE-1) >> CELL_PAGE_BITS ;
+    m->cell_pages = calloc(m->npages, sizeof(cell_t*)) ;
+    if (m->cell_pages == NULL) {
+        free_maze(m) ;
+        return NULL ;
+    }
+    COUNT(bytes_allocated, sizeof(maze_t) + m->npages*sizeof(cell_t*)) ;
+
+    int start_row = h.start/h.ncols, end_row = h.end/h.ncols ;
+    m->start = get_level_cell(m, start_row/h.nrows, start_row%h.nrows,
+            h.start%h.ncols) ;
+    m->end = get_level_cell(m, end_row/h.nrows, end_row%h.nrows,
+            h.end%h.ncols) ;
+    return m ;
+}
+
+// EDITING FUNCTIONS.
+//
+// Edits keep a spanning forest of the passages in a link-cut forest (see
+// link_node_t), which is made the first time it is needed from the
+// passages of the maze:  for a perfect maze, the forest is the tree that
+// build_prim grew.  Opening a wall between two trees links them; opening
+// one within a tree makes a passage that is not in the forest.  Closing a
+// passage that is not in the forest changes nothing else, and closing one
+// that is cuts its tree in two, after which a passage that joins the two
+// halves, if there is one, takes its place.  Connection and path length
+// are answered from the forest, in amortized logarithmic time.
+
+/** Check whether a node is the root of its splay tree.
+ */
+static bool is_splay_root(link_node_t* t, size_t x) {
+    size_t p = t[x].parent ;
+    return p == NO_LINK || (t[p].child[0] != x && t[p].child[1] != x) ;
+}
+
+/** Push a node's flip down to its children.
+ */
+static void push_flip(link_node_t* t, size_t x) {
+    if (!t[x].flip) return ;
+    size_t left = t[x].child[0] ;
+    t[x].child[0] = t[x].child[1] ;
+    t[x].child[1] = left ;
+    for (int i=0; i<2; ++i) {
+        if (t[x].child[i] != NO_LINK) t[t[x].child[i]].flip ^= true ;
+    }
+    t[x].flip = false ;
+}
+
+/** Recount the nodes of a node's splay tree from those of its children.
+ */
+static void update_size(link_node_t* t, size_t x) {
+    t[x].size = 1 ;
+    for (int i=0; i<2; ++i) {
+        if (t[x].child[i] != NO_LINK) t[x].size += t[t[x].child[i]].size ;
+    }
+}
+
+/** Rotate a node above its parent in their splay tree.  Both must have
+ *  had their flips pushed.
+ */
+static void rotate_link(link_node_t* t, size_t x) {
+    size_t p = t[x].parent, g = t[p].parent ;
+    int side = t[p].child[1] == x ;
+    size_t inner = t[x].child[!side] ;
+    if (!is_splay_root(t, p)) t[g].child[t[g].child[1] == p] = x ;
+    t[x].parent = g ;
+    t[x].child[!side] = p ;
+    t[p].parent = x ;
+    t[p].child[side] = inner ;
+    if (inner != NO_LINK) t[inner].parent = p ;
+    update_size(t, p) ;
+    update_size(t, x) ;
+}
+
+/** Splay a node to the root of its splay tree.  Flips are pushed down
+ *  from each grandparent on the way, so that the rotations see the true
+ *  sides of the nodes they move.
+ */
+static void splay_link(link_node_t* t, size_t x) {
+    while (!is_splay_root(t, x)) {
+        size_t p = t[x].parent ;
+        if (!is_splay_root(t, p)) push_flip(t, t[p].parent) ;
+        push_flip(t, p) ;
+        push_flip(t, x) ;
+        if (!is_splay_root(t, p)) {
+            size_t g = t[p].parent ;
+            bool zigzig = (t[g].child[1] == p) == (t[p].child[1] == x) ;
+            rotate_link(t, zigzig ? p : x) ;
+        }
+        rotate_link(t, x) ;
+    }
+    push_flip(t, x) ;
+}
+
+/** Make the path from a node to the root of its tree a single splay tree,
+ *  with the node at its root.
+ */
+static void access_link(link_node_t* t, size_t x) {
+    size_t below = NO_LINK ;
+    for (size_t y=x; y != NO_LINK; y=t[y].parent) {
+        splay_link(t, y) ;
+        t[y].child[1] = below ;
+        update_size(t, y) ;
+        below = y ;
+    }
+    splay_link(t, x) ;
+}
+
+/** Make a node the root of its tree.
+ */
+static void make_root_link(link_node_t* t, size_t x) {
+    access_link(t, x) ;
+    t[x].flip ^= true ;
+}
+
+/** Find the root of a node's tree.  The root changes only when another
+ *  node is made the root.
+ */
+static size_t find_root_link(link_node_t* t, size_t x) {
+    access_link(t, x) ;
+    size_t r = x ;
+    push_flip(t, r) ;
+    while (t[r].child[0] != NO_LINK) {
+        r = t[r].child[0] ;
+        push_flip(t, r) ;
+    }
+    splay_link(t, r) ;
+    return r ;
+}
+
+/** Link the trees of two nodes by an edge between them.
+ *
+ *  @return true if they were linked, false if they were in the same tree
+ *      already.
+ */
+static bool link_nodes(link_node_t* t, size_t x, size_t y) {
+    make_root_link(t, x) ;
+    if (find_root_link(t, y) == x) return false ;
+    t[x].parent = y ;
+    return true ;
+}
+
+/** Cut the edge between two nodes, if it is in the forest.
+ *
+ *  @return true if it was cut, false if it is not in the forest.
+ */
+static bool cut_nodes(link_node_t* t, size_t x, size_t y) {
+    make_root_link(t, x) ;
+    access_link(t, y) ;
+    if (t[y].size != 2 || t[y].child[0] != x) return false ;
+    t[y].child[0] = NO_LINK ;
+    t[x].parent = NO_LINK ;
+    update_size(t, y) ;
+    return true ;
+}
+
+/** Make the link-cut forest of a maze, if it has not been made.  The
+ *  forest is grown breadth first from each cell not yet in it, with each
+ *  cell linked to the one it was reached from by the parent of its own
+ *  splay tree, so every path starts out as a single node.
+ *
+ *  @param m a maze.
+ */
+static void make_links(maze_t* m) {
+    if (m->links != NULL) return ;
+    size_t ncells = (size_t)m->all_rows*m->ncols ;
+    block_t queue_block ;
+    bool made = alloc_block(&m->links_block, ncells*sizeof(link_node_t)) &&
+        alloc_block(&queue_block, ncells*sizeof(size_t)) ;
+    assert(made) ;
+    link_node_t* t = m->links_block.p ;
+    size_t* queue = queue_block.p ;
+    COUNT(bytes_allocated, ncells*(sizeof(link_node_t)+sizeof(size_t))) ;
+
+    // Nodes not yet in the forest have a size of 0.
+    for (size_t k=0; k<ncells; ++k) {
+        t[k] = (link_node_t){NO_LINK, {NO_LINK, NO_LINK}, 0, false, 0} ;
+    }
+
+    const unsigned char* cells = get_row_span(m, 0, m->all_rows) ;
+    ptrdiff_t level = (ptrdiff_t)m->nrows*m->ncols ;
+    ptrdiff_t step[] = {m->ncols, 1, -(ptrdiff_t)m->ncols, -1, level, -level} ;
+    size_t ends = 0 ;
+    m->ntrees = 0 ;
+    for (size_t first=0; first<ncells; ++first) {
+        if (t[first].size != 0) continue ;
+        m->ntrees++ ;
+        t[first].size = 1 ;
+        size_t head = 0, tail = 0 ;
+        queue[tail++] = first ;
+        while (head < tail) {
+            size_t k = queue[head++] ;
+            for (int i=0; i<6; ++i) {
+                if (!(cells[k] & directions[i])) continue ;
+                ends++ ;
+                size_t n = k + step[i] ;
+                if (t[n].size != 0) continue ;
+                t[n].size = 1 ;
+                t[n].parent = k ;
+                queue[tail++] = n ;
+            }
+        }
+    }
+    free_block(&queue_block) ;
+
+    // Each passage has two ends, and each tree one passage fewer than
+    // cells.
+    m->nextra = ends/2 - (ncells - m->ntrees) ;
+    m->links = t ;
+}
+
+/** Find the neighbor across a wall or passage to be edited.
+ *
+ *  @param m a maze.
+ *  @param c a cell in <code>m</code>.
+ *  @param d a direction.
+ *  @param k set to the offset of <code>c</code> in a row-major copy of
+ *      the cells.
+ *  @param n set to the offset of the neighbor.
+ *
+ *  @return the index of <code>d</code> in directions, or -1 if it is not
+ *      a direction or <code>c</code> has no neighbor that way.
+ */
+static int edit_neighbor(maze_t* m, cell_t* c, unsigned char d, size_t* k,
+        size_t* n) {
+    int i = 0 ;
+    while (i < 6 && directions[i] != d) ++i ;
+    bool inside[] = {
+        c->r < m->nrows-1, c->c < m->ncols-1, c->r > 0, c->c > 0,
+        c->level < m->nlevels-1, c->level > 0
+    } ;
+    if (i == 6 || !inside[i]) return -1 ;
+    *k = row_major_index(m, c) ;
+    *n = *k + (ptrdiff_t)m->row_step[i]*m->ncols + dir_dc[i] ;
+    return i ;
+}
+
+/** Open or close the passage from a cell in the cells of a maze and in
+ *  the row-major copy of them, if there is one.
+ *
+ *  @param m a maze.
+ *  @param k the offset of the cell in a row-major copy of the cells.
+ *  @param i the index of the direction of the passage.
+ *  @param open whether to open the passage rather than close it.
+ */
+static void set_passage(maze_t* m, size_t k, int i, bool open) {
+    int r = k/m->ncols, c = k%m->ncols ;
+    int nr = r+m->row_step[i], nc = c+dir_dc[i] ;
+    unsigned char d = directions[i], back = directions[dir_opposite[i]] ;
+    unsigned char* cells[] = {&CELL(m, r, c), &CELL(m, nr, nc), NULL, NULL} ;
+    if (m->rows != NULL) {
+        cells[2] = &m->rows[k] ;
+        cells[3] = &m->rows[(size_t)nr*m->ncols + nc] ;
+    }
+    for (int j=0; j<4 && cells[j] != NULL; ++j) {
+        unsigned char bit = j%2 == 0 ? d : back ;
+        if (open) *cells[j] |= bit ;
+        else *cells[j] &= ~bit ;
+    }
+}
+
+/** Look for a passage to take the place of one just cut from the forest,
+ *  and link the two trees by it if there is one.  Both trees are searched
+ *  breadth first by turns, one cell at a time, for a passage into the
+ *  other, so that the search ends after about twice the cells of the
+ *  smaller tree if there is none.  A cell reached by a passage is in the
+ *  other tree if it has the other tree's root, since searching moves no
+ *  roots.
+ *
+ *  @param m a maze.
+ *  @param x a cell of one tree.
+ *  @param y a cell of the other.
+ *
+ *  @return true if the trees were linked, false if nothing joins them.
+ */
+static bool find_replacement(maze_t* m, size_t x, size_t y) {
+    link_node_t* t = m->links ;
+    const unsigned char* cells = get_row_span(m, 0, m->all_rows) ;
+    ptrdiff_t level = (ptrdiff_t)m->nrows*m->ncols ;
+    ptrdiff_t step[] = {m->ncols, 1, -(ptrdiff_t)m->ncols, -1, level, -level} ;
+
+    size_t root[] = {find_root_link(t, x), find_root_link(t, y)} ;
+    size_t* queue[2] ;
+    size_t head[] = {0, 0}, tail[] = {1, 1}, cap[] = {64, 64} ;
+    for (int s=0; s<2; ++s) {
+        queue[s] = malloc(cap[s]*sizeof(size_t)) ;
+        assert(queue[s] != NULL) ;
+    }
+    queue[0][0] = x ;
+    queue[1][0] = y ;
+    t[x].seen |= 1 ;
+    t[y].seen |= 2 ;
+
+    size_t from = NO_LINK, to = NO_LINK ;
+    int s = 0 ;
+    while (from == NO_LINK && head[s] < tail[s]) {
+        size_t k = queue[s][head[s]++] ;
+        for (int i=0; i<6 && from == NO_LINK; ++i) {
+            if (!(cells[k] & directions[i])) continue ;
+            size_t n = k + step[i] ;
+            if (t[n].seen & (1 << s)) continue ;
+            if (find_root_link(t, n) == root[!s]) {
+                from = k ;
+                to = n ;
+                break ;
+            }
+            t[n].seen |= 1 << s ;
+            if (tail[s] == cap[s]) {
+                cap[s] *= 2 ;
+                queue[s] = realloc(queue[s], cap[s]*sizeof(size_t)) ;
+                assert(queue[s] != NULL) ;
+            }
+            queue[s][tail[s]++] = n ;
+        }
+        if (head[!s] < tail[!s]) s = !s ;
+        else break ;
+    }
+
+    for (int side=0; side<2; ++side) {
+        for (size_t j=0; j<tail[side]; ++j) t[queue[side][j]].seen = 0 ;
+        free(queue[side]) ;
+    }
+    return from != NO_LINK && link_nodes(t, from, to) ;
+}
+
+/** Remove a wall; see maze.h.
+ */
+bool remove_wall(maze_t* m, cell_t* c, unsigned char d) {
+    size_t k, n ;
+    int i = edit_neighbor(m, c, d, &k, &n) ;
+    if (m->read_only || i < 0 || (MAZECELL(m, c) & d) != 0) return false ;
+    make_links(m) ;
+    set_passage(m, k, i, true) ;
+    if (link_nodes(m->links, k, n)) m->ntrees-- ;
+    else m->nextra++ ;
+    m->perfect = m->ntrees == 1 && m->nextra == 0 ;
+    return true ;
+}
+
+/** Add a wall; see maze.h.
+ */
+bool add_wall(maze_t* m, cell_t* c, unsigned char d) {
+    size_t k, n ;
+    int i = edit_neighbor(m, c, d, &k, &n) ;
+    if (m->read_only || i < 0 || (MAZECELL(m, c) & d) == 0) return false ;
+    make_links(m) ;
+    set_passage(m, k, i, false) ;
+    if (!cut_nodes(m->links, k, n)) m->nextra-- ;
+    else if (find_replacement(m, k, n)) m->nextra-- ;
+    else m->ntrees++ ;
+    m->perfect = m->ntrees == 1 && m->nextra == 0 ;
+    return true ;
+}
+
+/** Check whether two cells are connected; see maze.h.
+ */
+bool is_connected(maze_t* m, cell_t* a, cell_t* b) {
+    make_links(m) ;
+    return find_root_link(m->links, row_major_index(m, a)) ==
+        find_root_link(m->links, row_major_index(m, b)) ;
+}
+
+/** Get the length of a path between two cells; see maze.h.
+ */
+long get_path_length(maze_t* m, cell_t* a, cell_t* b) {
+    make_links(m) ;
+    link_node_t* t = m->links ;
+    size_t x = row_major_index(m, a), y = row_major_index(m, b) ;
+    make_root_link(t, x) ;
+    if (find_root_link(t, y) != x) return -1 ;
+    access_link(t, y) ;
+    return t[y].size-1 ;
+}
+
+// COUNTER FUNCTIONS.
+
+#ifndef MAZE_NO_COUNTERS
+
+/** A thread's counters.  Each thread that counts takes a block on its
+ *  first count and gives it back when it exits, and the next thread to
+ *  count takes it over, adding to the counts already there.  The list of
+ *  blocks only grows, at its head, so it can be read without a lock.
+ */
+typedef struct _counter_block_t {
+    maze_counters_t counts ;
+    int owned ;
+    struct _counter_block_t* next ;
+} counter_block_t ;
+
+static counter_block_t* counter_blocks = NULL ;
+static __thread counter_block_t* thread_block = NULL ;
+static pthread_key_t counter_key ;
+static pthread_once_t counter_key_once = PTHREAD_ONCE_INIT ;
+
+// Counts made when there is no memory for a block; these are lost.
+static maze_counters_t lost_counts ;
+
+/** Give a thread's counter block back when the thread exits.
+ *
+ *  @param block the block.
+ */
+static void release_counters(void* block) {
+    __atomic_store_n(&((counter_block_t*)block)->owned, 0, __ATOMIC_RELEASE) ;
+}
+
+/** Make the key that gives counter blocks back.
+ */
+static void make_counter_key() {
+    pthread_key_create(&counter_key, release_counters) ;
+}
+
+/** Get the calling thread's counters, taking a block for them if it has
+ *  none yet.
+ *
+ *  @return the counters.
+ */
+static maze_counters_t* thread_counters() {
+    if (thread_block != NULL) return &thread_block->counts ;
+
+    pthread_once(&counter_key_once, make_counter_key) ;
+
+    counter_block_t* block ;
+    for (block = __atomic_load_n(&counter_blocks, __ATOMIC_ACQUIRE);
+            block != NULL; block = block->next) {
+        int free = 0 ;
+        if (__atomic_compare_exchange_n(&block->owned, &free, 1, false,
+                    __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) break ;
+    }
+
+    if (block == NULL) {
+        block = calloc(1, sizeof(counter_block_t)) ;
+        if (block == NULL) return &lost_counts ;
+        block->owned = 1 ;
+        block->next = __atomic_load_n(&counter_blocks, __ATOMIC_RELAXED) ;
+        while (!__atomic_compare_exchange_n(&counter_blocks, &block->next,
+                    block, true, __ATOMIC_RELEASE, __ATOMIC_RELAXED)) ;
+    }
+
+    pthread_setspecific(counter_key, block) ;
+    thread_block = block ;
+    return &block->counts ;
+}
+
+#endif
+
+/** Get the time in nanoseconds.
+ *
+ *  @return nanoseconds of the monotonic clock.
+ */
+static uint64_t now_ns() {
+    struct timespec now ;
+    clock_gettime(CLOCK_MONOTONIC, &now) ;
+    return now.tv_sec*1000000000ull + now.tv_nsec ;
+}
+
+/** Read the counters; see maze.h.
+ */
+void get_maze_counters(maze_counters_t* counts) {
+    *counts = (maze_counters_t){0} ;
+#ifndef MAZE_NO_COUNTERS
+    for (counter_block_t* block =
+                __atomic_load_n(&counter_blocks, __ATOMIC_ACQUIRE);
+            block != NULL; block = block->next) {
+        maze_counters_t* k = &block->counts ;
+#define SUM(field) counts->field += __atomic_load_n(&k->field, __ATOMIC_RELAXED)
+        SUM(mazes) ;
+        SUM(cells_generated) ;
+        SUM(walls_removed) ;
+        SUM(stale_edges) ;
+        SUM(setup_ns) ;
+        SUM(build_ns) ;
+        SUM(has_path_calls) ;
+        SUM(bytes_allocated) ;
+#undef SUM
+        uint64_t peak = __atomic_load_n(&k->frontier_peak, __ATOMIC_RELAXED) ;
+        if (peak > counts->frontier_peak) counts->frontier_peak = peak ;
+    }
+#endif
+}
+
+/** Write the counters as JSON; see maze.h.
+ */
+void write_maze_counters(FILE* f) {
+    maze_counters_t k ;
+    get_maze_counters(&k) ;
+#ifndef MAZE_NO_COUNTERS
+    bool enabled = true ;
+#else
+    bool enabled = false ;
+#endif
+    fprintf(f, "{\"enabled\": %s, \"mazes\": %llu, "
+            "\"cells_generated\": %llu, \"walls_removed\": %llu, "
+            "\"frontier_peak\": %llu, \"stale_edges\": %llu, "
+            "\"setup_ns\": %llu, \"build_ns\": %llu, "
+            "\"has_path_calls\": %llu, \"bytes_allocated\": %llu}",
+            enabled ? "true" : "false",
+            (unsigned long long)k.mazes, (unsigned long long)k.cells_generated,
+            (unsigned long long)k.walls_removed,
+            (unsigned long long)k.frontier_peak,
+            (unsigned long long)k.stale_edges, (unsigned long long)k.setup_ns,
+            (unsigned long long)k.build_ns,
+            (unsigned long long)k.has_path_calls,
+            (unsigned long long)k.bytes_allocated) ;
+}
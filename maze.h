@@ -5,6 +5,14 @@
  *  represent cells; such objects should only ever be obtained by invoking
  *  functions defined here.
  *
+ *  A maze may also have several levels, each a grid of the same size, with
+ *  passages up and down between cells in the same row and column of
+ *  neighboring levels.  Where a function below takes or gives the rows of
+ *  a maze as a whole (bulk access, collision and routes), the levels are
+ *  stacked one after another, so that row <code>r</code> of level
+ *  <code>l</code> is row <code>l*get_nrows(m) + r</code>; there is always
+ *  a wall between the last row of one level and the first of the next.
+ *
  *  @author N. Danner.
  */
 
@@ -12,6 +20,8 @@
 #define MAZE_H
 
 #include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
 
 /** The type of a cell.  Cells should not be created directly; only
  *  use <code>get_cell</code>.  Failure to do so may lead to unpredictable
@@ -20,6 +30,7 @@
 struct _cell_t {
     int r ;
     int c ;
+    int level ;
 } ;
 typedef struct _cell_t cell_t ;
 
@@ -32,6 +43,8 @@ typedef struct _maze_t maze_t ;
 #define EAST 0x2
 #define SOUTH 0x04
 #define WEST 0x08
+#define UP 0x10
+#define DOWN 0x20
 
 /** Test two cells for equality.
  *  
@@ -54,21 +67,208 @@ int cell_cmp(void* x, void* y) ;
  */
 cell_t* get_cell(maze_t* m, int r, int c) ;
 
+/** Get a cell from a maze for a given level, row and column.
+ *
+ *  @param m the maze.
+ *  @param level the level of the desired cell, from 0 to
+ *      <code>get_nlevels(m)-1</code>.
+ *  @param r the row of the desired cell.
+ *  @param c the column of the desired cell.
+ *
+ *  @return a <code>cell_t</code> object corresponding to <code>level</code>,
+ *  <code>r</code> and <code>c</code>.
+ */
+cell_t* get_level_cell(maze_t* m, int level, int r, int c) ;
+
 /** Make a maze of a given size.  The maze will initially have all walls
  *  present; then Prim's algorithm will be used to remove walls so that
  *  there is exactly one path between any two cells in the maze.  Prim's
  *  algorithm will choose walls to remove from the frontier at random,
  *  and the random number generator will be seeded with <code>seed</code>.
+ *  Each maze has its own random number generator and cells, so mazes may
+ *  be made on several threads at once.  Mazes may have more cells than an
+ *  int can count; the cells of large mazes are kept in huge pages where
+ *  the system has them.  Any positive size may be made, down to a single
+ *  cell, whose start and end are the same cell.
  *
  *  @param nrows the number of rows for the maze.
  *  @param ncols the number of columns for the maze.
  *  @param seed the seed for the random number generator used by Prim's
  *      algorithm to choose walls to remove.
  *
- *  @return the maze.
+ *  @return the maze, or <code>NULL</code> if <code>nrows</code> or
+ *      <code>ncols</code> is not positive or there is not enough memory
+ *      for the maze.
  */
 maze_t* make_maze(int nrows, int ncols, long seed) ;
 
+/** Ways of laying out the cells of a maze in memory.  The layout does not
+ *  change what maze is made from a seed, only how fast it is to get
+ *  around in.
+ */
+typedef enum _maze_layout_t {
+    /** Row by row.  Cells next to each other in a row are next to each
+     *  other in memory, but cells next to each other in a column are a
+     *  row apart.
+     */
+    MAZE_ROW_MAJOR,
+
+    /** In tiles of 256x256 cells, row by row, with the cells of each
+     *  tile in Z-order (Morton order), so that cells near each other in
+     *  any direction are usually near each other in memory.  The maze is
+     *  padded out to whole tiles.
+     */
+    MAZE_Z_ORDER
+} maze_layout_t ;
+
+/** Ways of building the passages of a maze.
+ */
+typedef enum _maze_algorithm_t {
+    /** Prim's algorithm, which grows the maze from a cell by opening
+     *  walls chosen at random from all around it.  Its mazes have many
+     *  short dead ends and no bias in any direction.
+     */
+    MAZE_PRIM,
+
+    /** A binary tree:  each cell has a passage north or east, chosen at
+     *  random.  Every cell has a path north and east to the top row, which
+     *  is one long passage, so the mazes are easy to solve going that way.
+     */
+    MAZE_BINARY_TREE,
+
+    /** A sidewinder:  each row is split at random into runs of cells
+     *  joined east, and each run has a passage north from one of its
+     *  cells, chosen at random.  The top row is one long passage.
+     */
+    MAZE_SIDEWINDER
+} maze_algorithm_t ;
+
+/** Options for making a maze.
+ */
+typedef struct _maze_opts_t {
+    /** How to lay out the cells.
+     */
+    maze_layout_t layout ;
+
+    /** The fraction of dead ends to braid, from 0 to 1.  After the maze
+     *  is made, each dead end is chosen with this probability to have a
+     *  wall to another of its neighbors removed, which makes a loop.  At 0
+     *  the maze is perfect; see <code>is_perfect</code>.
+     */
+    float braid ;
+
+    /** The number of levels; 0 is taken as 1.  The start is on the bottom
+     *  level (0) and the end on the top.  Cells take a byte each however
+     *  many levels there are, and a maze is made in time proportional to
+     *  its cells.
+     */
+    int nlevels ;
+
+    /** How to build the passages.  Binary trees and sidewinders are built
+     *  a row at a time from random numbers of each row's own, on several
+     *  threads for large mazes, many times as fast as Prim's algorithm,
+     *  but with the texture of their algorithms.  Their levels are joined
+     *  by a single shaft from each top row to the one below.
+     */
+    maze_algorithm_t algorithm ;
+} maze_opts_t ;
+
+/** Make a maze of a given size with options, as
+ *  <code>make_maze</code> does.  Large mazes are braided on several
+ *  threads at once, in time proportional to the number of cells; a maze
+ *  made from a seed with given options is the same however many threads
+ *  braid it.
+ *
+ *  @param nrows the number of rows for the maze.
+ *  @param ncols the number of columns for the maze.
+ *  @param seed the seed for the random number generator.
+ *  @param opts the options, or <code>NULL</code> for the defaults (those
+ *      of a <code>maze_opts_t</code> that is all zeros).
+ *
+ *  @return the maze, or <code>NULL</code> as for <code>make_maze</code>,
+ *      or if the levels together have more than 2^30 rows.
+ */
+maze_t* make_maze_opts(int nrows, int ncols, long seed,
+        const maze_opts_t* opts) ;
+
+/** The type of a maze being made a step at a time.
+ */
+typedef struct _maze_gen_t maze_gen_t ;
+
+/** Start making a maze a step at a time, so that making a large one can
+ *  be spread over many short steps between other work.  The maze made is
+ *  the same as <code>make_maze_opts</code> makes from the same arguments,
+ *  however it is split into steps.
+ *
+ *  @param nrows the number of rows for the maze.
+ *  @param ncols the number of columns for the maze.
+ *  @param seed the seed for the random number generator.
+ *  @param opts the options, or <code>NULL</code> for the defaults.
+ *
+ *  @return the maze being made, which has its cells and its start and end
+ *      but no passages yet, or <code>NULL</code> as for
+ *      <code>make_maze_opts</code>.
+ */
+maze_gen_t* start_maze(int nrows, int ncols, long seed,
+        const maze_opts_t* opts) ;
+
+/** Make some more of a maze.  A step stops once it has done the given
+ *  work or taken the given time, whichever comes first, or the maze is
+ *  done.  The time is checked every few thousand cells, and braiding is
+ *  done a row at a time, so a step can go a little past either limit.
+ *
+ *  @param g a maze being made.
+ *  @param max_cells the most work to do, in cells joined to the maze or
+ *      braided, or 0 for no limit.
+ *  @param max_us the most time to take, in microseconds, or 0 for no
+ *      limit.
+ *
+ *  @return <code>true</code> if the maze is done, <code>false</code> if
+ *      there is more to do.
+ */
+bool step_maze(maze_gen_t* g, size_t max_cells, long max_us) ;
+
+/** Get the maze being made.  Between steps it can be used like any other
+ *  maze, but not edited:  the cells joined so far are connected by
+ *  exactly one path between any two, those not yet joined have no
+ *  passages, and there is never a passage on one side of a wall only.  It
+ *  is not perfect until it is done.
+ *
+ *  @param g a maze being made.
+ *
+ *  @return the maze, which belongs to <code>g</code> until it is done.
+ */
+maze_t* get_gen_maze(maze_gen_t* g) ;
+
+/** Get how much of a maze has been made.
+ *
+ *  @param g a maze being made.
+ *
+ *  @return the fraction of the work done, from 0 to 1.
+ */
+float get_gen_progress(maze_gen_t* g) ;
+
+/** Finish making a maze, in one step with no limit.
+ *
+ *  @param g a maze being made, which is freed.
+ *
+ *  @return the maze, which is freed by <code>free_maze</code>.
+ */
+maze_t* finish_maze(maze_gen_t* g) ;
+
+/** Stop making a maze, and free it.
+ *
+ *  @param g a maze being made, or <code>NULL</code>.
+ */
+void free_maze_gen(maze_gen_t* g) ;
+
+/** Free a maze and its cells.  Cells obtained from the maze must not be
+ *  used afterwards.
+ *
+ *  @param m a maze, or <code>NULL</code>.
+ */
+void free_maze(maze_t* m) ;
+
 /** Get the start cell of a maze.
  *  
  *  @param m a maze.
@@ -97,6 +297,24 @@ int get_nrows(maze_t* m) ;
  */
 int get_ncols(maze_t* m) ;
 
+/** Get the number of levels of a maze.
+ *
+ *  @param m a maze.
+ *  @return the number of levels in <code>m</code>, which is 1 unless it
+ *      was made with more.
+ */
+int get_nlevels(maze_t* m) ;
+
+/** Check whether a maze is perfect:  whether there is exactly one path
+ *  between any two of its cells, so that its passages form a tree.  Mazes
+ *  are perfect unless they are braided.
+ *
+ *  @param m a maze.
+ *  @return <code>true</code> if <code>m</code> is perfect,
+ *      <code>false</code> otherwise.
+ */
+bool is_perfect(maze_t* m) ;
+
 /** Check whether there is a passage in a given direction from a given cell
  *  in a maze.
  *
@@ -121,5 +339,406 @@ bool has_path(maze_t* m, cell_t* c, unsigned char d) ;
  */
 bool has_wall(maze_t* m, cell_t* c, unsigned char d) ;
 
+// BULK ACCESS.
+//
+// The passages of a cell are kept as a mask of the directions in which it
+// has a passage, as has_path reports them.  These functions give loops
+// over many cells the masks themselves, without a call for each cell and
+// direction.
+
+/** Get the passage masks of a range of rows of a maze.
+ *
+ *  @param m a maze.
+ *  @param first the first row, counting the rows of all levels.
+ *  @param count the number of rows.
+ *
+ *  @return the masks of the cells of the rows, row by row, so that the
+ *      mask of the cell at row <code>r</code> and column <code>c</code> is
+ *      at <code>(r-first)*get_ncols(m) + c</code>.  The masks must not be
+ *      written to, and are valid until <code>m</code> is freed.  For
+ *      layouts other than row-major they are in a copy that is made on
+ *      the first call.
+ */
+const unsigned char* get_row_span(maze_t* m, int first, int count) ;
+
+/** Find the next cells of a maze whose passages match a pattern, in row
+ *  order.  A cell matches if the directions in <code>care</code> in which
+ *  it has passages are exactly those in <code>want</code>; so, for
+ *  instance, <code>care = NORTH|SOUTH</code> and <code>want = NORTH</code>
+ *  finds the cells with a passage north and a wall south.  Runs of cells
+ *  that do not match are skipped a block at a time.
+ *
+ *  @param m a maze.
+ *  @param care the directions to look at.
+ *  @param want the directions among <code>care</code> that must have
+ *      passages.
+ *  @param cursor the index (<code>r*get_ncols(m) + c</code>) of the cell
+ *      to start from, which should be 0 for the first call; updated to
+ *      the index to start the next call from.
+ *  @param out filled in with the indices of the matching cells found.
+ *  @param max the most indices to find.
+ *
+ *  @return the number of indices put in <code>out</code>.  If it is less
+ *      than <code>max</code>, there are no more matching cells.
+ */
+size_t next_cells(maze_t* m, unsigned char care, unsigned char want,
+        size_t* cursor, size_t* out, size_t max) ;
+
+// VALIDATION.
+
+/** What <code>check_maze</code> found in a maze.
+ */
+typedef struct _maze_check_t {
+    /** Passages with no passage back from the cell they lead to, counted
+     *  from each side that has one.
+     */
+    uint64_t asymmetric ;
+
+    /** Passages that lead off the edge of the maze or of a level, and
+     *  cells with bits that are not directions.
+     */
+    uint64_t off_grid ;
+
+    /** Passages between cells, each counted once.
+     */
+    uint64_t passages ;
+
+    /** The connected components of the cells, and the passages that
+     *  close a cycle.  A perfect maze of n cells has 1 component, no
+     *  cycles and n-1 passages.
+     */
+    uint64_t components, cycles ;
+} maze_check_t ;
+
+/** Check that a maze is well formed:  that every passage has a passage
+ *  back, none leads off the maze, every cell can be reached from every
+ *  other, and, if the maze is perfect (see <code>is_perfect</code>),
+ *  there are no cycles.  Large mazes are checked on several threads at
+ *  once, which share a lock-free union-find forest of the cells; what is
+ *  found does not depend on the number of threads.
+ *
+ *  @param m a maze.
+ *  @param nthreads the most threads to use, or 0 for one per processor.
+ *  @param check filled in with what was found.
+ *
+ *  @return true if the maze is well formed, false if it is not or there
+ *      is not enough memory to check it.
+ */
+bool check_maze(maze_t* m, int nthreads, maze_check_t* check) ;
+
+// COLLISION.
+//
+// The collision functions treat a maze as a plane in which the cell at row
+// r and column c is the unit square [r, r+1) x [c, c+1), and each wall is
+// the unit segment along the side of a cell that it blocks.  A mover is a
+// circle whose radius should include half the thickness the walls are
+// drawn with.  Positions may be anywhere, including outside the maze.
+
+/** The first contact of a circle swept through a maze.
+ */
+typedef struct _maze_contact_t {
+    /** The fraction of the move made before the circle touches a wall, or
+     *  1 if it touches none.
+     */
+    float t ;
+
+    /** The point of the wall touched, and the unit normal there pointing
+     *  from the wall toward the circle.
+     */
+    float contact_r, contact_c ;
+    float normal_r, normal_c ;
+
+    /** The rest of the move after the contact with the part into the wall
+     *  taken out, so that the circle can slide along the wall.
+     */
+    float slide_r, slide_c ;
+} maze_contact_t ;
+
+/** Sweep a circle through a maze and find the first wall it touches.  A
+ *  circle that already overlaps a wall touches it at once unless it is
+ *  moving away from it.  Only the walls near the cells the circle passes
+ *  through are tested, so the cost depends on the length of the move and
+ *  not on the size of the maze.
+ *
+ *  @param m a maze.
+ *  @param r the row coordinate of the center.
+ *  @param c the column coordinate of the center.
+ *  @param dr the move along rows.
+ *  @param dc the move along columns.
+ *  @param radius the radius of the circle.
+ *  @param contact filled in with the first contact, if any.
+ *
+ *  @return true if the circle touches a wall during the move, false
+ *      otherwise.
+ */
+bool sweep_circle(maze_t* m, float r, float c, float dr, float dc,
+        float radius, maze_contact_t* contact) ;
+
+/** Move a circle through a maze, stopping at walls and sliding along
+ *  them for the rest of the move.  Moves of any length are safe; a circle
+ *  inside the maze stays inside it.
+ *
+ *  @param m a maze.
+ *  @param r the row coordinate of the center; updated.
+ *  @param c the column coordinate of the center; updated.
+ *  @param dr the move along rows.
+ *  @param dc the move along columns.
+ *  @param radius the radius of the circle.
+ *
+ *  @return true if the circle touched a wall, false otherwise.
+ */
+bool move_circle(maze_t* m, float* r, float* c, float dr, float dc,
+        float radius) ;
+
+/** Move many circles of the same radius through a maze, as
+ *  <code>move_circle</code> does each one.
+ *
+ *  @param m a maze.
+ *  @param n the number of circles.
+ *  @param r the row coordinates of the centers; updated.
+ *  @param c the column coordinates of the centers; updated.
+ *  @param dr the moves along rows.
+ *  @param dc the moves along columns.
+ *  @param radius the radius of the circles.
+ *  @param touched if not <code>NULL</code>, set to whether each circle
+ *      touched a wall.
+ *
+ *  @return the number of circles that touched a wall.
+ */
+int move_circles(maze_t* m, int n, float* r, float* c, const float* dr,
+        const float* dc, float radius, bool* touched) ;
+
+// ROUTES.
+
+/** Make the next-hop table of a maze toward a target cell:  for each cell,
+ *  the direction of the first step on a shortest path from it to the
+ *  target.  The table is built with one traversal of the maze, after which
+ *  the route from any cell is found by following it, in time proportional
+ *  to the length of the route.  The traversal of a perfect maze is
+ *  depth-first and never checks whether a cell was seen, since the only
+ *  seen neighbor of a cell is the one it was reached from; that of a
+ *  braided maze is breadth-first.
+ *
+ *  @param m a maze.
+ *  @param target a cell in <code>m</code>.
+ *
+ *  @return an array of
+ *      <code>get_nlevels(m)*get_nrows(m)*get_ncols(m)</code> directions,
+ *      row by row, that the caller must free.  The entry of
+ *      <code>target</code>, and of any cell with no path to it, is 0.
+ */
+unsigned char* make_next_hops(maze_t* m, cell_t* target) ;
+
+/** What <code>fill_dead_ends</code> did, and what it cost.
+ */
+typedef struct _maze_fill_t {
+    /** Sweeps over the cells.
+     */
+    uint64_t passes ;
+
+    /** Cells filled, and cells left.
+     */
+    uint64_t filled, left ;
+
+    /** Bytes of passages read, counting each time a cell is read again.
+     */
+    uint64_t bytes_read ;
+
+    /** Page faults that had to read from disk, and bytes read from disk,
+     *  by the whole process while filling.
+     */
+    uint64_t major_faults, bytes_in ;
+
+    /** Nanoseconds taken.
+     */
+    uint64_t ns ;
+
+    /** Whether a cell was found with a passage off the maze, or to a cell
+     *  with no passage back, as a damaged maze file may have.  The maze
+     *  is then not filled.
+     */
+    bool corrupt ;
+} maze_fill_t ;
+
+/** Solve a maze by filling its dead ends:  a cell other than the start
+ *  and end with at most one passage to a cell that is not filled is a
+ *  dead end, and is filled, until there are none.  What is left of a
+ *  perfect maze is the route from the start to the end.  Only the cells
+ *  of the maze and a bit for each cell are used, and the cells are read in
+ *  sweeps from first to last, going back only a few rows at a time, so a
+ *  maze mapped from a maze file (see <code>map_maze_file</code>) much
+ *  larger than memory is solved with reads that are mostly sequential.
+ *  The sweeps needed depend on how far filling has to go back against
+ *  them; most mazes take a few.
+ *
+ *  @param m a maze.
+ *  @param stats filled in with what was done.
+ *
+ *  @return an array of <code>(n+63)/64</code> words for the <code>n</code>
+ *      cells of <code>m</code>, row by row, counting the rows of all
+ *      levels, in which bit <code>k%64</code> of word <code>k/64</code> is
+ *      set if cell <code>k</code> is left:  for a perfect maze, if it is
+ *      on the route.  The caller must free it.  <code>NULL</code> if
+ *      there is not enough memory, or if the maze is corrupt (see
+ *      <code>maze_fill_t</code>).
+ */
+uint64_t* fill_dead_ends(maze_t* m, maze_fill_t* stats) ;
+
+// EDITING.
+//
+// Walls can be added and removed after a maze is made, to open doors or
+// collapse passages, and the maze keeps track of which cells are still
+// connected as they change, so that connection and path length can be
+// asked for without a search of the maze.  The first edit or query makes
+// the structure that tracks them, of about 40 bytes a cell; after that,
+// queries, removals, and additions of walls across loops take amortized
+// logarithmic time, and an addition that cuts the only path between two
+// parts of the maze takes time in proportion to the size of the smaller
+// part.  Edits and queries change the maze, so they must not be made
+// while any other thread is using it.  Mazes mapped from maze files
+// cannot be edited.
+
+/** Remove a wall of a cell, opening a passage to the neighbor on the
+ *  other side.  A maze with a wall removed is no longer perfect unless it
+ *  was in two parts that the wall now joins.
+ *
+ *  @param m a maze.
+ *  @param c a cell in <code>m</code>.
+ *  @param d a direction.
+ *
+ *  @return <code>true</code> if the wall was removed, <code>false</code>
+ *      if there is no wall in direction <code>d</code> from
+ *      <code>c</code>, <code>c</code> has no neighbor that way, or
+ *      <code>m</code> cannot be edited.
+ */
+bool remove_wall(maze_t* m, cell_t* c, unsigned char d) ;
+
+/** Add a wall to a cell, closing the passage to the neighbor on the other
+ *  side.  A perfect maze with a wall added is in two parts, and so no
+ *  longer perfect.
+ *
+ *  @param m a maze.
+ *  @param c a cell in <code>m</code>.
+ *  @param d a direction.
+ *
+ *  @return <code>true</code> if the wall was added, <code>false</code>
+ *      if there is no passage in direction <code>d</code> from
+ *      <code>c</code> or <code>m</code> cannot be edited.
+ */
+bool add_wall(maze_t* m, cell_t* c, unsigned char d) ;
+
+/** Check whether there is a path between two cells of a maze.
+ *
+ *  @param m a maze.
+ *  @param a a cell in <code>m</code>.
+ *  @param b a cell in <code>m</code>.
+ *
+ *  @return <code>true</code> if there is a path from <code>a</code> to
+ *      <code>b</code>, <code>false</code> otherwise.
+ */
+bool is_connected(maze_t* m, cell_t* a, cell_t* b) ;
+
+/** Get the length of a path between two cells of a maze.  In a perfect
+ *  maze, or any maze without loops, it is the only path; otherwise it is
+ *  one path the maze keeps track of, which need not be the shortest.
+ *
+ *  @param m a maze.
+ *  @param a a cell in <code>m</code>.
+ *  @param b a cell in <code>m</code>.
+ *
+ *  @return the number of steps from <code>a</code> to <code>b</code>,
+ *      or -1 if there is no path between them.
+ */
+long get_path_length(maze_t* m, cell_t* a, cell_t* b) ;
+
+// MAZE FILES.
+//
+// A maze file holds a maze as a header of MAZE_FILE_HEADER bytes followed
+// by the passage masks of its cells, row by row, counting the rows of all
+// levels.  The header gives the size of the maze, whether it is perfect
+// and where its start and end are, in the byte order of the machine that
+// wrote it.  Starting the cells on a page boundary lets a file be mapped
+// and used as a maze in place, so a maze can be handed from one process
+// to another as a file descriptor without copying its cells.
+
+#define MAZE_FILE_HEADER 4096
+
+/** Write a maze to a file as a maze file, from the current offset.
+ *
+ *  @param m a maze.
+ *  @param fd a file descriptor open for writing.
+ *
+ *  @return true if the maze was written, false otherwise.
+ */
+bool write_maze_file(maze_t* m, int fd) ;
+
+/** Make a maze from a maze file by mapping the file, so that the cells
+ *  are read from it as they are used rather than copied.  The maze's
+ *  cells must not change while it is in use, and it is row-major.  The
+ *  file descriptor may be closed once this returns.
+ *
+ *  @param fd a file descriptor of a maze file, open for reading.
+ *
+ *  @return the maze, which is freed by <code>free_maze</code>, or
+ *      <code>NULL</code> if the file could not be mapped or is not a
+ *      maze file.
+ */
+maze_t* map_maze_file(int fd) ;
+
+// COUNTERS.
+//
+// Unless the library is built with MAZE_NO_COUNTERS defined, it counts
+// what it does in counters of its own for each thread, which are summed
+// (or, for peaks, maximized) only when they are read.  Counting costs a
+// thread-local add.  Counters are never reset; compare two readings to
+// count what happened between them.
+
+/** The library's counters, over all threads.
+ */
+typedef struct _maze_counters_t {
+    /** Mazes made, and the cells in them.
+     */
+    uint64_t mazes, cells_generated ;
+
+    /** Walls removed while building mazes.
+     */
+    uint64_t walls_removed ;
+
+    /** The most frontier edges any maze had at once while it was built,
+     *  and the frontier edges chosen that led into the tree already and
+     *  were discarded.
+     */
+    uint64_t frontier_peak, stale_edges ;
+
+    /** Nanoseconds spent making mazes, in setting up the cells and in
+     *  building the tree.
+     */
+    uint64_t setup_ns, build_ns ;
+
+    /** Calls of <code>has_path</code>, including those made by
+     *  <code>has_wall</code>.
+     */
+    uint64_t has_path_calls ;
+
+    /** Bytes allocated.
+     */
+    uint64_t bytes_allocated ;
+} maze_counters_t ;
+
+/** Read the library's counters.  They are all 0 if it was built without
+ *  them.
+ *
+ *  @param counts filled in with the counters.
+ */
+void get_maze_counters(maze_counters_t* counts) ;
+
+/** Write the library's counters as a JSON object with a member for each
+ *  counter, and an <code>enabled</code> member that is false if it was
+ *  built without them.
+ *
+ *  @param f the file to write to.
+ */
+void write_maze_counters(FILE* f) ;
+
 #endif
 
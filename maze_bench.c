@@ -0,0 +1,429 @@
+/*  Benchmarks for the maze library.
+ *
+ *  For each size from 10^2 cells up to a limit (10^8 by default), mazes
+ *  are made from several seeds, and on each one the program times:
+ *      make_maze: making the maze;
+ *      has_path_random: has_path calls on random cells and directions;
+ *      has_path_sequential: has_path calls on every direction of the cells
+ *          in row order, from the first;
+ *      solve_next_hops: building the next-hop table toward the end and
+ *          following it from the start;
+ *      solve_next_hops_braidN: the same on the maze made from the same
+ *          seed with N percent of its dead ends braided, for N of 25, 50
+ *          and 100, to show how solving costs more as loops make the maze
+ *          no longer a tree.
+ *  Each benchmark is reported with the median and 99th percentile of its
+ *  samples, its throughput and the peak resident set size of the process
+ *  so far, as JSON on standard output, followed by the library's counters.
+ *  Each benchmark is on a line of its own, so that a saved report can be
+ *  read back as a baseline.
+ *
+ *  Usage:  maze_bench [options]
+ *      --max-cells N: stop at sizes of N cells (default 10^8).
+ *      --seeds N: make N mazes of each size (default 5; at most 3 for
+ *          sizes over 10^6 cells).
+ *      --baseline FILE: compare with a report saved from an earlier run,
+ *          writing the comparison to standard error, and exit with
+ *          status 1 if any median is slower by more than the threshold.
+ *          Benchmarks are matched by name and size, so a run with one
+ *          layout can be compared with a baseline of another.
+ *      --threshold PCT: the threshold in percent (default 10).
+ *      --layout rows|z: lay the cells out row by row (the default) or in
+ *          Z-order; see maze.h.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <time.h>
+
+#include "maze.h"
+
+#define DEFAULT_MAX_CELLS 100000000LL
+#define DEFAULT_SEEDS 5
+#define LARGE_CELLS 1000000LL
+#define LARGE_SEEDS 3
+
+// Access benchmarks time batches of BATCH calls, up to ACCESS_BATCHES
+// batches per maze.
+#define BATCH 4096
+#define ACCESS_BATCHES 256
+
+#define MAX_NAME 64
+#define MAX_RESULTS 64
+
+// The percentages of dead ends braided by the braided solve benchmarks.
+#define NBRAIDS 3
+const int braid_pcts[NBRAIDS] = {25, 50, 100} ;
+
+// The results of each size.
+#define SIZE_RESULTS (4+NBRAIDS)
+
+/*  A benchmark's samples and what it reports.  Samples are in nanoseconds
+ *  per unit of work:  per maze for make_maze and solve_next_hops, and per
+ *  call for the access benchmarks.  work counts the units of throughput
+ *  (cells or calls) done in total_ns.
+ */
+typedef struct _result_t {
+    char name[MAX_NAME] ;
+    long long cells ;
+    double* samples ;
+    int nsamples ;
+    double total_ns ;
+    double work ;
+    const char* unit ;
+    double median_ns, p99_ns ;
+    long peak_rss_kb ;
+} result_t ;
+
+result_t results[MAX_RESULTS] ;
+int nresults = 0 ;
+
+maze_opts_t opts = {MAZE_ROW_MAJOR} ;
+const char* layout_name = "rows" ;
+
+double now_ns() ;
+long peak_rss_kb() ;
+result_t* new_result(const char*, long long, int, const char*) ;
+void finish_result(result_t*) ;
+void bench_size(int, int, int) ;
+double time_solve(maze_t*) ;
+void bench_access(maze_t*, result_t*, result_t*, uint64_t*) ;
+void write_result(FILE*, result_t*) ;
+int compare_baseline(const char*, double) ;
+
+int double_cmp(const void* x, const void* y) {
+    double a = *(const double*)x, b = *(const double*)y ;
+    return a < b ? -1 : a > b ;
+}
+
+// Keeps the results of the timed calls alive.
+volatile long sink ;
+
+int main(int argc, char **argv) {
+    long long max_cells = DEFAULT_MAX_CELLS ;
+    int nseeds = DEFAULT_SEEDS ;
+    char* baseline = NULL ;
+    double threshold = 10.0 ;
+    for (int i=1; i<argc; ++i) {
+        if (strcmp(argv[i], "--max-cells") == 0 && i+1 < argc) {
+            max_cells = atoll(argv[++i]) ;
+        } else if (strcmp(argv[i], "--seeds") == 0 && i+1 < argc) {
+            nseeds = atoi(argv[++i]) ;
+        } else if (strcmp(argv[i], "--baseline") == 0 && i+1 < argc) {
+            baseline = argv[++i] ;
+        } else if (strcmp(argv[i], "--threshold") == 0 && i+1 < argc) {
+            threshold = atof(argv[++i]) ;
+        } else if (strcmp(argv[i], "--layout") == 0 && i+1 < argc) {
+            layout_name = argv[++i] ;
+            if (strcmp(layout_name, "rows") == 0) opts.layout = MAZE_ROW_MAJOR ;
+            else if (strcmp(layout_name, "z") == 0) opts.layout = MAZE_Z_ORDER ;
+            else {
+                fprintf(stderr, "Unknown layout %s\n", layout_name) ;
+                return EXIT_FAILURE ;
+            }
+        } else {
+            fprintf(stderr, "Unknown option %s\n", argv[i]) ;
+            return EXIT_FAILURE ;
+        }
+    }
+    if (nseeds < 1) nseeds = 1 ;
+
+    // Sizes of 10^k cells, as square as a power of ten allows.
+    int side = 10 ;
+    for (long long cells=100; cells<=max_cells && nresults+SIZE_RESULTS <= MAX_RESULTS;
+            cells*=10) {
+        int nrows = side, ncols = (int)(cells/side) ;
+        int seeds = cells > LARGE_CELLS && nseeds > LARGE_SEEDS ?
+            LARGE_SEEDS : nseeds ;
+        fprintf(stderr, "%d x %d, %d seeds\n", nrows, ncols, seeds) ;
+        bench_size(nrows, ncols, seeds) ;
+        if (ncols > nrows) side = ncols ;
+    }
+
+    printf("{\"benchmarks\": [\n") ;
+    for (int i=0; i<nresults; ++i) {
+        write_result(stdout, &results[i]) ;
+        printf("%s\n", i+1 < nresults ? "," : "") ;
+    }
+    printf("],\n\"counters\": ") ;
+    write_maze_counters(stdout) ;
+    printf("}\n") ;
+
+    int status = EXIT_SUCCESS ;
+    if (baseline != NULL) status = compare_baseline(baseline, threshold) ;
+
+    for (int i=0; i<nresults; ++i) free(results[i].samples) ;
+    return status ;
+}
+
+/*  Get the time in nanoseconds.
+ *
+ *  @return nanoseconds of the monotonic clock.
+ */
+double now_ns() {
+    struct timespec t ;
+    clock_gettime(CLOCK_MONOTONIC, &t) ;
+    return t.tv_sec*1.0e9 + t.tv_nsec ;
+}
+
+/*  Get the peak resident set size of the process.
+ *
+ *  @return the peak RSS in kilobytes.
+ */
+long peak_rss_kb() {
+    struct rusage usage ;
+    getrusage(RUSAGE_SELF, &usage) ;
+#ifdef __MACOSX__
+    return usage.ru_maxrss/1024 ;
+#else
+    return usage.ru_maxrss ;
+#endif
+}
+
+/*  Add a result with room for its samples.
+ *
+ *  @param name the name of the benchmark.
+ *  @param cells the number of cells in its mazes.
+ *  @param nsamples the most samples it will take.
+ *  @param unit the unit of its throughput.
+ *  @return the result.
+ */
+result_t* new_result(const char* name, long long cells, int nsamples,
+        const char* unit) {
+    result_t* res = &results[nresults++] ;
+    memset(res, 0, sizeof(result_t)) ;
+    snprintf(res->name, MAX_NAME, "%s", name) ;
+    res->cells = cells ;
+    res->samples = malloc(nsamples*sizeof(double)) ;
+    res->unit = unit ;
+    return res ;
+}
+
+/*  Compute the median and 99th percentile of a result's samples and
+ *  record the peak RSS.
+ *
+ *  @param res the result.
+ */
+void finish_result(result_t* res) {
+    qsort(res->samples, res->nsamples, sizeof(double), double_cmp) ;
+    res->median_ns = res->samples[res->nsamples/2] ;
+    res->p99_ns = res->samples[res->nsamples*99/100] ;
+    res->peak_rss_kb = peak_rss_kb() ;
+}
+
+/*  Run every benchmark on mazes of one size.
+ *
+ *  @param nrows the number of rows.
+ *  @param ncols the number of columns.
+ *  @param nseeds the number of mazes to make.
+ */
+void bench_size(int nrows, int ncols, int nseeds) {
+    long long cells = (long long)nrows*ncols ;
+    result_t* make = new_result("make_maze", cells, nseeds, "cells/s") ;
+    result_t* solve = new_result("solve_next_hops", cells, nseeds, "cells/s") ;
+    result_t* rand_access = new_result("has_path_random", cells,
+            nseeds*ACCESS_BATCHES, "calls/s") ;
+    result_t* seq_access = new_result("has_path_sequential", cells,
+            nseeds*ACCESS_BATCHES, "calls/s") ;
+    result_t* braided[NBRAIDS] ;
+    for (int b=0; b<NBRAIDS; ++b) {
+        char name[MAX_NAME] ;
+        snprintf(name, MAX_NAME, "solve_next_hops_braid%d", braid_pcts[b]) ;
+        braided[b] = new_result(name, cells, nseeds, "cells/s") ;
+    }
+
+    for (int s=0; s<nseeds; ++s) {
+        double start = now_ns() ;
+        maze_t* m = make_maze_opts(nrows, ncols, s+1, &opts) ;
+        double t = now_ns()-start ;
+        if (m == NULL) {
+            fprintf(stderr, "Not enough memory for a %dx%d maze\n",
+                    nrows, ncols) ;
+            exit(EXIT_FAILURE) ;
+        }
+        make->samples[make->nsamples++] = t ;
+        make->total_ns += t ;
+        make->work += cells ;
+
+        t = time_solve(m) ;
+        solve->samples[solve->nsamples++] = t ;
+        solve->total_ns += t ;
+        solve->work += cells ;
+
+        uint64_t rng = 0x9e3779b97f4a7c15ULL*(s+1) | 1 ;
+        bench_access(m, rand_access, seq_access, &rng) ;
+        free_maze(m) ;
+
+        for (int b=0; b<NBRAIDS; ++b) {
+            maze_opts_t braid_opts = opts ;
+            braid_opts.braid = braid_pcts[b]/100.0f ;
+            m = make_maze_opts(nrows, ncols, s+1, &braid_opts) ;
+            if (m == NULL) {
+                fprintf(stderr, "Not enough memory for a %dx%d maze\n",
+                        nrows, ncols) ;
+                exit(EXIT_FAILURE) ;
+            }
+            t = time_solve(m) ;
+            braided[b]->samples[braided[b]->nsamples++] = t ;
+            braided[b]->total_ns += t ;
+            braided[b]->work += cells ;
+            free_maze(m) ;
+        }
+    }
+
+    finish_result(make) ;
+    finish_result(solve) ;
+    finish_result(rand_access) ;
+    finish_result(seq_access) ;
+    for (int b=0; b<NBRAIDS; ++b) finish_result(braided[b]) ;
+}
+
+/*  Time building a maze's next-hop table toward the end and following it
+ *  from the start.
+ *
+ *  @param m the maze.
+ *  @return the time in nanoseconds.
+ */
+double time_solve(maze_t* m) {
+    int ncols = get_ncols(m) ;
+    double start = now_ns() ;
+    cell_t* end = get_end(m) ;
+    unsigned char* hops = make_next_hops(m, end) ;
+    cell_t* cell = get_start(m) ;
+    int r = cell->r, c = cell->c ;
+    long steps = 0 ;
+    for (unsigned char d; (d = hops[(size_t)r*ncols + c]) != 0; ++steps) {
+        if (d == NORTH) r++ ;
+        else if (d == EAST) c++ ;
+        else if (d == SOUTH) r-- ;
+        else c-- ;
+    }
+    double t = now_ns()-start ;
+    sink += steps ;
+    free(hops) ;
+    return t ;
+}
+
+/*  Time has_path calls on a maze, in batches.  The random cells are
+ *  chosen before timing starts.
+ *
+ *  @param m the maze.
+ *  @param rand_access the result for random access.
+ *  @param seq_access the result for sequential access.
+ *  @param rng the random number generator (xorshift64*).
+ */
+void bench_access(maze_t* m, result_t* rand_access, result_t* seq_access,
+        uint64_t* rng) {
+    int nrows = get_nrows(m), ncols = get_ncols(m) ;
+    long long cells = (long long)nrows*ncols ;
+    static const unsigned char dirs[] = {NORTH, EAST, SOUTH, WEST} ;
+
+    cell_t** picks = malloc(BATCH*sizeof(cell_t*)) ;
+    unsigned char* pick_dirs = malloc(BATCH) ;
+    for (int b=0; b<ACCESS_BATCHES; ++b) {
+        for (int i=0; i<BATCH; ++i) {
+            *rng ^= *rng >> 12 ;
+            *rng ^= *rng << 25 ;
+            *rng ^= *rng >> 27 ;
+            uint64_t x = *rng*0x2545f4914f6cdd1dULL ;
+            long long k = (x >> 32) % cells ;
+            picks[i] = get_cell(m, k/ncols, k%ncols) ;
+            pick_dirs[i] = dirs[x & 3] ;
+        }
+        long n = 0 ;
+        double start = now_ns() ;
+        for (int i=0; i<BATCH; ++i) n += has_path(m, picks[i], pick_dirs[i]) ;
+        double t = now_ns()-start ;
+        sink += n ;
+        rand_access->samples[rand_access->nsamples++] = t/BATCH ;
+        rand_access->total_ns += t ;
+        rand_access->work += BATCH ;
+    }
+    free(picks) ;
+    free(pick_dirs) ;
+
+    // Cells in row order, BATCH/4 at a time from the first row on, going
+    // round again if the maze is small.
+    int r = 0, c = 0 ;
+    for (int b=0; b<ACCESS_BATCHES; ++b) {
+        long n = 0 ;
+        double start = now_ns() ;
+        for (int i=0; i<BATCH/4; ++i) {
+            cell_t* cell = get_cell(m, r, c) ;
+            for (int d=0; d<4; ++d) n += has_path(m, cell, dirs[d]) ;
+            if (++c == ncols) {
+                c = 0 ;
+                if (++r == nrows) r = 0 ;
+            }
+        }
+        double t = now_ns()-start ;
+        sink += n ;
+        seq_access->samples[seq_access->nsamples++] = t/BATCH ;
+        seq_access->total_ns += t ;
+        seq_access->work += BATCH ;
+    }
+}
+
+/*  Write a result as a JSON object on one line.
+ *
+ *  @param f the file.
+ *  @param res the result.
+ */
+void write_result(FILE* f, result_t* res) {
+    fprintf(f, "{\"name\": \"%s\", \"cells\": %lld, \"layout\": \"%s\", "
+            "\"samples\": %d, "
+            "\"median_ns\": %.3f, \"p99_ns\": %.3f, \"throughput\": %.0f, "
+            "\"unit\": \"%s\", \"peak_rss_kb\": %ld}",
+            res->name, res->cells, layout_name, res->nsamples, res->median_ns,
+            res->p99_ns, res->work/(res->total_ns/1.0e9), res->unit,
+            res->peak_rss_kb) ;
+}
+
+/*  Compare the results with a saved report, by median.
+ *
+ *  @param path the report.
+ *  @param threshold the slowdown in percent above which a benchmark has
+ *      regressed.
+ *  @return EXIT_SUCCESS if none regressed, EXIT_FAILURE otherwise.
+ */
+int compare_baseline(const char* path, double threshold) {
+    FILE* f = fopen(path, "r") ;
+    if (f == NULL) {
+        perror(path) ;
+        return EXIT_FAILURE ;
+    }
+
+    int regressions = 0 ;
+    char line[512] ;
+    fprintf(stderr, "%-20s %10s %14s %14s %9s\n", "benchmark", "cells",
+            "base ns", "ns", "change") ;
+    while (fgets(line, sizeof(line), f) != NULL) {
+        char name[MAX_NAME], layout[MAX_NAME] ;
+        long long cells ;
+        int nsamples ;
+        double median ;
+        if (sscanf(line, "{\"name\": \"%63[^\"]\", \"cells\": %lld, "
+                    "\"layout\": \"%63[^\"]\", \"samples\": %d, "
+                    "\"median_ns\": %lf",
+                    name, &cells, layout, &nsamples, &median) != 5) continue ;
+        for (int i=0; i<nresults; ++i) {
+            result_t* res = &results[i] ;
+            if (res->cells != cells || strcmp(res->name, name) != 0) continue ;
+            double change = 100.0*(res->median_ns-median)/median ;
+            bool regressed = change > threshold ;
+            regressions += regressed ;
+            fprintf(stderr, "%-20s %10lld %14.1f %14.1f %+8.1f%%%s\n", name,
+                    cells, median, res->median_ns, change,
+                    regressed ? "  REGRESSION" : "") ;
+        }
+    }
+    fclose(f) ;
+
+    fprintf(stderr, "%d regression%s over %.1f%%\n", regressions,
+            regressions == 1 ? "" : "s", threshold) ;
+    return regressions == 0 ? EXIT_SUCCESS : EXIT_FAILURE ;
+}
@@ -0,0 +1,194 @@
+/*  Fuzzing the maze generator.
+ *
+ *  Makes mazes of random sizes from random seeds, with random options and
+ *  algorithms, and checks each one with check_maze.  A maze that fails is
+ *  reported on standard error with everything needed to make it again.
+ *  At the end, the program reports how many mazes and cells it made and
+ *  checked, and how fast it checked them.
+ *
+ *  Usage:  maze_fuzz [options]
+ *      --mazes N: make N mazes (default 1000).
+ *      --max-cells N: make mazes of at most N cells (default 10^6).
+ *      --threads N: check on at most N threads (default one per
+ *          processor).
+ *      --seed N: draw the sizes, seeds and options from N (default the
+ *          time), so that a run can be repeated.
+ *      --mazed PATH: also fetch each maze from the maze daemon listening
+ *          on PATH (see mazed.h), and check that it is the same as the
+ *          maze made here.
+ *
+ *  The exit status is 1 if any maze failed.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "maze.h"
+#include "mazed.h"
+
+#define DEFAULT_MAZES 1000
+#define DEFAULT_MAX_CELLS 1000000LL
+
+// The most levels of a layered maze.
+#define MAX_LEVELS 4
+
+double now_ns() {
+    struct timespec t ;
+    clock_gettime(CLOCK_MONOTONIC, &t) ;
+    return t.tv_sec*1e9 + t.tv_nsec ;
+}
+
+/*  Draw a random number from the fuzzer's own generator (splitmix64), so
+ *  that a run does not depend on the C library's.
+ */
+uint64_t next_random(uint64_t* state) {
+    uint64_t z = (*state += 0x9e3779b97f4a7c15ULL) ;
+    z = (z ^ (z >> 30))*0xbf58476d1ce4e5b9ULL ;
+    z = (z ^ (z >> 27))*0x94d049bb133111ebULL ;
+    return z ^ (z >> 31) ;
+}
+
+/*  Draw a random number from lo to hi, inclusive.
+ */
+long long random_between(uint64_t* state, long long lo, long long hi) {
+    return lo + (long long)(next_random(state) % (uint64_t)(hi-lo+1)) ;
+}
+
+/*  Determine whether two mazes have the same size, start, end and
+ *  passages.
+ */
+bool same_maze(maze_t* a, maze_t* b) {
+    int nrows = get_nlevels(a)*get_nrows(a) ;
+    if (get_nrows(a) != get_nrows(b) || get_ncols(a) != get_ncols(b) ||
+            get_nlevels(a) != get_nlevels(b)) {
+        return false ;
+    }
+    cell_t *sa = get_start(a), *sb = get_start(b) ;
+    cell_t *ea = get_end(a), *eb = get_end(b) ;
+    return sa->r == sb->r && sa->c == sb->c && ea->r == eb->r &&
+        ea->c == eb->c && ea->level == eb->level &&
+        memcmp(get_row_span(a, 0, nrows), get_row_span(b, 0, nrows),
+                (size_t)nrows*get_ncols(a)) == 0 ;
+}
+
+int main(int argc, char **argv) {
+    long nmazes = DEFAULT_MAZES ;
+    long long max_cells = DEFAULT_MAX_CELLS ;
+    int nthreads = 0 ;
+    uint64_t fuzz_seed = time(NULL) ;
+    const char* mazed_path = NULL ;
+
+    for (int i=1; i<argc; ++i) {
+        if (strcmp(argv[i], "--mazes") == 0 && i+1 < argc) {
+            nmazes = atol(argv[++i]) ;
+        } else if (strcmp(argv[i], "--max-cells") == 0 && i+1 < argc) {
+            max_cells = atoll(argv[++i]) ;
+        } else if (strcmp(argv[i], "--threads") == 0 && i+1 < argc) {
+            nthreads = atoi(argv[++i]) ;
+        } else if (strcmp(argv[i], "--seed") == 0 && i+1 < argc) {
+            fuzz_seed = strtoull(argv[++i], NULL, 0) ;
+        } else if (strcmp(argv[i], "--mazed") == 0 && i+1 < argc) {
+            mazed_path = argv[++i] ;
+        } else {
+            fprintf(stderr, "Unknown option %s\n", argv[i]) ;
+            return EXIT_FAILURE ;
+        }
+    }
+    if (max_cells < 1) max_cells = 1 ;
+    fprintf(stderr, "maze_fuzz: --seed %llu\n", (unsigned long long)fuzz_seed) ;
+
+    uint64_t state = fuzz_seed ;
+    long nfailed = 0 ;
+    long long total_cells = 0 ;
+    double make_ns = 0, check_ns = 0 ;
+    for (long i=0; i<nmazes; ++i) {
+        // Draw the number of cells, and then the number of rows, on a log
+        // scale, so that small and narrow mazes, where the edge cases are,
+        // come up as often as big ones.  Mazes may be a single cell.
+        maze_opts_t opts = {MAZE_ROW_MAJOR, 0, 1} ;
+        if (next_random(&state) % 4 == 0) {
+            opts.nlevels = random_between(&state, 2, MAX_LEVELS) ;
+        }
+        long long level_cells = max_cells/opts.nlevels ;
+        if (level_cells < 1) level_cells = 1 ;
+        int bits = 63 - __builtin_clzll(level_cells) ;
+        long long cells = random_between(&state, 1,
+                (1LL << random_between(&state, 1, bits+1)) - 1) ;
+        if (cells > level_cells) cells = level_cells ;
+        int row_bits = random_between(&state, 0, 63 - __builtin_clzll(cells)) ;
+        int nrows = random_between(&state, 1LL << row_bits,
+                (2LL << row_bits) - 1) ;
+        if (nrows > cells) nrows = cells ;
+        int ncols = cells/nrows ;
+        if (next_random(&state) % 2 == 0) {
+            opts.layout = MAZE_Z_ORDER ;
+        }
+        if (next_random(&state) % 2 == 0) {
+            opts.braid = (next_random(&state) % 101)/100.0f ;
+        }
+        opts.algorithm = next_random(&state) % 3 ;
+        long seed = (long)next_random(&state) ;
+
+        double start = now_ns() ;
+        maze_t* m = make_maze_opts(nrows, ncols, seed, &opts) ;
+        double made = now_ns() ;
+        if (m == NULL) {
+            fprintf(stderr, "maze_fuzz: out of memory for %d x %d x %d\n",
+                    nrows, ncols, opts.nlevels) ;
+            continue ;
+        }
+        maze_check_t check ;
+        bool ok = check_maze(m, nthreads, &check) ;
+        double checked = now_ns() ;
+
+        // The daemon only serves row-major mazes, which have the same
+        // passages.
+        bool served = true ;
+        if (mazed_path != NULL) {
+            maze_t* f = fetch_maze(mazed_path, nrows, ncols, seed, &opts) ;
+            served = f != NULL && same_maze(m, f) ;
+            free_maze(f) ;
+        }
+        make_ns += made-start ;
+        check_ns += checked-made ;
+        total_cells += (long long)nrows*ncols*opts.nlevels ;
+
+        if (!ok) {
+            nfailed++ ;
+            fprintf(stderr, "FAILED: %d rows, %d columns, %d levels, seed "
+                    "%ld, braid %g, layout %s, algorithm %d:  %llu "
+                    "asymmetric, %llu off the grid, %llu passages, %llu "
+                    "components, %llu cycles%s\n",
+                    nrows, ncols, opts.nlevels, seed, opts.braid,
+                    opts.layout == MAZE_Z_ORDER ? "z" : "rows",
+                    (int)opts.algorithm,
+                    (unsigned long long)check.asymmetric,
+                    (unsigned long long)check.off_grid,
+                    (unsigned long long)check.passages,
+                    (unsigned long long)check.components,
+                    (unsigned long long)check.cycles,
+                    is_perfect(m) ? " (perfect)" : "") ;
+        }
+        if (!served) {
+            nfailed++ ;
+            fprintf(stderr, "FAILED: %d rows, %d columns, %d levels, seed "
+                    "%ld, braid %g, algorithm %d:  the daemon's maze is "
+                    "missing or different\n",
+                    nrows, ncols, opts.nlevels, seed, opts.braid,
+                    (int)opts.algorithm) ;
+        }
+        free_maze(m) ;
+    }
+
+    printf("%ld mazes, %lld cells, %ld failed\n", nmazes, total_cells,
+            nfailed) ;
+    printf("made in %.3f s (%.3g cells/s), checked in %.3f s "
+            "(%.3g cells/s)\n",
+            make_ns/1e9, total_cells/(make_ns/1e9),
+            check_ns/1e9, total_cells/(check_ns/1e9)) ;
+    return nfailed == 0 ? EXIT_SUCCESS : EXIT_FAILURE ;
+}
@@ -0,0 +1,126 @@
+/** maze_image.c:  raster images of mazes.
+ */
+
+#include <stdlib.h>
+
+#include "maze.h"
+#include "maze_image.h"
+
+#define WALL 255
+#define OPEN 0
+
+/** Free a maze image; see maze_image.h.
+ */
+void free_maze_image(maze_image_t* img) {
+    if (img == NULL) return ;
+    for (int l=0; l<img->nlevels; ++l) free(img->levels[l]) ;
+    free(img->levels) ;
+    free(img->widths) ;
+    free(img->heights) ;
+    free(img) ;
+}
+
+/** Rasterize a rectangle of level 0 of a maze's image; see maze_image.h.
+ *  Every pixel is worked out on its own from its parity:  posts are walls,
+ *  cells are open, and the pixel between two cells is open if there is a
+ *  passage between them.  The south and west exterior walls are never
+ *  opened.
+ */
+void draw_maze_image_rect(maze_t* m, int x0, int y0, int width, int height,
+        unsigned char* pixels) {
+    int nrows = get_nrows(m) ;
+    int ncols = get_ncols(m) ;
+    const unsigned char* cells = get_row_span(m, 0, nrows) ;
+
+    for (int y=y0; y<y0+height; ++y) {
+        unsigned char* row = pixels + (size_t)(y-y0)*width ;
+        for (int x=x0; x<x0+width; ++x) {
+            unsigned char p ;
+            if (x < 0 || y < 0 || x > 2*ncols || y > 2*nrows) p = OPEN ;
+            else if (x%2 == 0 && y%2 == 0) p = WALL ;
+            else if (x%2 == 1 && y%2 == 1) p = OPEN ;
+            else if (x%2 == 0) {
+                // Between the cells to the west and east.
+                int c = x/2 - 1 ;
+                p = c >= 0 && c+1 < ncols &&
+                        (cells[(size_t)(y/2)*ncols + c] & EAST) ? OPEN : WALL ;
+            }
+            else {
+                // Between the cells to the south and north.
+                int r = y/2 - 1 ;
+                p = r >= 0 && r+1 < nrows &&
+                        (cells[(size_t)r*ncols + x/2] & NORTH) ? OPEN : WALL ;
+            }
+            row[x-x0] = p ;
+        }
+    }
+}
+
+/** Compute one level of a maze image from the level below it by
+ *  averaging 2x2 blocks.  Blocks on an odd right or top edge only average
+ *  the pixels that exist.
+ *
+ *  @param src the pixels of the level below.
+ *  @param sw the width of the level below.
+ *  @param sh the height of the level below.
+ *  @param dst the pixels of the new level.
+ *  @param dw the width of the new level.
+ *  @param dh the height of the new level.
+ */
+static void reduce_level(unsigned char* src, int sw, int sh,
+        unsigned char* dst, int dw, int dh) {
+    for (int y=0; y<dh; ++y) {
+        unsigned char* s0 = src + (size_t)(2*y)*sw ;
+        unsigned char* s1 = 2*y+1 < sh ? s0 + sw : s0 ;
+        unsigned char* d = dst + (size_t)y*dw ;
+        for (int x=0; x<dw; ++x) {
+            int x1 = 2*x+1 < sw ? 2*x+1 : 2*x ;
+            d[x] = (s0[2*x] + s0[x1] + s1[2*x] + s1[x1] + 2)/4 ;
+        }
+    }
+}
+
+/** Rasterize a maze; see maze_image.h.
+ */
+maze_image_t* make_maze_image(maze_t* m) {
+    int width = 2*get_ncols(m)+1 ;
+    int height = 2*get_nrows(m)+1 ;
+
+    // Count the levels down to 1x1.
+    int nlevels = 1 ;
+    for (int w=width, h=height; w > 1 || h > 1; w=(w+1)/2, h=(h+1)/2) {
+        nlevels++ ;
+    }
+
+    maze_image_t* img = calloc(1, sizeof(maze_image_t)) ;
+    if (img == NULL) return NULL ;
+    img->nlevels = nlevels ;
+    img->widths = malloc(nlevels*sizeof(int)) ;
+    img->heights = malloc(nlevels*sizeof(int)) ;
+    img->levels = calloc(nlevels, sizeof(unsigned char*)) ;
+    if (img->widths == NULL || img->heights == NULL || img->levels == NULL) {
+        free_maze_image(img) ;
+        return NULL ;
+    }
+
+    for (int l=0; l<nlevels; ++l) {
+        img->widths[l] = width ;
+        img->heights[l] = height ;
+        img->levels[l] = malloc((size_t)width*height) ;
+        if (img->levels[l] == NULL) {
+            free_maze_image(img) ;
+            return NULL ;
+        }
+        width = (width+1)/2 ;
+        height = (height+1)/2 ;
+    }
+
+    draw_maze_image_rect(m, 0, 0, img->widths[0], img->heights[0],
+            img->levels[0]) ;
+    for (int l=1; l<nlevels; ++l) {
+        reduce_level(img->levels[l-1], img->widths[l-1], img->heights[l-1],
+                img->levels[l], img->widths[l], img->heights[l]) ;
+    }
+
+    return img ;
+}
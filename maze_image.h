@@ -0,0 +1,70 @@
+/** @file maze_image.h raster images of mazes.
+ *
+ *  A maze image draws each cell, wall and corner post of a maze as one
+ *  pixel:  the cell at row r and column c is pixel (2c+1, 2r+1), its east
+ *  and north walls are pixels (2c+2, 2r+1) and (2c+1, 2r+2), and pixels
+ *  with both coordinates even are posts.  Pixel values are wall coverage,
+ *  255 for a wall or post and 0 for open floor, and rows run from row 0
+ *  of the maze upward.  So the image for an <code>nrows</code> by
+ *  <code>ncols</code> maze is <code>2*ncols+1</code> pixels wide and
+ *  <code>2*nrows+1</code> pixels high, and pixel x covers the world interval
+ *  [x/2-1/4, x/2+1/4] when cells are 1 unit wide.
+ *
+ *  The image is kept at a pyramid of levels, each half the size of the one
+ *  before (rounding up) and averaging 2x2 blocks of it, down to a single
+ *  pixel, so that a view of any part of the maze at any scale can be drawn
+ *  from about as many pixels as it covers on screen.
+ */
+
+#ifndef MAZE_IMAGE_H
+#define MAZE_IMAGE_H
+
+#include "maze.h"
+
+/** The type of a maze image.
+ */
+typedef struct _maze_image_t {
+    /** The number of levels.  Level 0 is full size.
+     */
+    int nlevels ;
+
+    /** The width and height of each level, in pixels.
+     */
+    int* widths ;
+    int* heights ;
+
+    /** The pixels of each level, row by row.
+     */
+    unsigned char** levels ;
+} maze_image_t ;
+
+/** Rasterize a maze.
+ *
+ *  @param m the maze.
+ *
+ *  @return the image of <code>m</code> with all its levels, or
+ *      <code>NULL</code> if there is not enough memory.
+ */
+maze_image_t* make_maze_image(maze_t* m) ;
+
+/** Rasterize a rectangle of level 0 of a maze's image, without making the
+ *  rest of it.  Pixels outside the image are open floor.
+ *
+ *  @param m the maze.
+ *  @param x0 the x-coordinate of the lower left pixel of the rectangle.
+ *  @param y0 the y-coordinate of the lower left pixel of the rectangle.
+ *  @param width the width of the rectangle in pixels.
+ *  @param height the height of the rectangle in pixels.
+ *  @param pixels filled in with the <code>width*height</code> pixels of the
+ *      rectangle, row by row.
+ */
+void draw_maze_image_rect(maze_t* m, int x0, int y0, int width, int height,
+        unsigned char* pixels) ;
+
+/** Free a maze image.
+ *
+ *  @param img a maze image.
+ */
+void free_maze_image(maze_image_t* img) ;
+
+#endif
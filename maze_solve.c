@@ -0,0 +1,125 @@
+/*  Solving a maze file out of core.
+ *
+ *  Maps a maze file (see maze.h) and solves it with fill_dead_ends, which
+ *  reads the file in sweeps and keeps only a bit for each cell in memory,
+ *  so the maze can be far larger than memory.  Reports, as JSON on
+ *  standard output, the sweeps taken, the cells filled and left, the
+ *  length of the route if the maze is perfect, the bytes of passages read
+ *  and the bytes read from disk, and the time taken.
+ *
+ *  Usage:  maze_solve [options] FILE
+ *      --make NROWS NCOLS: first make a maze of this size and write it to
+ *          FILE, replacing it.
+ *      --seed N, --levels N, --braid F: the seed (default 1) and options
+ *          of the maze made by --make; see maze_opts_t.
+ *      --cold: drop the file from the page cache before solving, so that
+ *          every page is read from disk.
+ */
+
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "maze.h"
+
+/*  Make a maze and write it to a file.
+ */
+bool make_maze_file(const char* path, int nrows, int ncols, long seed,
+        const maze_opts_t* opts) {
+    maze_t* m = make_maze_opts(nrows, ncols, seed, opts) ;
+    if (m == NULL) {
+        fprintf(stderr, "Not enough memory for a %dx%d maze\n", nrows,
+                ncols) ;
+        return false ;
+    }
+    int fd = open(path, O_WRONLY|O_CREAT|O_TRUNC, 0644) ;
+    bool written = fd >= 0 && write_maze_file(m, fd) ;
+    if (fd >= 0 && close(fd) < 0) written = false ;
+    free_maze(m) ;
+    if (!written) perror(path) ;
+    return written ;
+}
+
+int main(int argc, char **argv) {
+    const char* path = NULL ;
+    int nrows = 0, ncols = 0 ;
+    long seed = 1 ;
+    maze_opts_t opts = {MAZE_ROW_MAJOR, 0, 1} ;
+    bool cold = false ;
+
+    for (int i=1; i<argc; ++i) {
+        if (strcmp(argv[i], "--make") == 0 && i+2 < argc) {
+            nrows = atoi(argv[++i]) ;
+            ncols = atoi(argv[++i]) ;
+        } else if (strcmp(argv[i], "--seed") == 0 && i+1 < argc) {
+            seed = atol(argv[++i]) ;
+        } else if (strcmp(argv[i], "--levels") == 0 && i+1 < argc) {
+            opts.nlevels = atoi(argv[++i]) ;
+        } else if (strcmp(argv[i], "--braid") == 0 && i+1 < argc) {
+            opts.braid = atof(argv[++i]) ;
+        } else if (strcmp(argv[i], "--cold") == 0) {
+            cold = true ;
+        } else if (argv[i][0] != '-' && path == NULL) {
+            path = argv[i] ;
+        } else {
+            fprintf(stderr, "Unknown option %s\n", argv[i]) ;
+            return EXIT_FAILURE ;
+        }
+    }
+    if (path == NULL) {
+        fprintf(stderr, "Usage: maze_solve [options] FILE\n") ;
+        return EXIT_FAILURE ;
+    }
+    if (nrows > 0 && !make_maze_file(path, nrows, ncols, seed, &opts)) {
+        return EXIT_FAILURE ;
+    }
+
+    int fd = open(path, O_RDONLY) ;
+    if (fd < 0) {
+        perror(path) ;
+        return EXIT_FAILURE ;
+    }
+    if (cold) {
+        fdatasync(fd) ;
+        posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED) ;
+    }
+    maze_t* m = map_maze_file(fd) ;
+    close(fd) ;
+    if (m == NULL) {
+        fprintf(stderr, "%s is not a maze file\n", path) ;
+        return EXIT_FAILURE ;
+    }
+
+    maze_fill_t stats ;
+    uint64_t* left = fill_dead_ends(m, &stats) ;
+    if (left == NULL) {
+        if (stats.corrupt) fprintf(stderr, "%s is corrupt\n", path) ;
+        else fprintf(stderr, "Not enough memory to solve %s\n", path) ;
+        free_maze(m) ;
+        return EXIT_FAILURE ;
+    }
+
+    double secs = stats.ns/1e9 ;
+    long long cells = (long long)get_nlevels(m)*get_nrows(m)*get_ncols(m) ;
+    printf("{\"file\": \"%s\", \"cells\": %lld, \"passes\": %llu, "
+            "\"filled\": %llu, \"left\": %llu, \"route_length\": %lld, "
+            "\"bytes_read\": %llu, \"bytes_in\": %llu, "
+            "\"major_faults\": %llu, \"seconds\": %.3f, "
+            "\"cells_per_sec\": %.4g}\n",
+            path, cells, (unsigned long long)stats.passes,
+            (unsigned long long)stats.filled,
+            (unsigned long long)stats.left,
+            is_perfect(m) ? (long long)stats.left-1 : -1LL,
+            (unsigned long long)stats.bytes_read,
+            (unsigned long long)stats.bytes_in,
+            (unsigned long long)stats.major_faults, secs,
+            secs > 0 ? cells/secs : 0) ;
+
+    free(left) ;
+    free_maze(m) ;
+    return EXIT_SUCCESS ;
+}
@@ -0,0 +1,332 @@
+/*  mazed:  serve mazes over a Unix domain socket.
+ *
+ *  Usage:  mazed [options]
+ *      --socket PATH: listen on PATH (default MAZED_SOCKET).
+ *      --cache-mb N: cache at most N megabytes of mazes (default 1024).
+ *      --threads N: serve on N threads (default one per processor).
+ *
+ *  See mazed.h for the protocol.  Each maze is made once, written to a
+ *  sealed memory file as a maze file, and cached under its request;
+ *  clients get a duplicate of the file's descriptor, so serving a cached
+ *  maze copies none of its cells.  The cache holds at most the given
+ *  number of bytes of mazes and drops the least recently served ones
+ *  first.  A dropped maze stays valid for the clients that have it, since
+ *  the file lives on until the last descriptor and mapping of it are
+ *  gone.
+ *
+ *  Connections are accepted on the main thread and queued for a pool of
+ *  threads, which read requests and make the mazes that are not cached.
+ *  A maze requested while another thread is making it is waited for
+ *  rather than made twice.
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "maze.h"
+#include "mazed.h"
+
+#define DEFAULT_CACHE_MB 1024
+
+// The most accepted connections waiting for a thread.
+#define MAX_WAITING 256
+
+/*  A cached maze.  Entries are kept in a list, most recently served
+ *  first.  An entry whose maze is being made has no file yet.
+ */
+typedef struct _entry_t {
+    mazed_request_t key ;
+    int fd ;
+    size_t bytes ;
+    struct _entry_t *prev, *next ;
+} entry_t ;
+
+/*  The cache, guarded by cache_lock.  made is signaled whenever a maze
+ *  being made is finished or given up on.
+ */
+static entry_t *lru_head = NULL, *lru_tail = NULL ;
+static size_t cache_bytes = 0, cache_budget ;
+static pthread_mutex_t cache_lock = PTHREAD_MUTEX_INITIALIZER ;
+static pthread_cond_t made = PTHREAD_COND_INITIALIZER ;
+
+/*  The accepted connections waiting for a thread, guarded by queue_lock.
+ */
+static int waiting[MAX_WAITING] ;
+static int waiting_head = 0, nwaiting = 0 ;
+static pthread_mutex_t queue_lock = PTHREAD_MUTEX_INITIALIZER ;
+static pthread_cond_t not_empty = PTHREAD_COND_INITIALIZER ;
+static pthread_cond_t not_full = PTHREAD_COND_INITIALIZER ;
+
+/*  Unlink an entry from the list.
+ */
+static void unlink_entry(entry_t* e) {
+    if (e->prev != NULL) e->prev->next = e->next ;
+    else lru_head = e->next ;
+    if (e->next != NULL) e->next->prev = e->prev ;
+    else lru_tail = e->prev ;
+}
+
+/*  Put an entry at the head of the list.
+ */
+static void push_entry(entry_t* e) {
+    e->prev = NULL ;
+    e->next = lru_head ;
+    if (lru_head != NULL) lru_head->prev = e ;
+    else lru_tail = e ;
+    lru_head = e ;
+}
+
+/*  Find the entry for a request, or NULL.
+ */
+static entry_t* find_entry(const mazed_request_t* req) {
+    for (entry_t* e=lru_head; e != NULL; e=e->next) {
+        if (memcmp(&e->key, req, sizeof(*req)) == 0) return e ;
+    }
+    return NULL ;
+}
+
+/*  Make the maze for a request and write it to a sealed memory file.
+ *
+ *  Returns the file descriptor, setting *bytes to the size of the file,
+ *  or -1, setting *error.
+ */
+static int make_maze_file(const mazed_request_t* req, size_t* bytes,
+        int* error) {
+    size_t ncells ;
+    if (req->nrows < 1 || req->ncols < 1 || req->nlevels < 1 ||
+            req->algorithm < MAZE_PRIM || req->algorithm > MAZE_SIDEWINDER) {
+        *error = EINVAL ;
+        return -1 ;
+    }
+    if (__builtin_mul_overflow((size_t)req->nlevels*req->nrows,
+                (size_t)req->ncols, &ncells) ||
+            ncells > cache_budget-MAZE_FILE_HEADER) {
+        *error = EFBIG ;
+        return -1 ;
+    }
+
+    maze_opts_t opts = {
+        MAZE_ROW_MAJOR, req->braid, req->nlevels, req->algorithm
+    } ;
+    maze_t* m = make_maze_opts(req->nrows, req->ncols, req->seed, &opts) ;
+    int fd = m != NULL ? memfd_create("maze", MFD_CLOEXEC|MFD_ALLOW_SEALING)
+        : -1 ;
+    bool written = fd >= 0 && write_maze_file(m, fd) ;
+    free_maze(m) ;
+    if (!written) {
+        if (fd >= 0) close(fd) ;
+        *error = ENOMEM ;
+        return -1 ;
+    }
+
+    // Seal the file so that no client can change the maze under another.
+    fcntl(fd, F_ADD_SEALS,
+            F_SEAL_SHRINK|F_SEAL_GROW|F_SEAL_WRITE|F_SEAL_SEAL) ;
+    *bytes = MAZE_FILE_HEADER + ncells ;
+    return fd ;
+}
+
+/*  Get the maze for a request, from the cache or by making it.
+ *
+ *  Returns a new file descriptor of the maze file, or -1, setting *error.
+ */
+static int get_maze(const mazed_request_t* req, int* error) {
+    pthread_mutex_lock(&cache_lock) ;
+    entry_t* e ;
+    while ((e = find_entry(req)) != NULL && e->fd < 0) {
+        pthread_cond_wait(&made, &cache_lock) ;
+    }
+    if (e != NULL) {
+        unlink_entry(e) ;
+        push_entry(e) ;
+        int fd = dup(e->fd) ;
+        pthread_mutex_unlock(&cache_lock) ;
+        if (fd < 0) *error = errno ;
+        return fd ;
+    }
+
+    // Claim the maze, so that other threads wait for it, and make it.
+    e = calloc(1, sizeof(entry_t)) ;
+    if (e == NULL) {
+        pthread_mutex_unlock(&cache_lock) ;
+        *error = ENOMEM ;
+        return -1 ;
+    }
+    e->key = *req ;
+    e->fd = -1 ;
+    push_entry(e) ;
+    pthread_mutex_unlock(&cache_lock) ;
+
+    size_t bytes ;
+    int fd = make_maze_file(req, &bytes, error) ;
+
+    pthread_mutex_lock(&cache_lock) ;
+    if (fd < 0) {
+        unlink_entry(e) ;
+        free(e) ;
+    } else {
+        // Drop the least recently served mazes until this one fits, or
+        // there are none left to drop.
+        entry_t* prev ;
+        for (entry_t* x=lru_tail; x != NULL && cache_bytes+bytes > cache_budget;
+                x=prev) {
+            prev = x->prev ;
+            if (x->fd < 0) continue ;
+            unlink_entry(x) ;
+            close(x->fd) ;
+            cache_bytes -= x->bytes ;
+            free(x) ;
+        }
+        e->fd = fd ;
+        e->bytes = bytes ;
+        cache_bytes += bytes ;
+        fd = dup(fd) ;
+        if (fd < 0) *error = errno ;
+    }
+    pthread_cond_broadcast(&made) ;
+    pthread_mutex_unlock(&cache_lock) ;
+    return fd ;
+}
+
+/*  Send a reply, with a file descriptor if fd is not -1.
+ */
+static bool send_reply(int conn, const mazed_reply_t* reply, int fd) {
+    struct iovec iov = {(void*)reply, sizeof(*reply)} ;
+    union {
+        struct cmsghdr h ;
+        char buf[CMSG_SPACE(sizeof(int))] ;
+    } control ;
+    struct msghdr msg = {.msg_iov = &iov, .msg_iovlen = 1} ;
+    if (fd >= 0) {
+        memset(&control, 0, sizeof(control)) ;
+        msg.msg_control = control.buf ;
+        msg.msg_controllen = sizeof(control.buf) ;
+        struct cmsghdr* c = CMSG_FIRSTHDR(&msg) ;
+        c->cmsg_level = SOL_SOCKET ;
+        c->cmsg_type = SCM_RIGHTS ;
+        c->cmsg_len = CMSG_LEN(sizeof(int)) ;
+        memcpy(CMSG_DATA(c), &fd, sizeof(int)) ;
+    }
+    return sendmsg(conn, &msg, MSG_NOSIGNAL) == sizeof(*reply) ;
+}
+
+/*  Read a whole request, returning false at the end of the connection.
+ */
+static bool read_request(int conn, mazed_request_t* req) {
+    char* p = (char*)req ;
+    size_t left = sizeof(*req) ;
+    while (left > 0) {
+        ssize_t n = recv(conn, p, left, 0) ;
+        if (n < 0 && errno == EINTR) continue ;
+        if (n <= 0) return false ;
+        p += n ;
+        left -= n ;
+    }
+    return true ;
+}
+
+/*  Serve the requests on a connection until the client closes it.
+ */
+static void serve(int conn) {
+    mazed_request_t req ;
+    while (read_request(conn, &req)) {
+        mazed_reply_t reply = {0} ;
+        int fd = get_maze(&req, &reply.error) ;
+        bool sent = send_reply(conn, &reply, fd) ;
+        if (fd >= 0) close(fd) ;
+        if (!sent) break ;
+    }
+    close(conn) ;
+}
+
+/*  A thread of the pool:  serve queued connections forever.
+ */
+static void* run_server(void* arg) {
+    while (true) {
+        pthread_mutex_lock(&queue_lock) ;
+        while (nwaiting == 0) pthread_cond_wait(&not_empty, &queue_lock) ;
+        int conn = waiting[waiting_head] ;
+        waiting_head = (waiting_head+1)%MAX_WAITING ;
+        nwaiting-- ;
+        pthread_cond_signal(&not_full) ;
+        pthread_mutex_unlock(&queue_lock) ;
+
+        serve(conn) ;
+    }
+    return NULL ;
+}
+
+int main(int argc, char **argv) {
+    const char* path = MAZED_SOCKET ;
+    size_t cache_mb = DEFAULT_CACHE_MB ;
+    int nthreads = sysconf(_SC_NPROCESSORS_ONLN) ;
+
+    for (int i=1; i<argc; ++i) {
+        if (strcmp(argv[i], "--socket") == 0 && i+1 < argc) {
+            path = argv[++i] ;
+        } else if (strcmp(argv[i], "--cache-mb") == 0 && i+1 < argc) {
+            cache_mb = atol(argv[++i]) ;
+        } else if (strcmp(argv[i], "--threads") == 0 && i+1 < argc) {
+            nthreads = atoi(argv[++i]) ;
+        } else {
+            fprintf(stderr, "Unknown option %s\n", argv[i]) ;
+            return EXIT_FAILURE ;
+        }
+    }
+    if (nthreads < 1) nthreads = 1 ;
+    cache_budget = cache_mb << 20 ;
+    if (cache_budget < MAZE_FILE_HEADER) cache_budget = MAZE_FILE_HEADER ;
+
+    struct sockaddr_un addr = {.sun_family = AF_UNIX} ;
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "Socket path too long: %s\n", path) ;
+        return EXIT_FAILURE ;
+    }
+    strcpy(addr.sun_path, path) ;
+
+    // Take over the socket of a daemon that is gone.
+    int sock = socket(AF_UNIX, SOCK_STREAM|SOCK_CLOEXEC, 0) ;
+    unlink(path) ;
+    if (sock < 0 || bind(sock, (struct sockaddr*)&addr, sizeof(addr)) < 0 ||
+            listen(sock, SOMAXCONN) < 0) {
+        perror(path) ;
+        return EXIT_FAILURE ;
+    }
+
+    for (int i=0; i<nthreads; ++i) {
+        pthread_t thread ;
+        pthread_create(&thread, NULL, run_server, NULL) ;
+        pthread_detach(thread) ;
+    }
+    fprintf(stderr, "mazed: serving on %s with %d threads and %zu MB of "
+            "cache\n", path, nthreads, cache_mb) ;
+
+    while (true) {
+        int conn = accept4(sock, NULL, NULL, SOCK_CLOEXEC) ;
+        if (conn < 0) {
+            if (errno != EINTR && errno != ECONNABORTED) perror("accept") ;
+            continue ;
+        }
+
+        pthread_mutex_lock(&queue_lock) ;
+        while (nwaiting == MAX_WAITING) {
+            pthread_cond_wait(&not_full, &queue_lock) ;
+        }
+        waiting[(waiting_head+nwaiting)%MAX_WAITING] = conn ;
+        nwaiting++ ;
+        pthread_cond_signal(&not_empty) ;
+        pthread_mutex_unlock(&queue_lock) ;
+    }
+}
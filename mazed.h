@@ -0,0 +1,69 @@
+/** @file mazed.h the maze daemon's protocol, and a client for it.
+ *
+ *  mazed serves mazes over a Unix domain socket, so that tools that need
+ *  the same mazes again and again can share them instead of each making
+ *  its own.  A client sends requests on a connection, one at a time, and
+ *  for each gets back a reply and, if the maze was made, the file
+ *  descriptor of a sealed memory file holding the maze as a maze file
+ *  (see maze.h), passed with SCM_RIGHTS.  Mapping that file makes the
+ *  maze without copying its cells, so a maze the daemon has cached is
+ *  fetched in about the time of a round trip on the socket, however big
+ *  it is.
+ */
+
+#ifndef MAZED_H
+#define MAZED_H
+
+#include <stdint.h>
+
+#include "maze.h"
+
+/** Where the daemon listens unless told otherwise.
+ */
+#define MAZED_SOCKET "/tmp/mazed.sock"
+
+/** A request for a maze.  Mazes made from equal requests are the same,
+ *  so the daemon keys its cache on the whole request.
+ */
+typedef struct _mazed_request_t {
+    int32_t nrows, ncols ;
+    int64_t seed ;
+
+    /** The options that choose which maze is made; see maze_opts_t.
+     *  Served mazes are always row-major, so there is no layout.
+     */
+    float braid ;
+    int32_t nlevels ;
+    int32_t algorithm ;
+} mazed_request_t ;
+
+/** The reply to a request.
+ */
+typedef struct _mazed_reply_t {
+    /** 0 if the maze was made, in which case a file descriptor comes
+     *  with the reply; otherwise an errno value:  EINVAL for a bad size
+     *  or algorithm, EFBIG for a maze bigger than the daemon's cache, or
+     *  ENOMEM.
+     */
+    int32_t error ;
+} mazed_reply_t ;
+
+/** Fetch a maze from the daemon.  The maze is the same as
+ *  <code>make_maze_opts</code> would make, except that it is always
+ *  row-major, and its cells are shared with the daemon and other clients.
+ *
+ *  @param path the daemon's socket, or <code>NULL</code> for
+ *      <code>MAZED_SOCKET</code>.
+ *  @param nrows the number of rows for the maze.
+ *  @param ncols the number of columns for the maze.
+ *  @param seed the seed for the maze.
+ *  @param opts the options, or <code>NULL</code> for the defaults.
+ *
+ *  @return the maze, which is freed by <code>free_maze</code>, or
+ *      <code>NULL</code> if the daemon could not be reached or did not
+ *      make the maze; callers may then make it themselves.
+ */
+maze_t* fetch_maze(const char* path, int nrows, int ncols, long seed,
+        const maze_opts_t* opts) ;
+
+#endif
@@ -0,0 +1,72 @@
+/** mazed_client.c:  fetching mazes from the maze daemon.
+ */
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "maze.h"
+#include "mazed.h"
+
+/** Fetch a maze from the daemon; see mazed.h.
+ */
+maze_t* fetch_maze(const char* path, int nrows, int ncols, long seed,
+        const maze_opts_t* opts) {
+    if (path == NULL) path = MAZED_SOCKET ;
+    struct sockaddr_un addr = {.sun_family = AF_UNIX} ;
+    if (strlen(path) >= sizeof(addr.sun_path)) return NULL ;
+    strcpy(addr.sun_path, path) ;
+
+    int sock = socket(AF_UNIX, SOCK_STREAM|SOCK_CLOEXEC, 0) ;
+    if (sock < 0) return NULL ;
+    if (connect(sock, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+        close(sock) ;
+        return NULL ;
+    }
+
+    mazed_request_t req ;
+    memset(&req, 0, sizeof(req)) ;
+    req.nrows = nrows ;
+    req.ncols = ncols ;
+    req.seed = seed ;
+    req.braid = opts != NULL ? opts->braid : 0 ;
+    req.nlevels = opts != NULL && opts->nlevels > 1 ? opts->nlevels : 1 ;
+    req.algorithm = opts != NULL ? opts->algorithm : MAZE_PRIM ;
+    if (send(sock, &req, sizeof(req), MSG_NOSIGNAL) != sizeof(req)) {
+        close(sock) ;
+        return NULL ;
+    }
+
+    // The reply, with the file descriptor of the maze file if it was
+    // made.
+    mazed_reply_t reply ;
+    struct iovec iov = {&reply, sizeof(reply)} ;
+    union {
+        struct cmsghdr h ;
+        char buf[CMSG_SPACE(sizeof(int))] ;
+    } control ;
+    struct msghdr msg = {
+        .msg_iov = &iov, .msg_iovlen = 1,
+        .msg_control = control.buf, .msg_controllen = sizeof(control.buf)
+    } ;
+    ssize_t n = recvmsg(sock, &msg, MSG_CMSG_CLOEXEC) ;
+    close(sock) ;
+
+    int fd = -1 ;
+    struct cmsghdr* c = CMSG_FIRSTHDR(&msg) ;
+    if (n > 0 && c != NULL && c->cmsg_level == SOL_SOCKET &&
+            c->cmsg_type == SCM_RIGHTS) {
+        memcpy(&fd, CMSG_DATA(c), sizeof(int)) ;
+    }
+    if (n != sizeof(reply) || reply.error != 0 || fd < 0) {
+        if (fd >= 0) close(fd) ;
+        return NULL ;
+    }
+
+    maze_t* m = map_maze_file(fd) ;
+    close(fd) ;
+    return m ;
+}
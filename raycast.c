@@ -0,0 +1,278 @@
+/** raycast.c:  a multi-threaded CPU raycaster for mazes.
+ *
+ *  Each frame is split into vertical strips of columns, one per thread.
+ *  The calling thread draws the first strip itself and a pool of worker
+ *  threads draws the rest; the workers sleep between frames.
+ */
+
+#include <math.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdlib.h>
+
+#include "maze.h"
+#include "raycast.h"
+
+#define D2R(x) ((x)*M_PI/180.0)     // Convert degrees to radians.
+
+// Colors.
+#define CEILING_RGB 0, 0, 0
+#define FLOOR_RGB 40, 40, 40
+#define WALL_BLUE 255
+
+/** A worker thread's argument:  the raycaster and which strip to draw.
+ */
+typedef struct _worker_t {
+    raycaster_t* rc ;
+    int strip ;
+} worker_t ;
+
+/** Type of a raycaster.
+ */
+struct _raycaster_t {
+    /** The framebuffer:  width*height RGBA pixels, bottom row first.
+     */
+    unsigned char* pixels ;
+    int width, height ;
+
+    /** The view being drawn.
+     */
+    maze_t* maze ;
+    float x, y, z, theta, fov_y ;
+
+    /** The thread pool.  Workers wait on work_ready until frame changes,
+     *  draw their strip, and signal work_done when pending reaches 0.
+     */
+    int nthreads ;
+    pthread_t* threads ;
+    worker_t* workers ;
+    pthread_mutex_t lock ;
+    pthread_cond_t work_ready ;
+    pthread_cond_t work_done ;
+    unsigned long frame ;
+    int pending ;
+    bool quit ;
+} ;
+
+static void* run_worker(void* arg) ;
+
+/** Make a raycaster; see raycast.h.
+ */
+raycaster_t* make_raycaster(int width, int height, int nthreads) {
+    raycaster_t* rc = calloc(1, sizeof(raycaster_t)) ;
+    if (rc == NULL) return NULL ;
+    rc->width = width ;
+    rc->height = height ;
+    rc->pixels = malloc(width*height*4) ;
+    rc->nthreads = nthreads < 1 ? 1 : nthreads ;
+    rc->threads = malloc(rc->nthreads*sizeof(pthread_t)) ;
+    rc->workers = malloc(rc->nthreads*sizeof(worker_t)) ;
+    if (rc->pixels == NULL || rc->threads == NULL || rc->workers == NULL) {
+        free(rc->pixels) ;
+        free(rc->threads) ;
+        free(rc->workers) ;
+        free(rc) ;
+        return NULL ;
+    }
+
+    pthread_mutex_init(&rc->lock, NULL) ;
+    pthread_cond_init(&rc->work_ready, NULL) ;
+    pthread_cond_init(&rc->work_done, NULL) ;
+
+    // Strip 0 belongs to the calling thread.
+    for (int i=1; i<rc->nthreads; ++i) {
+        rc->workers[i] = (worker_t){rc, i} ;
+        pthread_create(&rc->threads[i], NULL, run_worker, &rc->workers[i]) ;
+    }
+
+    return rc ;
+}
+
+/** Free a raycaster; see raycast.h.
+ */
+void free_raycaster(raycaster_t* rc) {
+    pthread_mutex_lock(&rc->lock) ;
+    rc->quit = true ;
+    pthread_cond_broadcast(&rc->work_ready) ;
+    pthread_mutex_unlock(&rc->lock) ;
+    for (int i=1; i<rc->nthreads; ++i) pthread_join(rc->threads[i], NULL) ;
+
+    pthread_mutex_destroy(&rc->lock) ;
+    pthread_cond_destroy(&rc->work_ready) ;
+    pthread_cond_destroy(&rc->work_done) ;
+    free(rc->pixels) ;
+    free(rc->threads) ;
+    free(rc->workers) ;
+    free(rc) ;
+}
+
+/** Resize the framebuffer; see raycast.h.  Only called between frames, so
+ *  no worker is touching the pixels.
+ */
+void resize_raycaster(raycaster_t* rc, int width, int height) {
+    unsigned char* pixels = realloc(rc->pixels, width*height*4) ;
+    if (pixels == NULL) return ;
+    rc->pixels = pixels ;
+    rc->width = width ;
+    rc->height = height ;
+}
+
+/** Get the framebuffer; see raycast.h.
+ */
+const unsigned char* get_raycast_pixels(raycaster_t* rc) {
+    return rc->pixels ;
+}
+
+/** Set a pixel in the framebuffer.
+ */
+static inline void put_pixel(raycaster_t* rc, int col, int row,
+        unsigned char r, unsigned char g, unsigned char b) {
+    unsigned char* p = rc->pixels + 4*(row*rc->width + col) ;
+    p[0] = r ; p[1] = g ; p[2] = b ; p[3] = 255 ;
+}
+
+/** Draw one column of the frame.  The ray for the column is walked from
+ *  the eye through the grid a cell boundary at a time until it crosses a
+ *  wall; since the exterior of the maze is walled, every ray that starts
+ *  inside the maze stops.
+ *
+ *  @param rc the raycaster.
+ *  @param col the column to draw.
+ */
+static void draw_column(raycaster_t* rc, int col) {
+    maze_t* m = rc->maze ;
+    int nrows = get_nlevels(m)*get_nrows(m) ;
+    int ncols = get_ncols(m) ;
+    const unsigned char* cells = get_row_span(m, 0, nrows) ;
+
+    // Ray direction:  the view direction plus a multiple of the direction
+    // to the right of the screen, so that the forward component is 1 and
+    // distances along the ray are distances from the view plane.
+    float aspect = (float)rc->width/rc->height ;
+    float plane = tan(D2R(rc->fov_y/2))*aspect ;
+    float cam = 2.0f*(col+0.5f)/rc->width - 1.0f ;
+    float ct = cos(D2R(rc->theta)), st = sin(D2R(rc->theta)) ;
+    float dx = ct + st*cam*plane ;
+    float dz = -st + ct*cam*plane ;
+
+    int r = (int)floorf(rc->x) ;
+    int c = (int)floorf(rc->z) ;
+    float dist = INFINITY ;
+    bool x_side = false ;
+
+    if (r >= 0 && r < nrows && c >= 0 && c < ncols) {
+        float delta_x = dx == 0.0f ? INFINITY : fabsf(1.0f/dx) ;
+        float delta_z = dz == 0.0f ? INFINITY : fabsf(1.0f/dz) ;
+        int step_x = dx < 0 ? -1 : 1 ;
+        int step_z = dz < 0 ? -1 : 1 ;
+        unsigned char dir_x = dx < 0 ? SOUTH : NORTH ;
+        unsigned char dir_z = dz < 0 ? WEST : EAST ;
+        float side_x = (dx < 0 ? rc->x-r : r+1-rc->x)*delta_x ;
+        float side_z = (dz < 0 ? rc->z-c : c+1-rc->z)*delta_z ;
+
+        while (r >= 0 && r < nrows && c >= 0 && c < ncols) {
+            unsigned char p = cells[(size_t)r*ncols + c] ;
+            if (side_x < side_z) {
+                if (!(p & dir_x)) {
+                    dist = side_x ;
+                    x_side = true ;
+                    break ;
+                }
+                side_x += delta_x ;
+                r += step_x ;
+            }
+            else {
+                if (!(p & dir_z)) {
+                    dist = side_z ;
+                    break ;
+                }
+                side_z += delta_z ;
+                c += step_z ;
+            }
+        }
+    }
+
+    // Project the bottom (y=0) and top (y=1) of the wall onto the screen.
+    // Rows are counted from the bottom.
+    float focal = (rc->height/2.0f)/tan(D2R(rc->fov_y/2)) ;
+    float center = rc->height/2.0f ;
+    int bottom = rc->height, top = rc->height ;
+    if (dist < INFINITY && dist > 0.0f) {
+        bottom = (int)(center + (0.0f-rc->y)/dist*focal) ;
+        top = (int)(center + (1.0f-rc->y)/dist*focal) ;
+    }
+
+    // Shade the wall by which way it faces and how far away it is.
+    float shade = (x_side ? 1.0f : 0.7f)/(1.0f + 0.1f*dist) ;
+    unsigned char blue = (unsigned char)(WALL_BLUE*shade) ;
+
+    for (int row=0; row<rc->height; ++row) {
+        if (row < bottom) put_pixel(rc, col, row, FLOOR_RGB) ;
+        else if (row < top) put_pixel(rc, col, row, 0, 0, blue) ;
+        else put_pixel(rc, col, row, CEILING_RGB) ;
+    }
+}
+
+/** Draw one strip of columns of the current frame.
+ *
+ *  @param rc the raycaster.
+ *  @param strip the strip, from 0 to <code>rc->nthreads-1</code>.
+ */
+static void draw_strip(raycaster_t* rc, int strip) {
+    int first = strip*rc->width/rc->nthreads ;
+    int last = (strip+1)*rc->width/rc->nthreads ;
+    for (int col=first; col<last; ++col) draw_column(rc, col) ;
+}
+
+/** Worker thread:  draw this worker's strip of every frame.
+ *
+ *  @param arg the <code>worker_t</code> for this thread.
+ */
+static void* run_worker(void* arg) {
+    worker_t* w = arg ;
+    raycaster_t* rc = w->rc ;
+    unsigned long seen = 0 ;
+
+    pthread_mutex_lock(&rc->lock) ;
+    while (true) {
+        while (!rc->quit && rc->frame == seen) {
+            pthread_cond_wait(&rc->work_ready, &rc->lock) ;
+        }
+        if (rc->quit) break ;
+        seen = rc->frame ;
+        pthread_mutex_unlock(&rc->lock) ;
+
+        draw_strip(rc, w->strip) ;
+
+        pthread_mutex_lock(&rc->lock) ;
+        if (--rc->pending == 0) pthread_cond_signal(&rc->work_done) ;
+    }
+    pthread_mutex_unlock(&rc->lock) ;
+
+    return NULL ;
+}
+
+/** Draw a frame; see raycast.h.
+ */
+void raycast(raycaster_t* rc, maze_t* m, float x, float y, float z,
+        float theta, float fov_y) {
+    rc->maze = m ;
+    rc->x = x ;
+    rc->y = y ;
+    rc->z = z ;
+    rc->theta = theta ;
+    rc->fov_y = fov_y ;
+
+    // Wake the workers, draw our own strip, then wait for theirs.
+    pthread_mutex_lock(&rc->lock) ;
+    rc->pending = rc->nthreads-1 ;
+    rc->frame++ ;
+    pthread_cond_broadcast(&rc->work_ready) ;
+    pthread_mutex_unlock(&rc->lock) ;
+
+    draw_strip(rc, 0) ;
+
+    pthread_mutex_lock(&rc->lock) ;
+    while (rc->pending > 0) pthread_cond_wait(&rc->work_done, &rc->lock) ;
+    pthread_mutex_unlock(&rc->lock) ;
+}
@@ -0,0 +1,73 @@
+/** @file raycast.h a multi-threaded CPU raycaster for mazes.
+ *
+ *  The raycaster draws a first-person view of a maze into a framebuffer
+ *  by casting one ray per screen column and walking it through the maze
+ *  grid (DDA) until it reaches a wall.  Columns are split among a pool of
+ *  threads.  The cost of a frame depends only on the framebuffer size and
+ *  how far the rays travel, not on the size of the maze.
+ *
+ *  Positions use the same frame as the 3D maze view:  x runs along rows
+ *  and z along columns, so the cell at row r and column c covers
+ *  [r, r+1) x [c, c+1).  A heading of theta degrees looks in direction
+ *  (cos theta, -sin theta) in (x, z).  Walls are 1 unit high, stand on
+ *  y=0, and are treated as having no thickness.
+ */
+
+#ifndef RAYCAST_H
+#define RAYCAST_H
+
+#include "maze.h"
+
+/** The type of a raycaster.
+ */
+typedef struct _raycaster_t raycaster_t ;
+
+/** Make a raycaster.
+ *
+ *  @param width the width of the framebuffer in pixels.
+ *  @param height the height of the framebuffer in pixels.
+ *  @param nthreads the number of threads to draw with (at least 1).
+ *
+ *  @return the raycaster, or <code>NULL</code> if it could not be made.
+ */
+raycaster_t* make_raycaster(int width, int height, int nthreads) ;
+
+/** Stop a raycaster's threads and free it.
+ *
+ *  @param rc a raycaster.
+ */
+void free_raycaster(raycaster_t* rc) ;
+
+/** Change the size of a raycaster's framebuffer.
+ *
+ *  @param rc a raycaster.
+ *  @param width the new width in pixels.
+ *  @param height the new height in pixels.
+ */
+void resize_raycaster(raycaster_t* rc, int width, int height) ;
+
+/** Draw a view of a maze into a raycaster's framebuffer.  Returns once
+ *  every column has been drawn.
+ *
+ *  @param rc a raycaster.
+ *  @param m the maze.
+ *  @param x the x-coordinate of the eye.  For a layered maze, the rows
+ *      of all levels are counted, as in maze.h.
+ *  @param y the height of the eye above the floor of its level.
+ *  @param z the z-coordinate of the eye.
+ *  @param theta the heading in degrees.
+ *  @param fov_y the vertical field of view in degrees.
+ */
+void raycast(raycaster_t* rc, maze_t* m, float x, float y, float z,
+        float theta, float fov_y) ;
+
+/** Get a raycaster's framebuffer.  Pixels are RGBA bytes, bottom row
+ *  first, as expected by <code>glTexImage2D</code>.
+ *
+ *  @param rc a raycaster.
+ *
+ *  @return the pixels of the last frame drawn.
+ */
+const unsigned char* get_raycast_pixels(raycaster_t* rc) ;
+
+#endif
@@ -8,6 +8,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdbool.h>
+#include <math.h>
 #include <time.h>
 
 #ifdef __MACOSX__
@@ -22,6 +23,7 @@
 #endif
 
 #include "maze.h"
+#include "maze_image.h"
 
 #define DEFAULT_WINDOW_WIDTH 500
 #define DEFAULT_WINDOW_HEIGHT 500
@@ -29,9 +31,29 @@
 #define DEFAULT_WINDOW_YORIG 0
 #define WINDOW_TITLE "2D maze visualization"
 
-/*  The maze itself
+// How much one key press zooms or pans by.
+#define ZOOM_STEP 1.25
+#define PAN_STEP 0.1
+
+/*  The maze itself and its image.
  */
 maze_t* maze ;
+maze_image_t* maze_image ;
+
+/*  The view:  the maze point at the center of the window and the
+ *  number of window pixels per cell.
+ */
+double view_x, view_y ;
+double zoom ;
+int win_width = DEFAULT_WINDOW_WIDTH ;
+int win_height = DEFAULT_WINDOW_HEIGHT ;
+
+/*  The streaming texture.  It is the size of the window (plus a pixel of
+ *  slack on each side), and each redraw uploads just the part of one
+ *  image level that is in view.
+ */
+GLuint view_texture ;
+int tex_width = 0, tex_height = 0 ;
 
 // GL initialization.
 void init_gl(int, int) ;
@@ -40,13 +62,18 @@ void init_gl(int, int) ;
 void initialize_maze(int, int) ;
 void draw_maze() ;
 
+// Resize and keyboard callbacks:  zoom and pan.
+void handle_resize(int, int) ;
+void handle_key(unsigned char, int, int) ;
+void handle_special_key(int, int, int) ;
+
 
 int main(int argc, char **argv)
 {
     // Handle command line arguments.
 
     // Set up the window---notice these are all GLUT calls.
-    glutInitDisplayMode(GLUT_SINGLE | GLUT_RGB) ;
+    glutInitDisplayMode(GLUT_DOUBLE | GLUT_RGB) ;
     glutInitWindowSize(DEFAULT_WINDOW_WIDTH, DEFAULT_WINDOW_HEIGHT) ;
     glutInitWindowPosition(DEFAULT_WINDOW_XORIG, DEFAULT_WINDOW_YORIG) ;
     glutInit(&argc, argv) ;
@@ -58,6 +85,11 @@ int main(int argc, char **argv)
     // re-drawn.
     glutDisplayFunc(draw_maze) ;
 
+    // Zoom with + and -, pan with the arrow keys.
+    glutReshapeFunc(handle_resize) ;
+    glutKeyboardFunc(handle_key) ;
+    glutSpecialFunc(handle_special_key) ;
+
     // Initialize the maze.
     int maze_width = atoi(argv[1]) ;
     int maze_height = atoi(argv[2]) ;
@@ -73,36 +105,108 @@ int main(int argc, char **argv)
     return 0 ;
 }
 
-/* Initialize OpenGL.  Set our world frame to be the width and height
- * of the maze.
+/* Initialize OpenGL.  Start with a view of the whole maze, with a
+ * cell of margin around it.
  */
 void init_gl(int maze_width, int maze_height) {
     // Background color.
     glClearColor(1.0, 1.0, 1.0, 1.0) ;
 
-    // 2D orthographic projection.
-    glMatrixMode(GL_PROJECTION) ;
-    glLoadIdentity() ;
-    gluOrtho2D(-1.0, maze_width+1, -1.0, maze_height+1) ;
+    view_x = maze_width/2.0 ;
+    view_y = maze_height/2.0 ;
+    double zx = (double)win_width/(maze_width+2) ;
+    double zy = (double)win_height/(maze_height+2) ;
+    zoom = zx < zy ? zx : zy ;
+
+    // The image is drawn as coverage in the alpha channel, blended over
+    // the background in the wall color.
+    glGenTextures(1, &view_texture) ;
+    glBindTexture(GL_TEXTURE_2D, view_texture) ;
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST) ;
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST) ;
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE) ;
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE) ;
+    glTexEnvi(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_MODULATE) ;
+    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA) ;
 }
 
-/*  Initialize the maze by building all possible walls.
+/*  Initialize the maze and rasterize it.
  */
 void initialize_maze(int maze_height, int maze_width) {
 
     maze = make_maze(maze_height, maze_width, time(NULL)) ;
+    if (maze == NULL) {
+        fprintf(stderr, "Not enough memory for the maze.\n") ;
+        exit(EXIT_FAILURE) ;
+    }
+    maze_image = make_maze_image(maze) ;
+    if (maze_image == NULL) {
+        fprintf(stderr, "Not enough memory for the maze image.\n") ;
+        exit(EXIT_FAILURE) ;
+    }
+
+}
 
+/*  Record the new window size, set the viewport, and reallocate the
+ *  streaming texture to match.
+ */
+void handle_resize(int width, int height) {
+    win_width = width ;
+    win_height = height ;
+    glViewport(0, 0, width, height) ;
+
+    tex_width = width+2 ;
+    tex_height = height+2 ;
+    glBindTexture(GL_TEXTURE_2D, view_texture) ;
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_ALPHA, tex_width, tex_height, 0,
+            GL_ALPHA, GL_UNSIGNED_BYTE, NULL) ;
+}
+
+/*  + (or =) zooms in, - zooms out.
+ */
+void handle_key(unsigned char key, int x, int y) {
+    if (key == '+' || key == '=') zoom *= ZOOM_STEP ;
+    else if (key == '-') zoom /= ZOOM_STEP ;
+    else return ;
+    glutPostRedisplay() ;
 }
 
+/*  The arrow keys pan by a fraction of the window.
+ */
+void handle_special_key(int key, int x, int y) {
+    double dx = PAN_STEP*win_width/zoom ;
+    double dy = PAN_STEP*win_height/zoom ;
+    switch (key) {
+        case GLUT_KEY_LEFT: view_x -= dx ; break ;
+        case GLUT_KEY_RIGHT: view_x += dx ; break ;
+        case GLUT_KEY_DOWN: view_y -= dy ; break ;
+        case GLUT_KEY_UP: view_y += dy ; break ;
+        default: return ;
+    }
+    glutPostRedisplay() ;
+}
+
+/*  Draw the maze.  Choose the coarsest image level whose pixels are
+ *  still at least one window pixel across, upload the part of that level
+ *  that is in view into the streaming texture, and draw it on one quad.
+ *  This touches about one image pixel per window pixel, however big the
+ *  maze is.
+ */
 void draw_maze() {
     glClear(GL_COLOR_BUFFER_BIT) ;
 
+    // The visible part of the world.
+    double left = view_x - win_width/(2*zoom) ;
+    double right = view_x + win_width/(2*zoom) ;
+    double bottom = view_y - win_height/(2*zoom) ;
+    double top = view_y + win_height/(2*zoom) ;
+    glMatrixMode(GL_PROJECTION) ;
+    glLoadIdentity() ;
+    gluOrtho2D(left, right, bottom, top) ;
+
     cell_t* maze_start = get_start(maze) ;
     cell_t* maze_end = get_end(maze) ;
 
-    int maze_width = get_ncols(maze) ;
-    int maze_height = get_nrows(maze) ;
-
     // Draw the start and end cell.
     glBegin(GL_QUADS) ;
     glColor3f(0, 1, 0) ;
@@ -117,32 +221,58 @@ void draw_maze() {
     glVertex2i(maze_end->c, maze_end->r+1) ;
     glEnd() ;
 
-    // Draw the walls.  First draw the west and south exterior walls, then
-    // draw any north or west walls of each cell.
-    glColor3f(1.0, 0.0, 0.0) ;
-    glBegin(GL_LINES) ;
-    glVertex2i(0, 0) ;
-    glVertex2i(0, maze_height) ;
-    glVertex2i(0, 0) ;
-    glVertex2i(maze_width, 0) ;
-    for (int i=0; i<maze_width; ++i) {
-        for (int j=0; j<maze_height; ++j) {
-            if (has_wall(maze, get_cell(maze, j, i), NORTH)) {
-                glVertex2i(i, j+1) ;
-                glVertex2i(i+1, j+1) ;
-            }
-            if (has_wall(maze, get_cell(maze, j, i), EAST)) {
-                glVertex2i(i+1, j+1) ;
-                glVertex2i(i+1, j) ;
-            }
-        }
+    // Level l pixels are 2^l level 0 pixels, which are half a cell.
+    int level = 0 ;
+    double pixel_size = 0.5 ;
+    while (level < maze_image->nlevels-1 && pixel_size*zoom < 1.0) {
+        level++ ;
+        pixel_size *= 2 ;
+    }
+    int lw = maze_image->widths[level] ;
+    int lh = maze_image->heights[level] ;
+
+    // The pixels of the level in view, clipped to the image and texture.
+    int x0 = (int)floor((left+0.25)/pixel_size) ;
+    int x1 = (int)ceil((right+0.25)/pixel_size) ;
+    int y0 = (int)floor((bottom+0.25)/pixel_size) ;
+    int y1 = (int)ceil((top+0.25)/pixel_size) ;
+    if (x0 < 0) x0 = 0 ;
+    if (y0 < 0) y0 = 0 ;
+    if (x1 > lw) x1 = lw ;
+    if (y1 > lh) y1 = lh ;
+    if (x1 > x0+tex_width) x1 = x0+tex_width ;
+    if (y1 > y0+tex_height) y1 = y0+tex_height ;
+
+    if (x1 > x0 && y1 > y0) {
+        glBindTexture(GL_TEXTURE_2D, view_texture) ;
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 1) ;
+        glPixelStorei(GL_UNPACK_ROW_LENGTH, lw) ;
+        glPixelStorei(GL_UNPACK_SKIP_PIXELS, x0) ;
+        glPixelStorei(GL_UNPACK_SKIP_ROWS, y0) ;
+        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, x1-x0, y1-y0, GL_ALPHA,
+                GL_UNSIGNED_BYTE, maze_image->levels[level]) ;
+        glPixelStorei(GL_UNPACK_ROW_LENGTH, 0) ;
+        glPixelStorei(GL_UNPACK_SKIP_PIXELS, 0) ;
+        glPixelStorei(GL_UNPACK_SKIP_ROWS, 0) ;
+
+        // Draw the walls.
+        double s = (double)(x1-x0)/tex_width ;
+        double t = (double)(y1-y0)/tex_height ;
+        double wx0 = x0*pixel_size-0.25, wx1 = x1*pixel_size-0.25 ;
+        double wy0 = y0*pixel_size-0.25, wy1 = y1*pixel_size-0.25 ;
+        glEnable(GL_TEXTURE_2D) ;
+        glEnable(GL_BLEND) ;
+        glColor3f(1.0, 0.0, 0.0) ;
+        glBegin(GL_QUADS) ;
+        glTexCoord2d(0, 0) ; glVertex2d(wx0, wy0) ;
+        glTexCoord2d(s, 0) ; glVertex2d(wx1, wy0) ;
+        glTexCoord2d(s, t) ; glVertex2d(wx1, wy1) ;
+        glTexCoord2d(0, t) ; glVertex2d(wx0, wy1) ;
+        glEnd() ;
+        glDisable(GL_BLEND) ;
+        glDisable(GL_TEXTURE_2D) ;
     }
-    glEnd() ;
 
-    glFlush() ;
+    glutSwapBuffers() ;
 
 }
-
-
-
-
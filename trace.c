@@ -0,0 +1,202 @@
+/** trace.c:  per-thread ring buffers of trace events.
+ *
+ *  Each thread that records an event takes a ring of its own on its
+ *  first event and gives it back when it exits, so that threads made
+ *  again and again (such as maze generators) reuse rings instead of
+ *  piling up new ones.  Rings are never freed, and a reused ring keeps
+ *  the events of the threads that had it before.  The list of rings only
+ *  grows, at its head, so it can be walked without a lock.
+ */
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "trace.h"
+
+// The events each ring holds; a power of two.
+#define RING_EVENTS (1 << 16)
+
+/** Type of a trace event.
+ */
+typedef struct _event_t {
+    /** The time of the event in nanoseconds of the monotonic clock.
+     */
+    uint64_t ts ;
+
+    const char* name ;
+    long long arg ;
+
+    /** The thread that recorded the event.
+     */
+    uint32_t tid ;
+
+    unsigned short cat ;
+    char phase ;
+} event_t ;
+
+/** Type of a ring of events.
+ */
+typedef struct _ring_t {
+    event_t events[RING_EVENTS] ;
+
+    /** The number of events ever recorded into the ring.  Only the owning
+     *  thread writes it, after the event itself.
+     */
+    uint64_t head ;
+
+    /** Whether a thread owns the ring, and the trace id of that thread.
+     */
+    int owned ;
+    uint32_t tid ;
+
+    struct _ring_t* next ;
+} ring_t ;
+
+unsigned trace_mask = 0 ;
+
+// Every ring ever made, newest first.
+static ring_t* rings = NULL ;
+
+// The trace ids given to threads so far.
+static uint32_t ntids = 0 ;
+
+// The calling thread's ring, and a key whose destructor gives it back.
+static __thread ring_t* thread_ring = NULL ;
+static pthread_key_t ring_key ;
+static pthread_once_t ring_key_once = PTHREAD_ONCE_INIT ;
+
+// The names of the categories, by bit.
+static const char* cat_names[] = {"debug", "frame", "world"} ;
+
+/** Give a thread's ring back when the thread exits.
+ *
+ *  @param ring the ring.
+ */
+static void release_ring(void* ring) {
+    __atomic_store_n(&((ring_t*)ring)->owned, 0, __ATOMIC_RELEASE) ;
+}
+
+/** Make the key that gives rings back.
+ */
+static void make_ring_key() {
+    pthread_key_create(&ring_key, release_ring) ;
+}
+
+/** Get the calling thread's ring, taking a free one or making one if it
+ *  has none yet.
+ *
+ *  @return the ring, or <code>NULL</code> if there is no memory for one.
+ */
+static ring_t* get_ring() {
+    if (thread_ring != NULL) return thread_ring ;
+
+    pthread_once(&ring_key_once, make_ring_key) ;
+
+    ring_t* ring ;
+    for (ring = __atomic_load_n(&rings, __ATOMIC_ACQUIRE); ring != NULL;
+            ring = ring->next) {
+        int free = 0 ;
+        if (__atomic_compare_exchange_n(&ring->owned, &free, 1, false,
+                    __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) break ;
+    }
+
+    if (ring == NULL) {
+        ring = calloc(1, sizeof(ring_t)) ;
+        if (ring == NULL) return NULL ;
+        ring->owned = 1 ;
+        ring->next = __atomic_load_n(&rings, __ATOMIC_RELAXED) ;
+        while (!__atomic_compare_exchange_n(&rings, &ring->next, ring, true,
+                    __ATOMIC_RELEASE, __ATOMIC_RELAXED)) ;
+    }
+
+    ring->tid = __atomic_add_fetch(&ntids, 1, __ATOMIC_RELAXED) ;
+    pthread_setspecific(ring_key, ring) ;
+    thread_ring = ring ;
+    return ring ;
+}
+
+/** Record an event; see trace.h.
+ */
+void trace_record(unsigned cat, char phase, const char* name, long long arg) {
+    ring_t* ring = get_ring() ;
+    if (ring == NULL) return ;
+
+    struct timespec now ;
+    clock_gettime(CLOCK_MONOTONIC, &now) ;
+
+    uint64_t head = ring->head ;
+    event_t* e = &ring->events[head & (RING_EVENTS-1)] ;
+    e->ts = now.tv_sec*1000000000ull + now.tv_nsec ;
+    e->name = name ;
+    e->arg = arg ;
+    e->tid = ring->tid ;
+    e->cat = cat ;
+    e->phase = phase ;
+    __atomic_store_n(&ring->head, head+1, __ATOMIC_RELEASE) ;
+}
+
+/** Write a string as a JSON string literal.
+ *
+ *  @param f the file to write to.
+ *  @param s the string.
+ */
+static void write_json_string(FILE* f, const char* s) {
+    fputc('"', f) ;
+    for (; *s != '\0'; ++s) {
+        if (*s == '"' || *s == '\\') fprintf(f, "\\%c", *s) ;
+        else if ((unsigned char)*s < 0x20) fprintf(f, "\\u%04x", *s) ;
+        else fputc(*s, f) ;
+    }
+    fputc('"', f) ;
+}
+
+/** Get the name of the first category in a mask.
+ *
+ *  @param cat a mask with at least one category.
+ *
+ *  @return the name of the lowest category in <code>cat</code>.
+ */
+static const char* cat_name(unsigned cat) {
+    int bit = __builtin_ctz(cat) ;
+    return bit < sizeof(cat_names)/sizeof(cat_names[0]) ?
+        cat_names[bit] : "other" ;
+}
+
+/** Write the trace as a Chrome trace; see trace.h.
+ */
+bool trace_dump(const char* path) {
+    FILE* f = fopen(path, "w") ;
+    if (f == NULL) return false ;
+
+    int pid = getpid() ;
+    bool first = true ;
+    fprintf(f, "{\"traceEvents\":[\n") ;
+    for (ring_t* ring = __atomic_load_n(&rings, __ATOMIC_ACQUIRE);
+            ring != NULL; ring = ring->next) {
+        uint64_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) ;
+        uint64_t tail = head > RING_EVENTS ? head-RING_EVENTS : 0 ;
+        for (uint64_t i=tail; i<head; ++i) {
+            event_t* e = &ring->events[i & (RING_EVENTS-1)] ;
+            fprintf(f, "%s{\"name\":", first ? "" : ",\n") ;
+            write_json_string(f, e->name) ;
+            fprintf(f, ",\"cat\":\"%s\",\"ph\":\"%c\",\"ts\":%.3f,"
+                    "\"pid\":%d,\"tid\":%u", cat_name(e->cat), e->phase,
+                    e->ts/1000.0, pid, e->tid) ;
+            if (e->phase == 'i') {
+                fprintf(f, ",\"s\":\"t\",\"args\":{\"arg\":%lld}", e->arg) ;
+            } else if (e->phase == 'C') {
+                fprintf(f, ",\"args\":{\"value\":%lld}", e->arg) ;
+            }
+            fputc('}', f) ;
+            first = false ;
+        }
+    }
+    fprintf(f, "\n],\"displayTimeUnit\":\"ns\"}\n") ;
+
+    return fclose(f) == 0 ;
+}
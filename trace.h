@@ -0,0 +1,133 @@
+/** @file trace.h low-overhead event tracing.
+ *
+ *  Trace events are recorded in binary form into a ring buffer owned by
+ *  the thread that records them, so recording takes no lock and does no
+ *  formatting or I/O:  it costs a clock read and a few stores.  When a
+ *  ring is full its oldest events are overwritten.  The rings are written
+ *  out together as a Chrome trace (JSON that chrome://tracing and
+ *  Perfetto can load) by <code>trace_dump</code>.
+ *
+ *  Each event belongs to a category, and only events whose category is in
+ *  <code>trace_mask</code> are recorded.  The mask starts out empty, so
+ *  tracing costs a load and a branch per event until it is turned on.
+ *
+ *  Event names are not copied, so they must outlive the trace; string
+ *  literals are the usual choice.
+ */
+
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdbool.h>
+
+/** Trace categories, which may be or-ed together into a mask.
+ */
+#define TRACE_DEBUG 0x1     // Debugging messages; see debug.h.
+#define TRACE_FRAME 0x2     // Drawing and simulating frames.
+#define TRACE_WORLD 0x4     // Building and installing mazes.
+#define TRACE_ALL 0x7
+
+/** The categories whose events are recorded.  It may be changed at any
+ *  time from any thread.
+ */
+extern unsigned trace_mask ;
+
+/** Record an event, whatever the mask.  Use the functions and macros
+ *  below instead, which check the mask first.
+ *
+ *  @param cat the category of the event.
+ *  @param phase the Chrome trace phase of the event:  'B' or 'E' for the
+ *      beginning or end of a span, 'i' for an instant and 'C' for a
+ *      counter.
+ *  @param name the name of the event.
+ *  @param arg the argument of an instant or the value of a counter.
+ */
+void trace_record(unsigned cat, char phase, const char* name, long long arg) ;
+
+/** Write every event still in the rings to a file as a Chrome trace.
+ *  Threads may go on recording while this runs, but events recorded
+ *  meanwhile may be missing or garbled in the output.
+ *
+ *  @param path the name of the file.
+ *
+ *  @return true if the file was written, false otherwise.
+ */
+bool trace_dump(const char* path) ;
+
+/** Record the beginning of a span.
+ *
+ *  @param cat the category of the span.
+ *  @param name the name of the span.
+ */
+static inline void trace_begin(unsigned cat, const char* name) {
+    if (trace_mask & cat) trace_record(cat, 'B', name, 0) ;
+}
+
+/** Record the end of a span.
+ *
+ *  @param cat the category of the span.
+ *  @param name the name of the span.
+ */
+static inline void trace_end(unsigned cat, const char* name) {
+    if (trace_mask & cat) trace_record(cat, 'E', name, 0) ;
+}
+
+/** Record an instant event.
+ *
+ *  @param cat the category of the event.
+ *  @param name the name of the event.
+ *  @param arg an argument to show with the event.
+ */
+static inline void trace_instant(unsigned cat, const char* name,
+        long long arg) {
+    if (trace_mask & cat) trace_record(cat, 'i', name, arg) ;
+}
+
+/** Record the value of a counter, which the trace viewer graphs over
+ *  time.
+ *
+ *  @param cat the category of the counter.
+ *  @param name the name of the counter.
+ *  @param value the value of the counter.
+ */
+static inline void trace_counter(unsigned cat, const char* name,
+        long long value) {
+    if (trace_mask & cat) trace_record(cat, 'C', name, value) ;
+}
+
+/** A span that ends when it goes out of scope; see
+ *  <code>TRACE_SPAN</code>.  A span that began while its category was
+ *  disabled records no end either, so every end has its beginning.
+ */
+typedef struct _trace_span_t {
+    unsigned cat ;
+    const char* name ;
+} trace_span_t ;
+
+static inline trace_span_t trace_span_begin(unsigned cat, const char* name) {
+    trace_span_t span = {0, name} ;
+    if (trace_mask & cat) {
+        span.cat = cat ;
+        trace_record(cat, 'B', name, 0) ;
+    }
+    return span ;
+}
+
+static inline void trace_span_end(trace_span_t* span) {
+    if (span->cat != 0) trace_record(span->cat, 'E', span->name, 0) ;
+}
+
+#define TRACE_CONCAT_(a, b) a ## b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_(a, b)
+
+/** Trace the rest of the enclosing block as a span, however it is left.
+ *
+ *  @param cat the category of the span.
+ *  @param name the name of the span.
+ */
+#define TRACE_SPAN(cat, name) \
+    trace_span_t TRACE_CONCAT(trace_span_, __LINE__) \
+        __attribute__((cleanup(trace_span_end))) = \
+        trace_span_begin(cat, name)
+
+#endif